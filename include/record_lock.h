@@ -3,45 +3,55 @@
 #include <fcntl.h>
 
 /*
- * RAIIװļ¼
- * ʱöӦlock뿪Զ
- * ע⣬ӦԼֶ
+ * RAII封装的记录锁
+ * 构造时调用对应的lock函数锁定，离开作用域后自动解锁
+ * 拿不到锁时都不会abort，阻塞锁出错时（比如fcntl检测到死锁）打印错误并记下errno，调用者都要用locked检查
+ * 注意，不应该自己手动解锁
  */
 class RecordLock {
 public:
 	/*
-	 * һfdӦļ
-	 * ڶoffsetƫ
-	 * ǲSEEK_SET,SEEK_CUR,SEEK_END
-	 * ĸǳ
-	 * 캯lockҪдlock
+	 * 第一个参数是fd，对应操作的文件描述符
+	 * 第二个参数是offset，相对偏移量
+	 * 第三个参数是操作的起点SEEK_SET,SEEK_CUR,SEEK_END
+	 * 第四个参数是长度
+	 * 构造函数会调用lock上锁，需要重写lock函数
 	 */
 	explicit RecordLock(int, off_t, int, off_t);
 	/*
-	 * un_lock
+	 * 析构函数调用un_lock解锁
 	 */
 	virtual ~RecordLock();
 	int lock_result();
 	int unlock_result();
+	/*
+	 * 是否拿到了锁，没拿到锁时析构不会解锁
+	 */
+	bool locked();
+	/*
+	 * 没拿到锁是不是因为锁被别人占着或者超时，否则是出错了
+	 */
+	bool busy();
 
 protected:
-	char *lockname_;        //Ӧ
-	int fd_;                //Ӧļfd	
-	off_t offset_;          //ƫ
-	int whence_;            //
-	off_t len_;             //
-	int lock_result_;        //lockķؽ
-	int unlock_result_;      //unlockķؽ
+	const char *lockname_;  //对应的锁的名字
+	int fd_;                //对应操作的文件fd	
+	off_t offset_;          //偏移量
+	int whence_;            //起点
+	off_t len_;             //长度
+	int lock_result_;        //调用lock函数的返回结果
+	int unlock_result_;      //调用unlock函数的返回结果
+	int lock_errno_;         //加锁失败时的errno
 	/*
-	 * ͬӦ
+	 * 不同锁对应的锁定函数
 	 */
 	virtual int lock();
 	/*
-	 * ͬǽһĹʸúҪд
+	 * 解锁函数，锁不同但是解锁是一样的故该函数不需要重写
 	 */
 	int un_lock();
 	/*
-	 * ʧܵĴ
+	 * 阻塞锁上锁失败的处理函数，记下errno
 	 */
 	void fail_lock_process();
 	int lock_reg(int, int, int, off_t, int, off_t);
@@ -51,7 +61,37 @@ private:
 };
 
 /*
- * 
+ * 限时锁，第五个参数是锁的类型F_RDLCK或F_WRLCK，第六个参数是最多等待的微秒数
+ * 等待时间为0时和非阻塞锁一样只试一次，小于0时和阻塞锁一样一直等，但是出错时不会abort
+ * fcntl没有带超时的加锁，所以是用非阻塞的方式重试，重试间隔从kLock_retry_min开始翻倍
+ */
+class RecordTimedLock :public RecordLock {
+public:
+	explicit RecordTimedLock(int, off_t, int, off_t, int, long long);
+protected:
+	int type_;               //锁的类型
+	long long timeout_;      //最多等待的微秒数
+	virtual int lock();
+};
+
+/*
+ * 限时读锁
+ */
+class RecordTimedReadLock :public RecordTimedLock {
+public:
+	explicit RecordTimedReadLock(int, off_t, int, off_t, long long);
+};
+
+/*
+ * 限时写锁
+ */
+class RecordTimedWriteLock :public RecordTimedLock {
+public:
+	explicit RecordTimedWriteLock(int, off_t, int, off_t, long long);
+};
+
+/*
+ * 非阻塞读锁
  */
 class RecordReadLock :public RecordLock {
 public:
@@ -61,7 +101,7 @@ protected:
 };
 
 /*
- * 
+ * 阻塞读锁
  */
 class RecordReadwLock :public RecordLock {
 public:
@@ -71,7 +111,7 @@ protected:
 };
 
 /*
- * д
+ * 非阻塞写锁
  */
 class RecordWriteLock :public RecordLock {
 public:
@@ -81,7 +121,7 @@ protected:
 };
 
 /*
- * д
+ * 阻塞写锁
  */
 class RecordWritewLock :public RecordLock {
 public:
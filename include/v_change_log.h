@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace vDB {
+
+class DB;
+
+const char kChange_store = 'S';     //变更记录的操作，写入
+const char kChange_delete = 'D';    //变更记录的操作，删除
+
+/*
+ * 只追加的变更日志，文件为pathname.clog，DB的每次修改成功后追加一条
+ * 文件开头是kChange_header_size字节的文件头，之后是一条接一条的记录
+ * 文件头里依次是标志，下一个序号，已经检查过的位置，第一条保留的记录的位置和已经截掉的最后一个序号
+ * 记录是序号(8)+操作(1)+key长度(4)+value长度(4)+校验和(4)+key+value，整数都是小端的
+ * 操作为kChange_store时value是修改后的完整value，为kChange_delete时没有value，重放是幂等的
+ * 追加时锁住文件头的第一个字节，多个进程写同一个数据库时序号也是全局递增的
+ * 调用者在持有hash链写锁的时候追加，所以同一个key的记录顺序和实际修改的顺序一致
+ * 崩溃或者磁盘满时末尾可能留下不完整的记录，以读写方式打开时会截掉，追加失败时也会截回原来的长度
+ * 打开时只检查上次检查过的位置之后的记录，中间的记录校验和不对说明文件损坏了，打开会失败而不是截掉后面的记录
+ * 所有跟随者都应用过的记录可以用log_trim截掉，截掉的部分在文件系统支持时会打洞释放空间，位置不变
+ */
+class ChangeLog {
+public:
+	explicit ChangeLog();
+	ChangeLog(const ChangeLog&) = delete;
+	virtual ~ChangeLog();
+	/*
+	 * 打开日志文件，第二个参数是open的标志，带O_CREAT时不存在就创建
+	 * 成功返回true，失败或者不存在返回false
+	 */
+	bool log_open(const std::string&, int);
+	void log_close();
+	/*
+	 * 追加一条记录，第一个参数是操作
+	 * 成功返回true，失败返回false
+	 */
+	bool log_append(char, const std::string&, const std::string&);
+	/*
+	 * 最后一条记录的序号，没有记录时为0，出错返回-1
+	 */
+	long long log_sequence();
+	/*
+	 * 把序号大于第二个参数的记录原样写到fd，fd可以是管道
+	 * 返回写出的最后一条记录的序号，没有新记录时返回第二个参数，出错返回-1
+	 * 反复调用就可以把日志持续地推给管道另一头的LogFollower
+	 */
+	long long log_copy(int, long long);
+	/*
+	 * 截掉序号不大于第一个参数的记录，调用者要保证所有跟随者都已经应用过这些记录
+	 * 之后从更小的序号开始跟随或者log_copy都会失败
+	 * 成功返回true，失败返回false
+	 */
+	bool log_trim(long long);
+private:
+	int fd_;                   //日志文件的fd
+	long long copy_sequence_;  //log_copy上次读到的最后一条记录的序号
+	off_t copy_offset_;        //这条记录之后的位置，下次从这里接着找
+
+	bool _log_repair();
+};
+
+/*
+ * 跟随者，从日志文件或者管道读出变更记录，应用到自己的数据库副本上
+ * 一般先用db_restore导入db_dump导出的流，得到导出时的序号，再从这个序号开始跟随
+ * fd是普通文件时就是日志文件本身，从文件头之后开始读，读到不完整的记录会停下来，下次从这条记录的开头重新读
+ * fd是管道时读的是log_copy写出的记录，没有数据时会阻塞
+ */
+class LogFollower {
+public:
+	explicit LogFollower();
+	LogFollower(const LogFollower&) = delete;
+	virtual ~LogFollower();
+	/*
+	 * 第一个参数是日志文件或者管道，第二个参数是已经应用过的序号，序号不大于它的记录会被跳过
+	 * 日志文件里需要的记录已经被log_trim截掉时失败
+	 * 成功返回true，失败返回false
+	 */
+	bool follower_open(int, long long);
+	/*
+	 * 最多应用第二个参数条记录到第一个参数上
+	 * 返回应用的记录数，没有新记录时返回0，出错返回-1
+	 */
+	int follower_apply(DB&, int);
+	/*
+	 * 已经应用过的最后一条记录的序号
+	 */
+	long long follower_sequence();
+private:
+	int fd_;                   //日志文件或者管道
+	bool file_;                //fd_是不是普通文件
+	off_t offset_;             //普通文件时下一次读的位置
+	long long sequence_;       //已经应用过的序号
+	std::string pending_;      //读到了但是还没应用的字节
+
+	bool _follower_fill();
+};
+
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace vDB {
+
+/*
+ * 计算CRC32C（Castagnoli多项式），第一个参数是上一段的结果，从头计算时传0
+ * cpu支持SSE4.2时用crc32指令，否则用slicing-by-8查表，第一次调用时选定实现
+ */
+uint32_t crc32c(uint32_t, const void*, size_t);
+
+}
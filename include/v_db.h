@@ -1,33 +1,71 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <sys/uio.h>
 #include <functional>
 
+struct z_stream_s;
+
+namespace vDB {
+class SharedCache;
+class BufferPool;
+class ChangeLog;
+}
+
 namespace vDB {
 
 /*
- * db_storeĺϷ־
- * INSERT
- * REPLACE滻
- * STORE滻
+ * db_store的合法标志
+ * INSERT插入
+ * REPLACE替换
+ * STORE替换或插入
  */
 enum DB_STORE_FLAG{STORE_MIN_FLAG, DB_INSERT, DB_REPLACE, DB_STORE, STORE_MAX_FLAG};
 
-const int kIndex_min = 6;     //indexСΪ6keysepstartseplength\n
-const int kIndex_max = 1024;  //index󳤶ȣԼ
-const int kData_min = 2;      //dataСΪ2һֽڼһз
-const int kData_max = 1024;   //data󳤶ȣԼ
+/*
+ * 读记录时校验校验和的方式，参考db_set_verify
+ * OFF不校验
+ * SAMPLED抽样校验
+ * ALWAYS每条都校验
+ */
+enum DB_VERIFY_FLAG{VERIFY_OFF, VERIFY_SAMPLED, VERIFY_ALWAYS};
+
+const int kIndex_min = 12;    //index长度最小为12，7字节的data偏移量，4字节的data长度，key至少一个字节
+const int kIndex_max = 1024;  //index最大长度，这个可以自己调节
+const int kData_min = 2;      //data的最小长度为2，一个字节的标志加至少一个字节的value
+const int kData_max = 1024;   //data的最大长度，可以自己调节
+const int kDB_busy = -2;      //try系列接口在限定时间内拿不到锁时的返回值
 
 using std::string;
 
-typedef unsigned int DBHASH;       //hashֵ
+typedef unsigned int DBHASH;       //hash值类型
+
+/*
+ * 数据库的统计信息，只统计当前句柄写入的记录
+ */
+struct DBStats {
+	long long raw_bytes;           //写入的value的原始字节数
+	long long stored_bytes;        //value实际写入.dat的字节数，不含标志和换行符
+	long long compressed_records;  //压缩存储的记录数
+	long long raw_records;         //原样存储的记录数
+	double compression_ratio;      //压缩率，raw_bytes / stored_bytes
+	long long cache_hits;          //共享缓存命中的次数，包括hash链的头指针和index记录
+	long long cache_misses;        //共享缓存没有命中的次数
+	long long pool_hits;           //缓冲池命中的页数
+	long long pool_misses;         //缓冲池没有命中、需要读文件或者淘汰的页数
+	long long checksum_errors;     //读记录时发现的校验和错误
+	long long lookups;             //在hash链上查找key的次数
+	long long lookup_visits;       //查找时读过的链表节点数，除以lookups就是平均每次查找走过的节点数
+	long long promotions;          //自适应模式下挪到链头的次数
+	long long log_errors;          //修改已经写进数据库但是追加变更日志失败的次数，跟随者看不到这些修改
+};
 
 /*
- * һkey->valueݿ⣬ݿ򿪺ļ.idx.datļ
- * .idx洢keyصϢ.dat洢
- * keyvalueΪstring
- * ע⣬lseekԶͬһ˵Щӿڶǲ
+ * 一个key->value数据库，数据库打开后会生成两个文件.idx和.dat文件
+ * .idx存储key和其他相关的信息，.dat存储真正的数据
+ * key和value均为string类型，可以包含任意字节，记录都是带长度的，没有分隔符和结束符
+ * 注意，读写共用句柄里的缓冲区，所以对同一个对象来说这些接口都是不可重入的
  */
 class DB {
 public:
@@ -35,63 +73,265 @@ public:
 	DB(const DB&) = delete;
 	virtual ~DB();
 	/*
-	 * 򿪻ߴݿ⣬openϵͳһ
-	 * ɹTrueʧܷFalse
+	 * 打开或者创建数据库，参数与open系统调用一致
+	 * 成功返回True失败返回False
 	 */
 	virtual bool db_open(const string&, int, ...);
 	/*
-	 * ݿķ
+	 * 放弃对数据库的访问
 	 */
 	virtual void db_close();
 	/*
-	 * keyȡӦvalue򷵻ؿstring
+	 * 用key获取对应的value，不存在则返回空string
 	 */
 	virtual string db_fetch(const string&);
 	/*
-	 * ɾָkeyļ¼
-	 * ɹtrueʧܷfalse
+	 * 一次查找多个key，value按顺序写到第二个参数里，不存在的key对应空string
+	 */
+	virtual void db_multi_fetch(const std::vector<string>&, std::vector<string>&);
+	/*
+	 * 删除指定key的记录
+	 * 成功返回true失败返回false
 	 */
 	virtual bool db_delete(const string&);
 	/*
-	 * Ѽ¼洢ݿ
-	 * һkeyڶvalueǲı־
-	 * ɹ0󷵻-1ڶָDB_INSERT򷵻1
+	 * 把记录存储到数据库中
+	 * 第一个参数是key，第二个参数是value，第三个是操作的标志
+	 * 成功返回0，错误返回-1，如果存在而且指定了DB_INSERT则返回1
 	 */
 	virtual int db_store(const string&, const string&, int);
+	/*
+	 * 限时的db_fetch，第三个参数是等锁最多的微秒数，0表示拿不到锁立即返回
+	 * 找到返回0，value写到第二个参数，不存在返回1，错误返回-1，拿不到锁返回kDB_busy
+	 * 调用者可以据此放弃这次请求或者返回旧数据，而不是排在慢的写操作后面
+	 */
+	virtual int db_try_fetch(const string&, string&, long long);
+	/*
+	 * 限时的db_store，前三个参数和返回值与db_store一样，第四个参数和db_try_fetch一样
+	 * 拿不到锁返回kDB_busy，这时数据库没有被修改
+	 */
+	virtual int db_try_store(const string&, const string&, int, long long);
+	/*
+	 * 原子地修改一条记录，查找、读出、写回都在同一个hash链的写锁里完成
+	 * 第二个参数的第一个参数表示key是否存在，第二个参数传入当前的value（不存在时为空），修改后的value也写回这里
+	 * 第二个参数返回false表示放弃修改
+	 * 写入成功返回0，放弃修改返回1，错误返回-1
+	 */
+	virtual int db_update(const string&, const std::function<bool(bool, string&)>&);
+	/*
+	 * 把value当作十进制整数加上第二个参数，不存在的key当作0，结果写到第三个参数
+	 * value不是整数或者结果溢出时失败，value不变
+	 * 成功返回true，失败返回false
+	 */
+	bool db_increment(const string&, long long, long long&);
+	/*
+	 * 在value后面追加第二个参数，不存在的key当作空value
+	 * 成功返回true，失败返回false
+	 */
+	bool db_append(const string&, const string&);
+	/*
+	 * 当前value等于第二个参数时改成第三个参数，第二个参数为空表示key必须不存在
+	 * 替换成功返回0，value不一致返回1，错误返回-1
+	 */
+	int db_compare_and_swap(const string&, const string&, const string&);
+	/*
+	 * 批量导入，只能对空数据库使用
+	 * 参数是一个生成器，每次调用填入一对key和value，返回false表示没有更多数据
+	 * key必须严格递增，这样不用额外的内存就能保证没有重复的key
+	 * 两个文件都是大块顺序写入，hash表在最后一次性写入
+	 * 成功返回true，失败返回false，失败时数据库会恢复成空库
+	 */
+	virtual bool db_bulk_load(const std::function<bool(string&, string&)>&);
+	/*
+	 * 创建数据库当前时刻的快照，并以只读方式打开到第二个参数上
+	 * 第一个参数是快照的路径，会生成对应的.idx和.dat文件
+	 * 文件系统支持reflink时克隆几乎不花时间，之后的写操作由文件系统写时复制
+	 * 否则会拷贝整个文件，拷贝期间写操作会被阻塞
+	 * 成功返回true，失败返回false
+	 */
+	virtual bool db_snapshot(const string&, DB&);
+	/*
+	 * 用样本训练一个压缩字典并写入数据库头部，之后写入的value都会尝试用字典压缩
+	 * 只能对空数据库使用，一般是创建数据库后马上调用
+	 * 每条记录都带有是否压缩的标志，压缩后没有变小的value会原样存储
+	 * 成功返回true，失败返回false
+	 */
+	virtual bool db_train_dictionary(const std::vector<string>&);
+	/*
+	 * 返回当前句柄的统计信息
+	 */
+	virtual DBStats db_stats();
+	/*
+	 * 遍历所有记录，对每个key和value调用参数，参数返回false时提前结束
+	 * 遍历的顺序不固定，遍历期间写操作会被阻塞
+	 * 成功返回true，失败返回false
+	 */
+	virtual bool db_scan(const std::function<bool(const string&, const string&)>&);
+	/*
+	 * 开启多进程共享的index缓存，参数是缓存的index记录个数
+	 * 缓存已经存在时直接连接，之后打开这个数据库的句柄也会自动连接
+	 * 所有写这个数据库的句柄都必须连上同一个缓存，所以应该在其他进程打开数据库之前开启
+	 * 成功返回true，失败返回false
+	 */
+	virtual bool db_share_cache(int);
+	/*
+	 * 删除共享缓存，已经连上的句柄不受影响，之后打开的句柄不再自动连接
+	 */
+	virtual bool db_remove_cache();
+	/*
+	 * 开启用户态的缓冲池，参数是内存预算的字节数
+	 * 两个文件会用O_DIRECT重新打开，读写都经过缓冲池，不再经过内核的页缓存
+	 * 脏页只在本进程里，所以开启后这个句柄独占数据库，其他句柄已经打开时会失败，之后也打不开
+	 * 失败后拿不回原来的共享flock时句柄会被关掉，调用者需要重新打开
+	 * 成功返回true，失败返回false
+	 */
+	virtual bool db_buffer_pool(size_t);
+	/*
+	 * 把缓冲池里的脏页写回文件并落盘，没有开启缓冲池时什么都不做
+	 * 关闭数据库时会自动调用
+	 * 成功返回true，失败返回false
+	 */
+	virtual bool db_flush();
+	/*
+	 * 设置读记录时如何校验校验和，参数是DB_VERIFY_FLAG，默认是VERIFY_ALWAYS
+	 * VERIFY_ALWAYS时查找沿途的每个index节点都会校验，抽样时只校验找到的那个节点
+	 * 放进共享缓存的index记录不论哪种方式都先校验过
+	 * 每条index记录和data记录写入时都带有CRC32C，校验失败的记录当作读取失败
+	 * 成功返回true，参数不合法返回false
+	 */
+	bool db_set_verify(int);
+	/*
+	 * 用多个线程校验所有hash链和空闲链表上的记录，第一个参数是线程数
+	 * 每条链只在校验时加读锁，不会长时间挡住写操作
+	 * 校验过的记录数和出错的记录数写到后两个参数，出错的记录会打印出偏移量
+	 * 同一条链上重复的key和哪条链都走不到的index节点也算出错
+	 * 读文件出错返回false，否则返回true，有损坏的记录时也返回true，调用者要检查出错的记录数
+	 */
+	bool db_verify(int, long long&, long long&);
+	/*
+	 * 开启自适应的hash链，db_fetch找到的key不在链头附近时，按1/参数的概率把它挪到链头
+	 * 常被访问的key很快会被抽中，冷的key很少被挪动，这样控制了额外的写
+	 * 参数为0表示关闭，默认关闭，只读打开时不会挪动
+	 * 成功返回true，参数不合法返回false
+	 */
+	bool db_set_adaptive(int);
+	/*
+	 * 把所有记录导出成紧凑的流写到第一个参数，可以是文件或者管道，第二个参数是线程数
+	 * 流里只有存在的记录，value是解压后的原文，不含删除留下的空洞和空闲链表，可以导入任何存储引擎
+	 * 流分成带校验和的块，整数都是小端的，以一个空块结束
+	 * 每条hash链只在读它的时候加读锁，不会长时间挡住写操作，所以导出的不是同一时刻的状态，需要的话先做快照
+	 * 成功返回true，失败返回false
+	 */
+	virtual bool db_dump(int, int);
+	/*
+	 * 从第一个参数读入db_dump导出的流，只能对空数据库使用，导出时的变更日志序号写到第二个参数
+	 * DB直接按db_bulk_load的方式顺序写出两个文件，块的校验和不对或者流没有结束时失败，失败时恢复成空库
+	 * 成功返回true，失败返回false
+	 */
+	virtual bool db_restore(int, long long&);
+	/*
+	 * 开启变更日志pathname.clog，之后每次成功的db_store，db_delete，db_update都会追加一条带序号的记录
+	 * 日志已经存在时直接打开，之后打开这个数据库的句柄也会自动打开，所以应该在其他进程打开数据库之前开启
+	 * 批量导入和db_restore不写日志，跟随者应该从之后的db_dump开始
+	 * 日志追加在修改之后，追加失败时db_store，db_update返回-1，db_delete返回false，但是修改已经生效了
+	 * 这种情况记在db_stats的log_errors里，这时副本已经和主库不一致，需要重新从db_dump开始跟随
+	 * 用O_TRUNC重新创建数据库时旧的日志会被删除
+	 * 成功返回true，失败返回false
+	 */
+	virtual bool db_change_log();
+	/*
+	 * 变更日志里最后一条记录的序号，没有开启日志时为0，出错返回-1
+	 */
+	long long db_sequence();
+	/*
+	 * 截掉变更日志里序号不大于参数的记录，调用者要保证所有跟随者都已经应用过
+	 * 成功返回true，没有开启日志或者失败返回false
+	 */
+	bool db_trim_log(long long);
+protected:
+	/*
+	 * 把fd对应的文件完整地复制到第二个参数，其他存储引擎做快照时也会用到
+	 */
+	bool _db_clone_file(int, const string&);
+	/*
+	 * 通用的导出和导入，其他存储引擎用db_scan导出，导入时对每条记录调用第二个参数，返回false时停止
+	 */
+	bool _db_dump_scan(int);
+	bool _db_restore_read(int, long long&, const std::function<bool(string&, string&)>&);
 private:
-	string pathname_;          //ݿ·
-	//һζдindex¼ʱǰһڵͺһڵƫ
+	string pathname_;          //数据库路径
+	bool readonly_;            //是否以只读方式打开
+	string dict_;              //压缩字典，为空表示没有开启压缩
+	struct z_stream_s *deflate_stream_, *inflate_stream_;   //压缩和解压用的z_stream
+	DBStats stats_;            //统计信息
+	SharedCache *cache_;       //共享的index缓存，没有开启时为空
+	BufferPool *pool_;         //用户态的缓冲池，没有开启时为空
+	ChangeLog *change_log_;    //变更日志，没有开启时为空
+	int verify_;               //校验方式
+	unsigned verify_count_;    //抽样校验的计数
+	string index_crc_;         //最后一次从文件读出、还没有校验的index记录的校验和，已经校验过或者命中共享缓存时为空
+	bool index_error_;         //最后一次_db_find是否因为读错误、校验和错误或者损坏的ptr停下，这时没找到不代表不存在
+	int adaptive_;             //自适应模式的抽样比例，0表示关闭
+	unsigned adaptive_seed_;   //抽样用的随机数状态
+	int find_depth_;           //最后一次_db_find找到的节点前面有几个节点
+	//最后一次读写index记录时的前一个节点和后一个节点的偏移量
 	off_t pre_offset_, next_offset_;
-	//db_storeͬflagӦӳ亯
+	int key_length_;           //最后一次读取的index记录中key的长度
+	//db_store不同flag对应的映射函数
 	std::function<int(const string&, const string&, bool, off_t)> store_function_map[STORE_MAX_FLAG];
 
 	struct Handle {
-		int fd;                //ļ
-		off_t offset;          //һζд¼ʱƫ
-		int length;            //һζдļ¼
-		char *buffer;          //д¼ʱõĻ
-	}index_, data_;            //idxļdatļ
+		int fd;                //文件描述符
+		off_t offset;          //最后一次读写记录时的偏移量
+		int length;            //最后一次读写的记录长度
+		int capacity;          //最后一次读写的记录所占的空间，只用于data记录
+		char *buffer;          //读写记录时用的缓冲区
+	}index_, data_;            //idx文件和dat文件
 
 	void _db_bind_function();
 	bool _db_allocate();
 	void _db_free();
 	DBHASH _db_hash(const string&);
 	bool _db_find(const string&, off_t);
+	bool _db_log_change(char, const string&, const string&);
+	bool _db_should_promote();
+	void _db_move_to_front(const string&, off_t);
 	off_t _db_read_ptr(off_t);
 	off_t _db_read_idx(off_t);
-	char *_db_read_data();
+	bool _db_parse_idx();
+	bool _db_should_verify();
+	bool _db_verify_idx();
+	void _db_count_data(const string&, const string&, DBStats&);
+	long long _db_verify_reached(std::vector<off_t>&, off_t);
+	bool _db_check_idx();
+	string _db_read_data();
 	bool _db_do_delete();
-	bool _db_write_data(const char*, off_t, int);
-	bool _db_lock_and_write_data(const char*, off_t, int);
-	bool _db_write_idx(const char*, off_t, int, off_t);
-	bool _db_lock_and_write_idx(const char*, off_t, int, off_t);
-	bool _db_pre_write_idx(const char*, off_t, struct iovec*, char*);
+	bool _db_write_data(const string&, off_t, int);
+	int _db_data_capacity(int);
+	bool _db_lock_and_write_data(const string&, off_t, int);
+	bool _db_write_idx(const string&, off_t, int, off_t);
+	bool _db_lock_and_write_idx(const string&, off_t, int, off_t);
+	bool _db_pre_write_idx(const string&, off_t, struct iovec*, char*);
+	int _db_format_idx(char*, const string&, off_t, int);
 	bool _db_do_write_idx(off_t, int, struct iovec*);
 	bool _db_write_ptr(off_t, off_t);
 	int _db_store_insert(const string&, const string&, bool, off_t);
 	int _db_store_replace(const string&, const string&, bool, off_t);
 	int _db_store_ins_or_rep(const string&, const string&, bool, off_t);
 	bool _db_find_and_delete_free(int, int);
+	ssize_t _db_pread(int, void*, size_t, off_t);
+	ssize_t _db_pwrite(int, const void*, size_t, off_t);
+	ssize_t _db_pwritev(int, const struct iovec*, int, off_t);
+	off_t _db_file_size(int);
+	bool _db_truncate(int, off_t);
+	bool _db_bulk_load(const std::function<bool(string&, string&)>&, const bool*);
+	bool _db_bulk_write(const std::function<bool(string&, string&)>&, const bool*);
+	bool _db_bulk_flush(int, string&, off_t&);
+	string _db_build_dict(const std::vector<string>&);
+	bool _db_load_dict();
+	bool _db_init_stream();
+	bool _db_encode_data(const string&, string&);
+	bool _db_decode_data(const char*, int, string&);
 };
 
 }
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace vDB {
+
+/*
+ * 多个进程共享的index缓存，放在以.idx文件的设备号和inode号命名的POSIX共享内存里
+ * 缓存两样东西：hash表里每条链的头指针，以及最近读过的index记录
+ * index记录按偏移量直接映射到槽上，每个槽带一个版本号（seqlock）
+ * 版本号为奇数表示正在写，读的一方前后两次读到同一个偶数版本号才算命中
+ * 写槽的一方先把自己的pid写进槽的owner，写的进程崩溃后其他进程能靠pid发现并接手
+ * DB的读写本来就持有对应hash链的记录锁，缓存只需要处理不同链映射到同一个槽的情况
+ * 所以缓存省掉的只是读文件的pread，每次查找仍然要付fcntl加锁解锁的代价，进程间的协调并没有比fcntl便宜
+ * 注意，同一个数据库的所有句柄都要连上缓存，否则没连上的句柄写入后其他进程会读到旧数据
+ */
+class SharedCache {
+public:
+	explicit SharedCache();
+	SharedCache(const SharedCache&) = delete;
+	virtual ~SharedCache();
+	/*
+	 * 连接fd对应的.idx文件的共享缓存
+	 * 第二个参数是index记录槽的个数，会向上取整到2的幂，为0表示只连接已经存在的缓存
+	 * 第三个参数是hash表的大小
+	 * 成功返回true，失败或者不存在返回false
+	 */
+	bool cache_attach(int, int, int);
+	void cache_detach();
+	/*
+	 * 删除fd对应的共享缓存，已经连上的进程不受影响
+	 */
+	static bool cache_remove(int);
+	/*
+	 * 读写第i条hash链的头指针
+	 * 调用前需要持有这条链的锁，cache_get_bucket命中返回true
+	 */
+	bool cache_get_bucket(int, off_t&);
+	void cache_set_bucket(int, off_t);
+	/*
+	 * 读取偏移量为offset的index记录，命中时把记录写到buffer，长度写到length，下一个节点写到next
+	 * 返回是否命中
+	 */
+	bool cache_get_node(off_t, char*, int&, off_t&);
+	/*
+	 * 放入一条刚从文件读出的index记录，槽正在被别人写或者记录太长时直接放弃
+	 */
+	void cache_put_node(off_t, const char*, int, off_t);
+	/*
+	 * offset处的index记录被修改了，把对应的槽作废
+	 * 不能放弃，槽正在被写时退避等待，写的进程已经不在了就接手这个槽
+	 */
+	void cache_invalidate_node(off_t);
+	/*
+	 * 作废所有内容，批量导入等直接改写文件的操作之后调用，调用前需要锁住整个文件
+	 */
+	void cache_reset();
+private:
+	struct Header;
+	struct Node;
+	Header *header_;           //共享内存的起始地址
+	int64_t *buckets_;         //hash链的头指针，0表示没有缓存，否则是指针加1
+	Node *nodes_;              //index记录槽
+	size_t size_;              //共享内存的大小
+
+	Node* _cache_node(off_t);
+	bool _cache_lock_node(Node*, bool);
+	void _cache_unlock_node(Node*);
+	static std::string _cache_name(int);
+};
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "v_db_protocol.h"
+
+#include <deque>
+
+namespace vDB {
+
+/*
+ * vdb-server的客户端
+ * 同步接口每次发送一个请求并等待回复
+ * 流水线接口先用client_send把请求放进缓冲区，client_flush一次发出，再用client_receive按顺序取回复
+ * 注意，同一个对象不能在多个线程中同时使用
+ */
+class Client {
+public:
+	explicit Client();
+	Client(const Client&) = delete;
+	virtual ~Client();
+	/*
+	 * 连接服务器，参数是ip和端口
+	 * 成功返回true，失败返回false
+	 */
+	bool client_connect(const string&, int);
+	void client_close();
+	/*
+	 * 同步接口，返回服务器的状态码，网络错误返回-1
+	 * client_get查找成功时把value写到第二个参数
+	 * client_mget把value按顺序写到第二个参数，不存在的key对应空string
+	 */
+	int client_get(const string&, string&);
+	int client_set(const string&, const string&);
+	int client_del(const string&);
+	int client_mget(const std::vector<string>&, std::vector<string>&);
+	/*
+	 * 流水线接口
+	 * client_send只写缓冲区，client_flush把缓冲区全部发出
+	 * client_receive按请求的顺序读取下一个回复，缓冲区里还有未发出的请求时会先发出
+	 * 成功返回true，失败返回false
+	 */
+	void client_send(const Request&);
+	bool client_flush();
+	bool client_receive(Response&);
+	/*
+	 * 还没有收到回复的请求数
+	 */
+	size_t client_outstanding();
+private:
+	int fd_;                   //连接的fd
+	string output_;            //还没发出的请求
+	string input_;             //已经收到但还没解析的数据
+	std::deque<int> ops_;      //还没收到回复的请求的操作码，用于解析回复
+
+	int _client_call(const Request&, Response&);
+};
+
+}
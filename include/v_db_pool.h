@@ -0,0 +1,100 @@
+#pragma once
+
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <sys/types.h>
+
+namespace vDB {
+
+/*
+ * 用户态的页缓冲池，文件按kPage_size大小的页读写，文件本身用O_DIRECT打开，不经过内核的页缓存
+ * 替换算法是简化的2Q：新读入的页先进A1队列（先进先出），在另一次操作里再被访问才进入Am
+ * Am用CLOCK淘汰，每个文件可以设置页的权重，权重高的页（index文件）要多转几圈才会被淘汰
+ * 同一次操作里的重复访问不算，所以一次大的扫描只会冲刷A1，不会冲掉Am里的热页
+ * 写操作只修改缓冲池里的页，淘汰脏页时连同其他脏页一起按偏移量排序后批量写回
+ * 注意，脏页在写回之前只存在于本进程，所以使用缓冲池的句柄必须独占数据库
+ */
+class BufferPool {
+public:
+	explicit BufferPool();
+	BufferPool(const BufferPool&) = delete;
+	virtual ~BufferPool();
+	/*
+	 * 分配缓冲池，参数是内存预算的字节数，至少会有kPool_min个页
+	 * 成功返回true，失败返回false
+	 */
+	bool pool_open(size_t);
+	/*
+	 * 释放缓冲池，不会写回脏页
+	 */
+	void pool_close();
+	/*
+	 * 登记一个文件，第二个参数是它的页在CLOCK中的权重
+	 * 成功返回true，失败返回false
+	 */
+	bool pool_add_file(int, int);
+	/*
+	 * 和pread，pwrite语义一样，读到文件末尾会返回较少的字节数
+	 */
+	ssize_t pool_pread(int, void*, size_t, off_t);
+	ssize_t pool_pwrite(int, const void*, size_t, off_t);
+	/*
+	 * 文件的逻辑大小，包括还没写回的部分
+	 */
+	off_t pool_size(int);
+	bool pool_truncate(int, off_t);
+	/*
+	 * 写回所有脏页，再把文件截断成逻辑大小
+	 * 成功返回true，失败返回false
+	 */
+	bool pool_flush();
+	/*
+	 * 开始一次新的操作，同一次操作里的重复访问不会让页进入Am
+	 */
+	void pool_tick();
+	long long pool_hits();
+	long long pool_misses();
+private:
+	/*
+	 * 一个页框
+	 */
+	struct Frame {
+		int file;                      //所属文件在files_中的下标，-1表示空闲
+		off_t page;                    //页号
+		char *data;                    //页的内容，按页对齐
+		bool dirty;                    //是否被修改过
+		bool hot;                      //是否在Am里
+		int usage;                     //CLOCK的计数
+		unsigned long long tick;       //最后一次访问时的操作号
+		std::list<int>::iterator a1;   //在A1中的位置
+	};
+	/*
+	 * 登记过的文件
+	 */
+	struct File {
+		int fd;
+		off_t size;                    //逻辑大小
+		off_t disk_size;               //磁盘上的大小
+		int weight;                    //页的权重
+	};
+
+	char *memory_;                                   //所有页框的内存
+	std::vector<Frame> frames_;
+	std::vector<int> free_;                          //空闲的页框
+	std::unordered_map<unsigned long long, int> table_;   //(文件, 页号)->页框
+	std::list<int> a1_;                              //A1队列，队头最老
+	size_t hand_;                                    //CLOCK的指针
+	unsigned long long tick_;                        //当前的操作号
+	std::vector<File> files_;
+	long long hits_, misses_;
+
+	int _pool_file(int);
+	int _pool_get(int, off_t, bool);
+	int _pool_victim();
+	void _pool_touch(Frame&);
+	void _pool_drop(int);
+	bool _pool_write_back(std::vector<int>&);
+};
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace vDB {
+
+/*
+ * vdb-server使用的二进制协议
+ * 每一帧的结构是4字节的长度（网络字节序，不含自身）+1字节的操作码或状态码+内容
+ * 请求的内容：
+ * GET，DEL：key
+ * SET：4字节的key长度+key+value
+ * MGET：4字节的key个数+若干个(4字节的key长度+key)
+ * 回复的内容：
+ * GET：value，SET和DEL：无
+ * MGET：4字节的value个数+若干个(4字节的value长度+value)，长度为0表示不存在
+ * 同一个连接上的回复和请求顺序一致，所以客户端可以连续发送多个请求（流水线）
+ */
+enum PROTOCOL_OP{OP_MIN, OP_GET, OP_SET, OP_DEL, OP_MGET, OP_MAX};
+enum PROTOCOL_STATUS{STATUS_OK, STATUS_NOT_FOUND, STATUS_ERROR};
+
+const int kFrame_header_size = 5;          //帧头的大小，长度+操作码
+const uint32_t kFrame_max = 1 << 20;       //一帧的最大长度
+
+using std::string;
+
+struct Request {
+	int op;                          //操作码
+	std::vector<string> keys;        //GET，SET，DEL只有一个key
+	string value;                    //SET的value
+};
+
+struct Response {
+	int status;                      //状态码
+	std::vector<string> values;      //GET只有一个value，MGET中不存在的key对应空string
+};
+
+/*
+ * 把请求编码后追加到第二个参数
+ */
+void encode_request(const Request&, string&);
+/*
+ * 从缓冲区解出一个请求
+ * 返回消耗的字节数，数据不完整返回0，格式错误返回-1
+ */
+int decode_request(const char*, size_t, Request&);
+/*
+ * 把op对应的回复编码后追加到最后一个参数
+ * 编码后超过kFrame_max时改成编码一个STATUS_ERROR的回复，比如value太多的MGET
+ */
+void encode_response(int, const Response&, string&);
+/*
+ * 从缓冲区解出一个op对应的回复，返回值同decode_request
+ */
+int decode_response(int, const char*, size_t, Response&);
+
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "v_db.h"
+#include "v_db_protocol.h"
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <pthread.h>
+#include <stdint.h>
+
+namespace vDB {
+
+/*
+ * 独占一个数据库的服务器，协议参考v_db_protocol.h
+ * 主线程跑epoll事件循环，负责收发和解析
+ * 同一个连接上一次读到的所有请求会打包成一个批次交给工作线程
+ * 工作线程把批次里连续的GET和MGET合并成一次db_multi_fetch，连续的SET和DEL在一次加锁里完成
+ * 每个连接同时只有一个批次在执行，所以回复的顺序和请求一致
+ */
+class Server {
+public:
+	explicit Server();
+	Server(const Server&) = delete;
+	virtual ~Server();
+	/*
+	 * 打开数据库并监听端口
+	 * 参数依次是数据库路径，端口，工作线程数，是否重新创建数据库
+	 * 成功返回true，失败返回false
+	 */
+	bool server_open(const string&, int, int, bool);
+	/*
+	 * 运行事件循环，直到server_stop被调用
+	 */
+	void server_run();
+	/*
+	 * 让事件循环退出，可以在信号处理函数中调用
+	 */
+	void server_stop();
+	/*
+	 * 停止工作线程并释放资源
+	 */
+	void server_close();
+private:
+	struct Connection {
+		int fd;                          //连接的fd
+		uint64_t id;                     //连接的编号，fd会被复用所以用编号区分连接
+		string input;                    //已经收到但还没解析的数据
+		string output;                   //还没发出的回复
+		std::deque<Request> pending;     //已经解析但还没执行的请求
+		bool busy;                       //是否有批次正在执行
+		bool reading;                    //是否在监听可读事件，积压太多请求时暂停读
+		bool closed;                     //连接已经关闭，等正在执行的批次结束后释放
+		bool eof;                        //对方已经不再发送，积压的请求都回复完后关闭
+	};
+
+	struct Task {
+		uint64_t id;                     //所属连接的编号
+		std::vector<Request> requests;   //这个批次的请求
+		string output;                   //编码好的回复
+	};
+
+	int listen_fd_;            //监听的fd
+	int epoll_fd_;             //epoll的fd
+	int event_fd_;             //工作线程完成任务或者server_stop时用来唤醒事件循环
+	std::atomic<bool> running_;
+	bool stopping_;            //工作线程是否应该退出
+	uint64_t next_id_;         //下一个连接的编号
+	std::unordered_map<uint64_t, Connection*> connections_;
+	std::vector<uint64_t> closed_;   //这一轮事件处理中关闭的连接
+
+	std::vector<DB*> dbs_;     //每个工作线程一个数据库句柄
+	std::vector<std::thread> workers_;
+	/*
+	 * 记录锁是进程级的，同一个进程里的线程之间不互斥
+	 * 所以线程之间用读写锁保护数据库
+	 */
+	pthread_rwlock_t db_lock_;
+	std::mutex task_mutex_;
+	std::condition_variable task_cond_;
+	std::deque<Task*> tasks_;  //等待执行的批次
+	std::mutex done_mutex_;
+	std::deque<Task*> done_;   //执行完的批次
+
+	void _server_accept();
+	void _server_read(Connection*);
+	void _server_write(Connection*);
+	void _server_dispatch(Connection*);
+	void _server_complete();
+	void _server_update_events(Connection*);
+	void _server_finish(Connection*);
+	void _server_close_connection(Connection*);
+	void _server_worker(DB*);
+	void _server_execute(DB*, Task*);
+};
+
+}
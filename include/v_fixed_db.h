@@ -0,0 +1,444 @@
+#pragma once
+
+#include "v_db.h"
+#include "v_crc32c.h"
+#include "record_lock.h"
+
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <functional>
+
+namespace vDB {
+
+const uint32_t kFixed_buckets = 4096;     //新建数据库时默认的hash桶个数
+const char kFixed_magic[8] = "vDBFIXD";   //文件头的标志
+
+/*
+ * FixedDB默认的hash函数，FNV-1a之后再把高位混合到低位
+ * KeySize是编译期常量，循环会被编译器展开
+ */
+template<size_t KeySize>
+struct FixedHash {
+	uint64_t operator()(const char *key) const {
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for (size_t i = 0; i < KeySize; ++i) {
+			hash ^= (unsigned char)key[i];
+			hash *= 0x100000001b3ULL;
+		}
+		hash ^= hash >> 33;
+		hash *= 0xff51afd7ed558ccdULL;
+		hash ^= hash >> 33;
+		return hash;
+	}
+};
+
+/*
+ * key和value都是定长的存储引擎，长度是模板参数，比如16字节的id对应64字节的结构体
+ * 数据库只有一个文件pathname.fdb，key和value放在同一条记录里，没有单独的data文件
+ * 记录是4字节的CRC32C加上key和value，长度在编译期确定，不需要解析长度、分隔符和标志
+ * 文件按桶划分，第0个桶的位置是文件头，每个hash桶固定占kBucket_size字节，最多放kBucket_slots条记录
+ * 桶满了在文件末尾分配溢出桶挂在后面，记录的位置直接由桶号和槽号算出来
+ * 查找时一次pread读出整个桶，在内存里用定长的memcmp比较key
+ * 锁和PageDB一样，每个桶锁自己的第一个字节，可以多个进程同时读写
+ * 接口不是虚函数，key和value都是指向定长字节的指针，不经过string
+ * 注意，文件是本机字节序的二进制格式，接口和DB一样都是不可重入的
+ */
+template<size_t KeySize, size_t ValueSize, typename Hash = FixedHash<KeySize> >
+class FixedDB {
+public:
+	static_assert(KeySize > 0 && ValueSize > 0, "key and value can not be empty");
+
+	static constexpr size_t kRecord_size = 4 + KeySize + ValueSize;    //一条记录的大小，校验和+key+value
+	static constexpr size_t kBucket_header = 16;                       //桶头的大小，记录数和溢出桶号
+	static constexpr size_t kBucket_slots = kBucket_header + kRecord_size <= 4096 ? (4096 - kBucket_header) / kRecord_size : 1;   //每个桶的槽数，尽量装满一页
+	static constexpr size_t kBucket_size = kBucket_header + kBucket_slots * kRecord_size;   //桶的大小
+
+	explicit FixedDB();
+	FixedDB(const FixedDB&) = delete;
+	~FixedDB();
+	/*
+	 * 打开或者创建数据库，前三个参数与open系统调用一致
+	 * 第四个参数是新建数据库时hash桶的个数，打开已有的数据库时忽略
+	 * 已有数据库的key和value长度与模板参数不一致时打开失败
+	 * 成功返回true，失败返回false
+	 */
+	bool db_open(const string&, int, mode_t = S_IRUSR | S_IWUSR, uint32_t = kFixed_buckets);
+	void db_close();
+	/*
+	 * 第一个参数指向KeySize字节的key，找到时把ValueSize字节的value拷贝到第二个参数
+	 * 找到返回true，不存在或者出错返回false
+	 */
+	bool db_fetch(const char*, char*);
+	/*
+	 * 标志和返回值与DB::db_store一致
+	 * 成功返回0，错误返回-1，如果存在而且指定了DB_INSERT则返回1
+	 */
+	int db_store(const char*, const char*, int);
+	/*
+	 * 成功返回true，不存在或者出错返回false
+	 */
+	bool db_delete(const char*);
+	/*
+	 * 遍历所有记录，参数的两个参数分别指向key和value，返回false时停止遍历
+	 * 每个hash桶的链在一个读锁里读完
+	 * 遍历完返回true，出错或者被停止返回false
+	 */
+	bool db_scan(const std::function<bool(const char*, const char*)>&);
+	/*
+	 * 返回hash桶的个数和溢出桶的个数
+	 */
+	bool db_bucket_count(uint32_t&, uint64_t&);
+private:
+	/*
+	 * 第0个桶开头的文件头
+	 */
+	struct Header {
+		char magic[8];
+		uint32_t key_size;        //key的长度，打开时检查
+		uint32_t value_size;      //value的长度，打开时检查
+		uint32_t bucket_count;    //hash桶的个数，创建后不再改变
+		uint32_t reserved;
+		uint64_t bucket_total;    //桶的总数，包括文件头和溢出桶，分配溢出桶时加1
+	};
+	/*
+	 * 桶头，前count个槽有效
+	 */
+	struct BucketHeader {
+		uint32_t count;           //有效的记录数
+		uint32_t reserved;
+		uint64_t overflow;        //下一个溢出桶的桶号，0表示没有
+	};
+
+	bool readonly_;                  //是否以只读方式打开
+	int fd_;                         //.fdb的fd
+	uint32_t bucket_count_;          //hash桶的个数，打开时从文件头读出
+	char bucket_[kBucket_size];      //最后一次读出的桶
+	uint64_t found_bucket_;          //_fixed_find找到的桶号
+	uint32_t found_slot_;            //_fixed_find找到的槽号
+	uint64_t free_bucket_;           //_fixed_find经过的第一个没满的桶，0表示没有
+	uint32_t free_count_;            //free_bucket_里的记录数
+	uint64_t last_bucket_;           //_fixed_find经过的最后一个桶
+	Hash hash_;
+
+	static off_t _fixed_offset(uint64_t bucket, uint32_t slot) {
+		return (off_t)(bucket * kBucket_size + kBucket_header + slot * kRecord_size);
+	}
+	uint64_t _fixed_home(const char *key) {
+		return hash_(key) % bucket_count_ + 1;
+	}
+	void _fixed_free();
+	bool _fixed_read(uint64_t);
+	bool _fixed_write_count(uint64_t, uint32_t);
+	bool _fixed_check(const char*);
+	bool _fixed_find(const char*, uint64_t);
+	uint64_t _fixed_allocate();
+};
+
+template<size_t KeySize, size_t ValueSize, typename Hash>
+FixedDB<KeySize, ValueSize, Hash>::FixedDB() : readonly_(false), fd_(-1), bucket_count_(0) {
+	static_assert(sizeof(Header) <= kBucket_size && sizeof(BucketHeader) == kBucket_header, "header must fit in one bucket");
+}
+
+template<size_t KeySize, size_t ValueSize, typename Hash>
+FixedDB<KeySize, ValueSize, Hash>::~FixedDB() {
+	_fixed_free();
+}
+
+template<size_t KeySize, size_t ValueSize, typename Hash>
+void FixedDB<KeySize, ValueSize, Hash>::_fixed_free() {
+	if (fd_ >= 0)
+		close(fd_);
+	fd_ = -1;
+	bucket_count_ = 0;
+}
+
+template<size_t KeySize, size_t ValueSize, typename Hash>
+bool FixedDB<KeySize, ValueSize, Hash>::db_open(const string &pathname, int oflag, mode_t mode, uint32_t bucket_count) {
+	if (!pathname.length()) {
+		printf("db_open: pathname can not be blank\n");
+		return false;
+	}
+	_fixed_free();
+	readonly_ = (oflag & O_ACCMODE) == O_RDONLY;
+	fd_ = open((pathname + ".fdb").c_str(), oflag, mode);
+	if (fd_ < 0)
+		return false;
+	if (!readonly_) {
+		//文件为空就初始化，写锁住整个文件，防止两个进程同时初始化
+		RecordWritewLock writew_lock(fd_, 0, SEEK_SET, 0);
+		struct stat statbuff;
+		if (fstat(fd_, &statbuff) < 0) {
+			printf("db_open: fstat error\n");
+			_fixed_free();
+			return false;
+		}
+		if (!statbuff.st_size) {
+			if (!bucket_count) {
+				printf("db_open: invalid bucket count\n");
+				_fixed_free();
+				return false;
+			}
+			//hash桶都是空的，直接ftruncate出空洞就行
+			Header header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, kFixed_magic, sizeof(header.magic));
+			header.key_size = KeySize;
+			header.value_size = ValueSize;
+			header.bucket_count = bucket_count;
+			header.bucket_total = (uint64_t)bucket_count + 1;
+			if (ftruncate(fd_, (off_t)header.bucket_total * kBucket_size) < 0 || pwrite(fd_, &header, sizeof(header), 0) != sizeof(header)) {
+				printf("db_open: fixed file init write error\n");
+				_fixed_free();
+				return false;
+			}
+		}
+	}
+	//文件头里除了桶数都不会再改变，不需要加锁
+	Header header;
+	if (pread(fd_, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, kFixed_magic, sizeof(header.magic)) || !header.bucket_count) {
+		printf("db_open: invalid fixed db file\n");
+		_fixed_free();
+		return false;
+	}
+	if (header.key_size != KeySize || header.value_size != ValueSize) {
+		printf("db_open: key or value size does not match\n");
+		_fixed_free();
+		return false;
+	}
+	bucket_count_ = header.bucket_count;
+	return true;
+}
+
+template<size_t KeySize, size_t ValueSize, typename Hash>
+void FixedDB<KeySize, ValueSize, Hash>::db_close() {
+	_fixed_free();
+}
+
+template<size_t KeySize, size_t ValueSize, typename Hash>
+bool FixedDB<KeySize, ValueSize, Hash>::_fixed_read(uint64_t bucket) {
+	if (pread(fd_, bucket_, kBucket_size, (off_t)(bucket * kBucket_size)) != (ssize_t)kBucket_size) {
+		printf("_fixed_read: read error of bucket %llu\n", (unsigned long long)bucket);
+		return false;
+	}
+	return true;
+}
+
+template<size_t KeySize, size_t ValueSize, typename Hash>
+bool FixedDB<KeySize, ValueSize, Hash>::_fixed_write_count(uint64_t bucket, uint32_t count) {
+	if (pwrite(fd_, &count, sizeof(count), (off_t)(bucket * kBucket_size)) != sizeof(count)) {
+		printf("_fixed_write_count: write error of bucket %llu\n", (unsigned long long)bucket);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * 校验bucket_里的一条记录
+ */
+template<size_t KeySize, size_t ValueSize, typename Hash>
+bool FixedDB<KeySize, ValueSize, Hash>::_fixed_check(const char *record) {
+	uint32_t crc;
+	memcpy(&crc, record, sizeof(crc));
+	if (crc != crc32c(0, record + 4, KeySize + ValueSize)) {
+		printf("_fixed_check: checksum error\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * 沿着home开始的桶链查找key，调用前需要锁住home
+ * 找到时found_bucket_和found_slot_是记录的位置，bucket_里是它所在的桶
+ * 没找到时free_bucket_是第一个没满的桶，last_bucket_是链上最后一个桶
+ * 找到返回true，不存在或者出错返回false
+ */
+template<size_t KeySize, size_t ValueSize, typename Hash>
+bool FixedDB<KeySize, ValueSize, Hash>::_fixed_find(const char *key, uint64_t home) {
+	free_bucket_ = 0;
+	uint64_t bucket = home;
+	while (true) {
+		if (!_fixed_read(bucket))
+			return false;
+		BucketHeader header;
+		memcpy(&header, bucket_, sizeof(header));
+		if (header.count > kBucket_slots) {
+			printf("_fixed_find: invalid bucket %llu\n", (unsigned long long)bucket);
+			return false;
+		}
+		const char *record = bucket_ + kBucket_header;
+		for (uint32_t i = 0; i < header.count; ++i, record += kRecord_size)
+			if (!memcmp(record + 4, key, KeySize)) {
+				found_bucket_ = bucket;
+				found_slot_ = i;
+				return true;
+			}
+		if (!free_bucket_ && header.count < kBucket_slots) {
+			free_bucket_ = bucket;
+			free_count_ = header.count;
+		}
+		last_bucket_ = bucket;
+		if (!header.overflow)
+			return false;
+		bucket = header.overflow;
+	}
+}
+
+template<size_t KeySize, size_t ValueSize, typename Hash>
+bool FixedDB<KeySize, ValueSize, Hash>::db_fetch(const char *key, char *value) {
+	uint64_t home = _fixed_home(key);
+	RecordReadwLock readw_lock(fd_, (off_t)(home * kBucket_size), SEEK_SET, 1);
+	if (!_fixed_find(key, home))
+		return false;
+	const char *record = bucket_ + kBucket_header + found_slot_ * kRecord_size;
+	if (!_fixed_check(record))
+		return false;
+	memcpy(value, record + 4 + KeySize, ValueSize);
+	return true;
+}
+
+/*
+ * 已存在时原地覆盖，否则写到链上第一个没满的桶，都满了就分配溢出桶
+ * 先写记录再改记录数，中途崩溃不会出现半条记录
+ */
+template<size_t KeySize, size_t ValueSize, typename Hash>
+int FixedDB<KeySize, ValueSize, Hash>::db_store(const char *key, const char *value, int flag) {
+	if (readonly_) {
+		printf("db_store: db is readonly\n");
+		return -1;
+	}
+	if (flag <= STORE_MIN_FLAG || flag >= STORE_MAX_FLAG) {
+		printf("_db_store: flag is invalid\n");
+		return -1;
+	}
+	char record[kRecord_size];
+	memcpy(record + 4, key, KeySize);
+	memcpy(record + 4 + KeySize, value, ValueSize);
+	uint32_t crc = crc32c(0, record + 4, KeySize + ValueSize);
+	memcpy(record, &crc, sizeof(crc));
+	uint64_t home = _fixed_home(key);
+	RecordWritewLock writew_lock(fd_, (off_t)(home * kBucket_size), SEEK_SET, 1);
+	bool can_find = _fixed_find(key, home);
+	if (can_find && DB_INSERT == flag) {
+		printf("_db_store_insert: key is exist in db\n");
+		return 1;
+	}
+	if (!can_find && DB_REPLACE == flag) {
+		printf("_db_store_replace: db can not find key\n");
+		return -1;
+	}
+	uint64_t bucket;
+	uint32_t slot;
+	if (can_find) {
+		bucket = found_bucket_;
+		slot = found_slot_;
+	}
+	else if (free_bucket_) {
+		bucket = free_bucket_;
+		slot = free_count_;
+	}
+	else {
+		//新的溢出桶是空洞，写好记录和记录数之后再挂到链尾
+		if (!(bucket = _fixed_allocate()))
+			return -1;
+		slot = 0;
+	}
+	if (pwrite(fd_, record, kRecord_size, _fixed_offset(bucket, slot)) != (ssize_t)kRecord_size) {
+		printf("db_store: write error of record\n");
+		return -1;
+	}
+	if (can_find)
+		return 0;
+	if (!_fixed_write_count(bucket, slot + 1))
+		return -1;
+	if (bucket != free_bucket_ && pwrite(fd_, &bucket, sizeof(bucket), (off_t)(last_bucket_ * kBucket_size + offsetof(BucketHeader, overflow))) != sizeof(bucket)) {
+		printf("db_store: write error of overflow\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * 在文件头里把桶数加1，返回新桶的桶号，失败返回0
+ */
+template<size_t KeySize, size_t ValueSize, typename Hash>
+uint64_t FixedDB<KeySize, ValueSize, Hash>::_fixed_allocate() {
+	RecordWritewLock writew_lock(fd_, 0, SEEK_SET, 1);
+	Header header;
+	if (pread(fd_, &header, sizeof(header), 0) != sizeof(header)) {
+		printf("_fixed_allocate: read error of header\n");
+		return 0;
+	}
+	uint64_t bucket = header.bucket_total++;
+	if (ftruncate(fd_, (off_t)header.bucket_total * kBucket_size) < 0 || pwrite(fd_, &header, sizeof(header), 0) != sizeof(header)) {
+		printf("_fixed_allocate: write error of header\n");
+		return 0;
+	}
+	return bucket;
+}
+
+/*
+ * 删除时把桶里最后一条记录挪到被删的位置，桶里的记录始终是紧凑的
+ */
+template<size_t KeySize, size_t ValueSize, typename Hash>
+bool FixedDB<KeySize, ValueSize, Hash>::db_delete(const char *key) {
+	if (readonly_) {
+		printf("db_delete: db is readonly\n");
+		return false;
+	}
+	uint64_t home = _fixed_home(key);
+	RecordWritewLock writew_lock(fd_, (off_t)(home * kBucket_size), SEEK_SET, 1);
+	if (!_fixed_find(key, home))
+		return false;
+	BucketHeader header;
+	memcpy(&header, bucket_, sizeof(header));
+	uint32_t last = header.count - 1;
+	if (found_slot_ != last && pwrite(fd_, bucket_ + kBucket_header + last * kRecord_size, kRecord_size, _fixed_offset(found_bucket_, found_slot_)) != (ssize_t)kRecord_size) {
+		printf("db_delete: write error of record\n");
+		return false;
+	}
+	return _fixed_write_count(found_bucket_, last);
+}
+
+template<size_t KeySize, size_t ValueSize, typename Hash>
+bool FixedDB<KeySize, ValueSize, Hash>::db_scan(const std::function<bool(const char*, const char*)> &visit) {
+	for (uint64_t home = 1; home <= bucket_count_; ++home) {
+		RecordReadwLock readw_lock(fd_, (off_t)(home * kBucket_size), SEEK_SET, 1);
+		uint64_t bucket = home;
+		while (bucket) {
+			if (!_fixed_read(bucket))
+				return false;
+			BucketHeader header;
+			memcpy(&header, bucket_, sizeof(header));
+			if (header.count > kBucket_slots) {
+				printf("db_scan: invalid bucket %llu\n", (unsigned long long)bucket);
+				return false;
+			}
+			const char *record = bucket_ + kBucket_header;
+			for (uint32_t i = 0; i < header.count; ++i, record += kRecord_size)
+				if (!_fixed_check(record) || !visit(record + 4, record + 4 + KeySize))
+					return false;
+			bucket = header.overflow;
+		}
+	}
+	return true;
+}
+
+template<size_t KeySize, size_t ValueSize, typename Hash>
+bool FixedDB<KeySize, ValueSize, Hash>::db_bucket_count(uint32_t &bucket_count, uint64_t &overflow_count) {
+	RecordReadwLock readw_lock(fd_, 0, SEEK_SET, 1);
+	Header header;
+	if (pread(fd_, &header, sizeof(header), 0) != sizeof(header)) {
+		printf("db_bucket_count: read error of header\n");
+		return false;
+	}
+	bucket_count = header.bucket_count;
+	overflow_count = header.bucket_total - header.bucket_count - 1;
+	return true;
+}
+
+}
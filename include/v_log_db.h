@@ -0,0 +1,138 @@
+#pragma once
+
+#include "v_db.h"
+
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <pthread.h>
+
+namespace vDB {
+
+/*
+ * 日志结构（Bitcask）的存储引擎，接口与DB一致
+ * 所有写操作都是追加到当前的段文件，删除也是追加一条墓碑记录
+ * 内存中的key目录记录了每个key最新的value在哪个段的哪个位置，读操作最多一次pread
+ * 段文件为pathname.<段号>.log，写满段的最大长度（默认kSegment_max）后换一个新的段
+ * db_merge把旧段里还存活的记录重写到新段里并删除旧段，同时为新段生成pathname.<段号>.hint
+ * 打开时有hint文件的段只读hint文件，不用扫描整个段
+ * 注意，key目录常驻内存，内存占用和key的总长度成正比
+ * 同一个对象可以在多个线程中使用，但同一个数据库只能被一个进程以读写方式打开
+ */
+class LogDB :public DB {
+public:
+	explicit LogDB();
+	LogDB(const LogDB&) = delete;
+	virtual ~LogDB();
+	/*
+	 * 参数与DB::db_open一致，O_TRUNC会删除所有的段文件
+	 */
+	virtual bool db_open(const string&, int, ...);
+	virtual void db_close();
+	virtual string db_fetch(const string&);
+	virtual void db_multi_fetch(const std::vector<string>&, std::vector<string>&);
+	virtual bool db_delete(const string&);
+	virtual int db_store(const string&, const string&, int);
+	virtual int db_try_fetch(const string&, string&, long long);
+	virtual int db_try_store(const string&, const string&, int, long long);
+	/*
+	 * 用db_scan单线程导出，线程数被忽略
+	 */
+	virtual bool db_dump(int, int);
+	/*
+	 * 逐条插入，失败时已经导入的记录不会回滚
+	 */
+	virtual bool db_restore(int, long long&);
+	/*
+	 * 不支持变更日志，总是返回false
+	 */
+	virtual bool db_change_log();
+	/*
+	 * 整个过程持有写锁
+	 */
+	virtual int db_update(const string&, const std::function<bool(bool, string&)>&);
+	virtual bool db_bulk_load(const std::function<bool(string&, string&)>&);
+	/*
+	 * 快照先切换到一个新段，之后旧的段都不会再修改，直接硬链接过去即可
+	 * 所以快照的路径必须和数据库在同一个文件系统上，第二个参数需要是LogDB
+	 */
+	virtual bool db_snapshot(const string&, DB&);
+	/*
+	 * 不支持压缩，总是返回false
+	 */
+	virtual bool db_train_dictionary(const std::vector<string>&);
+	virtual DBStats db_stats();
+	virtual bool db_scan(const std::function<bool(const string&, const string&)>&);
+	/*
+	 * 合并除当前段以外的所有段，只保留存活的记录，并为合并出来的段写hint文件
+	 * 合并期间读写操作不会被阻塞，只有最后更新key目录的时候需要短暂的加锁
+	 * 成功返回true，失败返回false，失败时旧段保持不变
+	 */
+	bool db_merge();
+	/*
+	 * 在后台线程中调用db_merge，上一次合并还没结束时返回false
+	 */
+	bool db_merge_background();
+	/*
+	 * 返回已经失效的记录占段文件总大小的比例，可以据此决定何时合并
+	 */
+	double db_dead_ratio();
+	/*
+	 * 设置段文件的最大长度，之后写入和合并都按新的长度换段，参数不大于0时不修改
+	 */
+	void db_set_segment_size(off_t);
+private:
+	/*
+	 * key目录中的一项，value在段文件中的位置
+	 */
+	struct Entry {
+		unsigned long long segment;   //段号
+		off_t offset;                 //记录在段中的偏移量
+		int length;                   //value的长度
+	};
+	/*
+	 * 一个段文件
+	 */
+	struct Segment {
+		int fd;                       //文件描述符
+		off_t size;                   //文件大小
+		off_t dead;                   //已经失效的记录的字节数
+	};
+	/*
+	 * 合并时搬过的一条记录
+	 */
+	struct Moved {
+		string key;
+		Entry from;                   //原来的位置
+		Entry to;                     //合并后的位置
+	};
+
+	string pathname_;                                   //数据库路径
+	bool readonly_;                                     //是否以只读方式打开
+	int lock_fd_;                                       //pathname.lock的fd，用flock保证只有一个进程写
+	pthread_rwlock_t lock_;                             //保护下面的key目录和段
+	std::unordered_map<string, Entry> keydir_;          //key目录
+	std::map<unsigned long long, Segment> segments_;    //所有段，按段号排序，最后一个是当前段
+	unsigned long long active_;                         //当前段的段号
+	DBStats stats_;                                     //统计信息
+	std::thread merger_;                                //后台合并线程
+	bool merging_;                                      //是否正在合并
+	off_t segment_max_;                                 //段文件的最大长度
+
+	string _log_segment_name(unsigned long long, const char*);
+	bool _log_list_segments(std::vector<unsigned long long>&);
+	bool _log_load_segment(unsigned long long, int);
+	bool _log_load_hint(unsigned long long, int);
+	bool _log_open_active(unsigned long long);
+	bool _log_append(const string&, const string&, Entry&);
+	int _log_put(const string&, const string&);
+	int _log_format_header(char*, const string&, const string&);
+	void _log_apply(const string&, const Entry&, off_t);
+	string _log_read_value(const Entry&);
+	bool _log_write_all(int, const string&);
+	bool _log_merge_segments(const std::vector<unsigned long long>&, std::vector<Moved>&, std::vector<unsigned long long>&);
+	bool _log_write_hint(unsigned long long, const std::vector<Moved>&, size_t, size_t);
+	void _log_free();
+};
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "v_db.h"
+
+#include <ctime>
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace vDB {
+
+/*
+ * 纯内存的存储引擎，接口与DB一致，适合可以重建的缓存
+ * hash表是开放寻址的，key和value一起放在从大块内存(slab)里切出来的记录中，不为每条记录单独分配内存
+ * 记录按容量分级，释放的记录挂在对应级别的空闲链表上复用
+ * db_open的路径是快照的路径，快照就是DB的.idx和.dat文件，打开时如果存在就载入
+ * db_save把所有记录写成快照，db_save_background在fork出来的子进程里写，父进程不受影响
+ * 设置了db_set_save_interval后，写操作会按时间间隔自动在后台保存快照
+ * 快照用的是DB的文件格式，大小同样受7位偏移量的限制
+ * 注意，接口和DB一样都是不可重入的，在多线程程序中fork有风险，多线程时请用db_save
+ */
+class MemDB :public DB {
+public:
+	explicit MemDB();
+	MemDB(const MemDB&) = delete;
+	virtual ~MemDB();
+	/*
+	 * 第一个参数是快照路径，为空表示不做持久化
+	 * 带O_TRUNC时不载入已有的快照，其余标志和mode会被忽略
+	 * 成功返回true，失败返回false
+	 */
+	virtual bool db_open(const string&, int, ...);
+	/*
+	 * 释放所有记录，会等待正在进行的后台保存结束，不会自动保存
+	 */
+	virtual void db_close();
+	virtual string db_fetch(const string&);
+	virtual void db_multi_fetch(const std::vector<string>&, std::vector<string>&);
+	virtual bool db_delete(const string&);
+	virtual int db_store(const string&, const string&, int);
+	/*
+	 * 没有锁，不会返回kDB_busy，等价于db_fetch和db_store
+	 */
+	virtual int db_try_fetch(const string&, string&, long long);
+	virtual int db_try_store(const string&, const string&, int, long long);
+	/*
+	 * 用db_scan单线程导出，线程数被忽略
+	 */
+	virtual bool db_dump(int, int);
+	/*
+	 * 逐条插入，失败时已经导入的记录不会回滚
+	 */
+	virtual bool db_restore(int, long long&);
+	/*
+	 * 不支持变更日志，总是返回false
+	 */
+	virtual bool db_change_log();
+	virtual int db_update(const string&, const std::function<bool(bool, string&)>&);
+	virtual bool db_bulk_load(const std::function<bool(string&, string&)>&);
+	/*
+	 * 把所有记录写成第一个参数对应的快照，并以只读方式打开到第二个参数上
+	 */
+	virtual bool db_snapshot(const string&, DB&);
+	/*
+	 * 不支持压缩，总是返回false
+	 */
+	virtual bool db_train_dictionary(const std::vector<string>&);
+	virtual DBStats db_stats();
+	virtual bool db_scan(const std::function<bool(const string&, const string&)>&);
+	/*
+	 * 把所有记录保存到db_open时的路径，先写临时文件再改名
+	 * 成功返回true，失败返回false
+	 */
+	bool db_save();
+	/*
+	 * 在子进程中保存快照，子进程看到的是fork那一刻的数据
+	 * 上一次后台保存还没结束时返回false
+	 */
+	bool db_save_background();
+	/*
+	 * 设置自动保存的间隔秒数，0表示不自动保存
+	 */
+	void db_set_save_interval(int);
+private:
+	/*
+	 * 一条记录，后面紧跟着key和value
+	 * 空闲时前8个字节用作空闲链表的指针
+	 */
+	struct Record {
+		uint16_t level;          //容量的级别
+		uint16_t key_length;     //key的长度
+		uint16_t value_length;   //value的长度
+		uint16_t reserved;       //凑满8个字节
+	};
+	/*
+	 * hash表中的一个槽，record为空表示空槽
+	 */
+	struct Slot {
+		uint64_t hash;           //key的hash值，先比较它再比较key
+		Record *record;          //对应的记录
+	};
+
+	string pathname_;            //快照路径
+	bool readonly_;              //是否以只读方式打开
+	Slot *table_;                //hash表
+	size_t capacity_;            //hash表的槽数，总是2的幂
+	size_t size_;                //记录数
+	std::vector<char*> slabs_;   //所有分配过的slab
+	char *slab_ptr_;             //当前slab中还没用过的位置
+	size_t slab_left_;           //当前slab剩余的字节数
+	std::vector<Record*> free_;  //每个级别的空闲链表
+	std::vector<int> levels_;    //每个级别的容量
+	DBStats stats_;              //统计信息
+	pid_t saver_;                //正在后台保存的子进程，没有则为-1
+	int save_interval_;          //自动保存的间隔秒数
+	time_t last_save_;           //上一次开始保存的时间
+
+	uint64_t _mem_hash(const char*, size_t);
+	size_t _mem_find(const string&, uint64_t);
+	bool _mem_grow();
+	int _mem_level(size_t);
+	Record* _mem_alloc(int);
+	void _mem_release(Record*);
+	Record* _mem_make_record(const string&, const string&);
+	int _mem_store(const string&, const string&, int);
+	void _mem_erase(size_t);
+	bool _mem_write_snapshot(const string&);
+	void _mem_reap(bool);
+	void _mem_auto_save();
+	void _mem_free();
+};
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "v_db.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace vDB {
+
+/*
+ * 按页组织index的存储引擎，接口与DB一致
+ * 数据库由pathname.pidx和pathname.pdat两个文件组成
+ * .pidx的第0页是文件头，第1页开始每个hash桶固定占一个kPage_size大小的页，装不下时在文件末尾分配溢出页挂在后面
+ * 每页里是紧凑的槽：key的指纹（hash值的高8位），key和value在.pdat中的偏移量和长度
+ * 查找时读一页，用SIMD一次比较页里所有的指纹，指纹相同的槽再用一次pread读出key和value比较
+ * 所以一次查找通常只读一个index页和一个data位置，不像DB那样沿着分散在.idx里的链表一个节点读一次
+ * .pdat只追加，替换和删除留下的旧记录不会回收
+ * 锁和DB一样用记录锁，每个桶锁自己页的第一个字节，可以多个进程同时读写
+ * 注意，文件是本机字节序的二进制格式，不能在字节序不同的机器之间拷贝
+ */
+class PageDB :public DB {
+public:
+	explicit PageDB();
+	PageDB(const PageDB&) = delete;
+	virtual ~PageDB();
+	/*
+	 * 参数与DB::db_open一致，文件为空时会自动初始化
+	 */
+	virtual bool db_open(const string&, int, ...);
+	virtual void db_close();
+	virtual string db_fetch(const string&);
+	virtual void db_multi_fetch(const std::vector<string>&, std::vector<string>&);
+	virtual bool db_delete(const string&);
+	virtual int db_store(const string&, const string&, int);
+	virtual int db_try_fetch(const string&, string&, long long);
+	virtual int db_try_store(const string&, const string&, int, long long);
+	/*
+	 * 用db_scan单线程导出，线程数被忽略
+	 */
+	virtual bool db_dump(int, int);
+	/*
+	 * 逐条插入，失败时已经导入的记录不会回滚
+	 */
+	virtual bool db_restore(int, long long&);
+	/*
+	 * 不支持变更日志，总是返回false
+	 */
+	virtual bool db_change_log();
+	virtual int db_update(const string&, const std::function<bool(bool, string&)>&);
+	virtual bool db_bulk_load(const std::function<bool(string&, string&)>&);
+	virtual bool db_snapshot(const string&, DB&);
+	/*
+	 * 不支持压缩，总是返回false
+	 */
+	virtual bool db_train_dictionary(const std::vector<string>&);
+	virtual DBStats db_stats();
+	virtual bool db_scan(const std::function<bool(const string&, const string&)>&);
+	/*
+	 * 返回hash桶的个数和溢出页的个数，可以据此判断桶是不是太少了
+	 */
+	bool db_page_count(uint32_t&, uint64_t&);
+	/*
+	 * 设置新建数据库时hash桶的个数，默认kPage_buckets，要在db_open之前调用
+	 * 已有的数据库以文件头里的为准，设成很小可以让少量记录就用到溢出页
+	 */
+	void db_set_bucket_count(uint32_t);
+private:
+	struct Header;
+	struct Slot;
+	struct Page;
+
+	string pathname_;          //数据库路径
+	bool readonly_;            //是否以只读方式打开
+	int index_fd_, data_fd_;   //.pidx和.pdat的fd
+	uint32_t bucket_count_;    //hash桶的个数，打开时从文件头读出
+	uint32_t bucket_init_;     //新建数据库时hash桶的个数
+	DBStats stats_;            //统计信息
+
+	uint64_t _page_hash(const string&);
+	off_t _page_bucket_offset(uint64_t);
+	bool _page_read(uint64_t, Page&);
+	bool _page_write(uint64_t, const Page&);
+	int _page_match(const Page&, uint8_t, int*);
+	int _page_find(const string&, uint64_t, Page&, uint64_t&, int&, string*);
+	bool _page_read_record(const Slot&, string&, string*);
+	bool _page_append(const string&, const string&, off_t&);
+	int _page_put(const string&, const string&, uint64_t, Page&, uint64_t, int, bool);
+	uint64_t _page_allocate();
+	void _page_free();
+};
+
+}
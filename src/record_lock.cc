@@ -1,7 +1,23 @@
 #include "../include/record_lock.h"
 
 #include <cstdio>
+#include <cstring>
+#include <errno.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+const long long kLock_retry_min = 20;      //限时锁第一次重试前等待的微秒数
+const long long kLock_retry_max = 1000;    //限时锁重试间隔的上限
+
+/*
+ * 单调时钟的当前时间，单位微秒
+ */
+static long long now_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
 
 RecordLock::RecordLock(int fd, off_t offset, int whence, off_t len)
 	:	fd_(fd),
@@ -9,24 +25,25 @@ RecordLock::RecordLock(int fd, off_t offset, int whence, off_t len)
 		whence_(whence),
 		len_(len),
 		lock_result_(0),
-		unlock_result_(0)
+		unlock_result_(0),
+		lock_errno_(0)
 {}
 
 RecordLock::~RecordLock() {
-	if ((unlock_result_ = un_lock()) < 0)
+	//没拿到锁时不能解锁，同一个进程在这个区域上可能还有别的锁
+	if (locked() && (unlock_result_ = un_lock()) < 0)
 		fail_unlock_process();
 }
 
 void RecordLock::fail_lock_process() {
-	printf("%s fail lock\n", lockname_);
-	abort();
-	//䴦
+	lock_errno_ = errno;
+	printf("%s fail lock: %s\n", lockname_, strerror(lock_errno_));
 }
 
 void RecordLock::fail_unlock_process() {
 	printf("%s fail unlock\n", lockname_);
 	abort();
-	//䴦
+	//待补充处理
 }
 
 int RecordLock::lock_result() {
@@ -37,15 +54,23 @@ int RecordLock::unlock_result() {
 	return unlock_result_;
 }
 
+bool RecordLock::locked() {
+	return lock_result_ >= 0;
+}
+
+bool RecordLock::busy() {
+	return !locked() && (EAGAIN == lock_errno_ || EACCES == lock_errno_ || ETIMEDOUT == lock_errno_);
+}
+
 /*
- * ߽һ
+ * 加锁或者解锁一个区域
  */
 int RecordLock::lock_reg(int fd, int cmd, int type, off_t offset, int whence, off_t len) {
 	struct flock lock;
-	lock.l_type = type;                 //F_RDLCK,R_WRLCK,F_UNLCK
-	lock.l_start = offset;              //whenceƫ
-	lock.l_whence = whence;             //SEEK_SET,SEEK_CUR,SEEK_ENDͷǰβ
-	lock.l_len = len;                   //ֽڳ 0ζķΧչܵƫ׷ӶݶķΧ
+	lock.l_type = type;                 //操作类型F_RDLCK,R_WRLCK,F_UNLCK
+	lock.l_start = offset;              //相对于whence的偏移量
+	lock.l_whence = whence;             //三种起点SEEK_SET,SEEK_CUR,SEEK_END，头，当前，尾
+	lock.l_len = len;                   //字节长度 0意味着锁的范围可以扩展到最大可能的偏移量，不管追加多少数据都在锁的范围内
 	return fcntl(fd, cmd, &lock);
 }
 
@@ -60,7 +85,7 @@ RecordReadLock::RecordReadLock(int fd, off_t offset, int whence, off_t len)
 {
 	lockname_ = "RecordReadLock";
 	if ((lock_result_ = lock()) < 0)
-		fail_lock_process();
+		lock_errno_ = errno;
 }
 
 int RecordReadLock::lock() {
@@ -76,7 +101,11 @@ RecordReadwLock::RecordReadwLock(int fd, off_t offset, int whence, off_t len)
 }
 
 int RecordReadwLock::lock() {
-	return lock_reg(fd_, F_SETLKW, F_RDLCK, offset_, whence_, len_);
+	int result;
+	//被信号打断时重新等待
+	while ((result = lock_reg(fd_, F_SETLKW, F_RDLCK, offset_, whence_, len_)) < 0 && EINTR == errno)
+		;
+	return result;
 }
 
 RecordWriteLock::RecordWriteLock(int fd, off_t offset, int whence, off_t len)
@@ -84,7 +113,7 @@ RecordWriteLock::RecordWriteLock(int fd, off_t offset, int whence, off_t len)
 {
 	lockname_ = "RecordWriteLock";
 	if ((lock_result_ = lock()) < 0)
-		fail_lock_process();
+		lock_errno_ = errno;
 }
 
 int RecordWriteLock::lock() {
@@ -100,6 +129,58 @@ RecordWritewLock::RecordWritewLock(int fd, off_t offset, int whence, off_t len)
 }
 
 int RecordWritewLock::lock() {
-	return lock_reg(fd_, F_SETLKW, F_WRLCK, offset_, whence_, len_);
+	int result;
+	while ((result = lock_reg(fd_, F_SETLKW, F_WRLCK, offset_, whence_, len_)) < 0 && EINTR == errno)
+		;
+	return result;
+}
+
+RecordTimedLock::RecordTimedLock(int fd, off_t offset, int whence, off_t len, int type, long long timeout)
+	:	RecordLock(fd, offset, whence, len),
+		type_(type),
+		timeout_(timeout)
+{}
+
+/*
+ * 失败时errno为EAGAIN表示锁被占着，ETIMEDOUT表示超时，其他是出错
+ */
+int RecordTimedLock::lock() {
+	int result;
+	if (timeout_ < 0) {
+		while ((result = lock_reg(fd_, F_SETLKW, type_, offset_, whence_, len_)) < 0 && EINTR == errno)
+			;
+		return result;
+	}
+	long long deadline = now_us() + timeout_;
+	long long wait = kLock_retry_min;
+	while ((result = lock_reg(fd_, F_SETLK, type_, offset_, whence_, len_)) < 0) {
+		if (EAGAIN != errno && EACCES != errno)
+			return result;
+		long long left = deadline - now_us();
+		if (left <= 0) {
+			if (timeout_)
+				errno = ETIMEDOUT;
+			return result;
+		}
+		usleep(wait < left ? wait : left);
+		wait = wait * 2 < kLock_retry_max ? wait * 2 : kLock_retry_max;
+	}
+	return result;
+}
+
+RecordTimedReadLock::RecordTimedReadLock(int fd, off_t offset, int whence, off_t len, long long timeout)
+	: RecordTimedLock(fd, offset, whence, len, F_RDLCK, timeout)
+{
+	lockname_ = "RecordTimedReadLock";
+	if ((lock_result_ = lock()) < 0)
+		lock_errno_ = errno;
+}
+
+RecordTimedWriteLock::RecordTimedWriteLock(int fd, off_t offset, int whence, off_t len, long long timeout)
+	: RecordTimedLock(fd, offset, whence, len, F_WRLCK, timeout)
+{
+	lockname_ = "RecordTimedWriteLock";
+	if ((lock_result_ = lock()) < 0)
+		lock_errno_ = errno;
 }
 
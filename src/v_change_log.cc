@@ -0,0 +1,460 @@
+#include "../include/v_change_log.h"
+#include "../include/v_db.h"
+#include "../include/v_crc32c.h"
+#include "../include/record_lock.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/falloc.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+
+const char kChange_magic[8] = "vDBCLG2";   //日志文件头的标志
+const int kChange_next = 8;                //文件头里下一个序号的位置
+const int kChange_checked = 16;            //文件头里已经检查过的位置，它之前的记录都是完整的
+const int kChange_start = 24;              //文件头里第一条保留的记录的位置
+const int kChange_trimmed = 32;            //文件头里已经截掉的最后一个序号
+const int kChange_header_size = 40;        //文件头的大小
+const int kChange_entry_header = 21;       //记录头的大小，序号+操作+key长度+value长度+校验和
+const size_t kChange_read_size = 1 << 16;  //每次从文件或者管道读的字节数
+
+namespace vDB {
+
+/*
+ * 日志里的整数都是小端的
+ */
+static void put_u64(char *buffer, uint64_t value, int bytes = 8) {
+	for (int i = 0; i < bytes; ++i)
+		buffer[i] = (char)(value >> (i * 8));
+}
+
+static uint64_t get_u64(const char *buffer, int bytes = 8) {
+	uint64_t value = 0;
+	for (int i = 0; i < bytes; ++i)
+		value |= (uint64_t)(unsigned char)buffer[i] << (i * 8);
+	return value;
+}
+
+/*
+ * 从buffer的position处解析一条记录，校验和不对时把error设为true
+ * 记录完整返回true，并把记录的长度写到length
+ */
+static bool parse_entry(const std::string &buffer, size_t position, size_t &length, bool &error) {
+	error = false;
+	if (buffer.length() - position < (size_t)kChange_entry_header)
+		return false;
+	const char *entry = buffer.data() + position;
+	length = kChange_entry_header + get_u64(entry + 9, 4) + get_u64(entry + 13, 4);
+	if (buffer.length() - position < length)
+		return false;
+	//校验和覆盖除了校验和本身以外的所有字段
+	uint32_t crc = crc32c(0, entry, 17);
+	crc = crc32c(crc, entry + kChange_entry_header, length - kChange_entry_header);
+	error = crc != get_u64(entry + 17, 4);
+	return true;
+}
+
+ChangeLog::ChangeLog() : fd_(-1), copy_sequence_(0), copy_offset_(kChange_header_size) {}
+
+ChangeLog::~ChangeLog() {
+	log_close();
+}
+
+bool ChangeLog::log_open(const std::string &pathname, int oflag) {
+	log_close();
+	fd_ = open(pathname.c_str(), oflag, S_IRUSR | S_IWUSR);
+	if (fd_ < 0)
+		return false;
+	char header[kChange_header_size];
+	if (oflag & O_CREAT) {
+		//新建的文件写入文件头，写锁住文件头防止两个进程同时初始化
+		RecordWritewLock writew_lock(fd_, 0, SEEK_SET, 1);
+		struct stat statbuff;
+		if (!writew_lock.locked() || fstat(fd_, &statbuff) < 0) {
+			printf("log_open: fstat error\n");
+			log_close();
+			return false;
+		}
+		if (!statbuff.st_size) {
+			memcpy(header, kChange_magic, sizeof(kChange_magic));
+			put_u64(header + kChange_next, 1);
+			put_u64(header + kChange_checked, kChange_header_size);
+			put_u64(header + kChange_start, kChange_header_size);
+			put_u64(header + kChange_trimmed, 0);
+			if (write(fd_, header, sizeof(header)) != sizeof(header)) {
+				printf("log_open: write error of header\n");
+				log_close();
+				return false;
+			}
+		}
+	}
+	if (pread(fd_, header, sizeof(header), 0) != sizeof(header) || memcmp(header, kChange_magic, sizeof(kChange_magic))) {
+		printf("log_open: invalid change log\n");
+		log_close();
+		return false;
+	}
+	if ((oflag & O_ACCMODE) != O_RDONLY && !_log_repair()) {
+		log_close();
+		return false;
+	}
+	copy_sequence_ = 0;
+	copy_offset_ = kChange_header_size;
+	return true;
+}
+
+/*
+ * 从上次检查过的位置开始检查每条记录，截掉末尾不完整或者校验和不对的记录，再把检查过的位置写回文件头
+ * 追加是串行的，失败时也会截回去，所以只有最后一条记录可能是坏的，后面还有字节时说明文件损坏了，返回false
+ * 文件头里的序号不大于最后一条记录的序号时也一起改正
+ */
+bool ChangeLog::_log_repair() {
+	RecordWritewLock writew_lock(fd_, 0, SEEK_SET, 1);
+	char header[kChange_header_size];
+	struct stat statbuff;
+	if (!writew_lock.locked() || pread(fd_, header, sizeof(header), 0) != sizeof(header) || fstat(fd_, &statbuff) < 0) {
+		printf("_log_repair: read error of header\n");
+		return false;
+	}
+	std::string buffer;
+	char chunk[kChange_read_size];
+	off_t offset = get_u64(header + kChange_checked);      //buffer开头在文件中的位置
+	uint64_t last = 0;
+	bool broken = false;
+	if (offset < kChange_header_size || offset > statbuff.st_size) {
+		printf("_log_repair: invalid checked offset %lld\n", (long long)offset);
+		return false;
+	}
+	while (!broken) {
+		ssize_t n = pread(fd_, chunk, sizeof(chunk), offset + buffer.length());
+		if (n < 0) {
+			printf("_log_repair: read error\n");
+			return false;
+		}
+		if (!n)
+			break;
+		buffer.append(chunk, n);
+		size_t position = 0, length = 0;
+		bool error = false;
+		while (parse_entry(buffer, position, length, error) && !error) {
+			last = get_u64(buffer.data() + position);
+			position += length;
+		}
+		broken = error;
+		offset += position;
+		buffer.erase(0, position);
+		if (broken && offset + (off_t)length < statbuff.st_size) {
+			printf("_log_repair: checksum mismatch of entry at %lld in the middle of the log\n", (long long)offset);
+			return false;
+		}
+	}
+	if (offset < statbuff.st_size) {
+		printf("_log_repair: truncate %lld broken bytes at the end\n", (long long)(statbuff.st_size - offset));
+		if (ftruncate(fd_, offset) < 0) {
+			printf("_log_repair: ftruncate error\n");
+			return false;
+		}
+	}
+	if (get_u64(header + kChange_next) <= last)
+		put_u64(header + kChange_next, last + 1);
+	put_u64(header + kChange_checked, offset);
+	if (pwrite(fd_, header + kChange_next, 16, kChange_next) != 16) {
+		printf("_log_repair: write error of header\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * 从第一条保留的记录开始找到第一条序号大于sequence的记录，把文件头里的起点挪过去，再把之前的部分打洞
+ * 不支持打洞的文件系统上只挪起点，空间不会释放
+ */
+bool ChangeLog::log_trim(long long sequence) {
+	RecordWritewLock writew_lock(fd_, 0, SEEK_SET, 1);
+	char header[kChange_header_size];
+	if (!writew_lock.locked() || pread(fd_, header, sizeof(header), 0) != sizeof(header)) {
+		printf("log_trim: read error of header\n");
+		return false;
+	}
+	off_t start = get_u64(header + kChange_start), offset = start;
+	long long trimmed = get_u64(header + kChange_trimmed);
+	std::string buffer;
+	char chunk[kChange_read_size];
+	bool done = false;
+	while (!done) {
+		ssize_t n = pread(fd_, chunk, sizeof(chunk), offset + buffer.length());
+		if (n < 0) {
+			printf("log_trim: read error\n");
+			return false;
+		}
+		if (!n)
+			break;
+		buffer.append(chunk, n);
+		size_t position = 0, length;
+		bool error;
+		while (parse_entry(buffer, position, length, error)) {
+			if (error) {
+				printf("log_trim: checksum mismatch of entry at %lld\n", (long long)(offset + position));
+				return false;
+			}
+			long long entry_sequence = get_u64(buffer.data() + position);
+			if (entry_sequence > sequence) {
+				done = true;
+				break;
+			}
+			trimmed = entry_sequence;
+			position += length;
+		}
+		offset += position;
+		buffer.erase(0, position);
+	}
+	if (offset == start)
+		return true;
+	put_u64(header + kChange_start, offset);
+	put_u64(header + kChange_trimmed, trimmed);
+	if ((off_t)get_u64(header + kChange_checked) < offset)
+		put_u64(header + kChange_checked, offset);
+	if (pwrite(fd_, header + kChange_checked, 24, kChange_checked) != 24) {
+		printf("log_trim: write error of header\n");
+		return false;
+	}
+	if (fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, offset - start) < 0 && EOPNOTSUPP != errno)
+		printf("log_trim: fallocate error\n");
+	return true;
+}
+
+void ChangeLog::log_close() {
+	if (fd_ >= 0)
+		close(fd_);
+	fd_ = -1;
+}
+
+/*
+ * 先把文件头里的序号加1再追加记录，中途崩溃只会让序号跳过一个，不会重复
+ * 文件头也要改写，所以不能用O_APPEND，持有文件头的锁时用文件大小作为追加的位置
+ */
+bool ChangeLog::log_append(char op, const std::string &key, const std::string &value) {
+	char header[kChange_header_size], entry[kChange_entry_header];
+	RecordWritewLock writew_lock(fd_, 0, SEEK_SET, 1);
+	if (!writew_lock.locked() || pread(fd_, header, sizeof(header), 0) != sizeof(header)) {
+		printf("log_append: read error of header\n");
+		return false;
+	}
+	uint64_t sequence = get_u64(header + kChange_next);
+	put_u64(header + kChange_next, sequence + 1);
+	struct stat statbuff;
+	if (fstat(fd_, &statbuff) < 0) {
+		printf("log_append: fstat error\n");
+		return false;
+	}
+	if (pwrite(fd_, header + kChange_next, 8, kChange_next) != 8) {
+		printf("log_append: write error of header\n");
+		return false;
+	}
+	put_u64(entry, sequence);
+	entry[8] = op;
+	put_u64(entry + 9, key.length(), 4);
+	put_u64(entry + 13, value.length(), 4);
+	uint32_t crc = crc32c(0, entry, 17);
+	crc = crc32c(crc, key.data(), key.length());
+	crc = crc32c(crc, value.data(), value.length());
+	put_u64(entry + 17, crc, 4);
+	struct iovec iov[3] = {{entry, sizeof(entry)}, {(void *)key.data(), key.length()}, {(void *)value.data(), value.length()}};
+	ssize_t length = sizeof(entry) + key.length() + value.length();
+	if (pwritev(fd_, iov, 3, statbuff.st_size) != length) {
+		//截掉写了一半的记录，否则之后追加的记录都会跟在坏字节后面
+		printf("log_append: write error of entry\n");
+		if (ftruncate(fd_, statbuff.st_size) < 0)
+			printf("log_append: ftruncate error\n");
+		return false;
+	}
+	return true;
+}
+
+long long ChangeLog::log_sequence() {
+	char header[kChange_header_size];
+	RecordReadwLock readw_lock(fd_, 0, SEEK_SET, 1);
+	if (!readw_lock.locked() || pread(fd_, header, sizeof(header), 0) != sizeof(header)) {
+		printf("log_sequence: read error of header\n");
+		return -1;
+	}
+	return get_u64(header + kChange_next) - 1;
+}
+
+/*
+ * 从上次停下的位置接着往后读，只有from比上次小时才从第一条保留的记录开始找
+ */
+long long ChangeLog::log_copy(int fd, long long from) {
+	char header[kChange_header_size];
+	{
+		RecordReadwLock readw_lock(fd_, 0, SEEK_SET, 1);
+		if (!readw_lock.locked() || pread(fd_, header, sizeof(header), 0) != sizeof(header)) {
+			printf("log_copy: read error of header\n");
+			return -1;
+		}
+	}
+	if (from < (long long)get_u64(header + kChange_trimmed)) {
+		printf("log_copy: entries after %lld have been trimmed\n", from);
+		return -1;
+	}
+	if (from < copy_sequence_ || copy_offset_ < (off_t)get_u64(header + kChange_start)) {
+		copy_sequence_ = 0;
+		copy_offset_ = get_u64(header + kChange_start);
+	}
+	std::string buffer;
+	char chunk[kChange_read_size];
+	long long last = from;
+	while (true) {
+		ssize_t n = pread(fd_, chunk, sizeof(chunk), copy_offset_ + buffer.length());
+		if (n < 0) {
+			printf("log_copy: read error\n");
+			return -1;
+		}
+		if (!n)
+			break;
+		buffer.append(chunk, n);
+		size_t position = 0, length;
+		bool error;
+		while (parse_entry(buffer, position, length, error)) {
+			if (error) {
+				printf("log_copy: checksum mismatch of entry at %lld\n", (long long)(copy_offset_ + position));
+				return -1;
+			}
+			long long sequence = get_u64(buffer.data() + position);
+			if (sequence > from) {
+				ssize_t written = 0;
+				while (written < (ssize_t)length) {
+					ssize_t w = write(fd, buffer.data() + position + written, length - written);
+					if (w < 0 && EINTR == errno)
+						continue;
+					if (w <= 0) {
+						printf("log_copy: write error\n");
+						return -1;
+					}
+					written += w;
+				}
+				last = sequence;
+			}
+			copy_sequence_ = sequence;
+			position += length;
+		}
+		copy_offset_ += position;
+		buffer.erase(0, position);
+	}
+	return last;
+}
+
+LogFollower::LogFollower() : fd_(-1), file_(false), offset_(0), sequence_(0) {}
+
+LogFollower::~LogFollower() {}
+
+bool LogFollower::follower_open(int fd, long long sequence) {
+	struct stat statbuff;
+	if (fstat(fd, &statbuff) < 0) {
+		printf("follower_open: fstat error\n");
+		return false;
+	}
+	fd_ = fd;
+	file_ = S_ISREG(statbuff.st_mode);
+	offset_ = kChange_header_size;
+	sequence_ = sequence;
+	pending_.clear();
+	if (file_) {
+		char header[kChange_header_size];
+		if (pread(fd_, header, sizeof(header), 0) != sizeof(header) || memcmp(header, kChange_magic, sizeof(kChange_magic))) {
+			printf("follower_open: invalid change log\n");
+			fd_ = -1;
+			return false;
+		}
+		if (sequence < (long long)get_u64(header + kChange_trimmed)) {
+			printf("follower_open: entries after %lld have been trimmed\n", sequence);
+			fd_ = -1;
+			return false;
+		}
+		offset_ = get_u64(header + kChange_start);
+	}
+	return true;
+}
+
+long long LogFollower::follower_sequence() {
+	return sequence_;
+}
+
+/*
+ * 再读一些字节到pending_，读到了返回true，文件末尾或者管道关闭返回false，出错时fd_置为-1
+ */
+bool LogFollower::_follower_fill() {
+	char chunk[kChange_read_size];
+	ssize_t n;
+	do
+		n = file_ ? pread(fd_, chunk, sizeof(chunk), offset_) : read(fd_, chunk, sizeof(chunk));
+	while (n < 0 && EINTR == errno);
+	if (n < 0) {
+		printf("_follower_fill: read error\n");
+		fd_ = -1;
+		return false;
+	}
+	pending_.append(chunk, n);
+	offset_ += n;
+	return n > 0;
+}
+
+int LogFollower::follower_apply(DB &db, int batch) {
+	if (fd_ < 0) {
+		printf("follower_apply: follower is not open\n");
+		return -1;
+	}
+	int applied = 0;
+	size_t position = 0, length;
+	bool error;
+	while (applied < batch) {
+		if (!parse_entry(pending_, position, length, error)) {
+			//管道已经读到过数据就先返回，不要阻塞在下一次读上
+			if ((applied && !file_) || !_follower_fill()) {
+				if (fd_ < 0)
+					return -1;
+				//文件末尾不完整的记录可能会被截掉重写，丢掉读到的部分，下次从记录开头重新读
+				if (file_) {
+					offset_ -= pending_.length() - position;
+					pending_.resize(position);
+				}
+				break;
+			}
+			continue;
+		}
+		if (error) {
+			printf("follower_apply: checksum mismatch of entry\n");
+			fd_ = -1;
+			return -1;
+		}
+		const char *entry = pending_.data() + position;
+		long long sequence = get_u64(entry);
+		if (sequence > sequence_) {
+			size_t key_length = get_u64(entry + 9, 4);
+			std::string key(entry + kChange_entry_header, key_length);
+			if (kChange_store == entry[8]) {
+				if (db.db_store(key, std::string(entry + kChange_entry_header + key_length, length - kChange_entry_header - key_length), DB_STORE)) {
+					printf("follower_apply: store error\n");
+					return -1;
+				}
+			}
+			else if (kChange_delete == entry[8])
+				//key可能本来就不在副本里，比如导出时已经是删除后的状态
+				db.db_delete(key);
+			else {
+				printf("follower_apply: invalid operation\n");
+				fd_ = -1;
+				return -1;
+			}
+			sequence_ = sequence;
+			++applied;
+		}
+		position += length;
+	}
+	pending_.erase(0, position);
+	return applied;
+}
+
+}
@@ -0,0 +1,83 @@
+#include "../include/v_crc32c.h"
+
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
+const uint32_t kCrc32c_poly = 0x82f63b78;   //Castagnoli多项式，按位反转的形式
+
+namespace vDB {
+
+/*
+ * slicing-by-8的查表，table[k][i]是字节i后面再跟k个0字节的crc
+ */
+struct Crc32cTable {
+	uint32_t table[8][256];
+	Crc32cTable() {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t crc = i;
+			for (int j = 0; j < 8; ++j)
+				crc = (crc >> 1) ^ (crc & 1 ? kCrc32c_poly : 0);
+			table[0][i] = crc;
+		}
+		for (uint32_t i = 0; i < 256; ++i)
+			for (int k = 1; k < 8; ++k)
+				table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+	}
+};
+
+/*
+ * 每次处理8个字节，8张表各查一次，不够8个字节的部分逐字节处理
+ */
+static uint32_t crc32c_slicing(uint32_t crc, const unsigned char *p, size_t length) {
+	static const Crc32cTable tables;
+	const uint32_t (*t)[256] = tables.table;
+	for (; length >= 8; p += 8, length -= 8) {
+		uint32_t low, high;
+		memcpy(&low, p, 4);
+		memcpy(&high, p + 4, 4);
+		low ^= crc;
+		crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+			t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+	}
+	while (length--)
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+#if defined(__x86_64__)
+/*
+ * crc32指令一次处理8个字节，只为这个函数打开SSE4.2，其余代码不受影响
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t length) {
+	uint64_t crc64 = crc;
+	for (; length >= 8; p += 8, length -= 8) {
+		uint64_t word;
+		memcpy(&word, p, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = crc64;
+	while (length--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+#endif
+
+typedef uint32_t (*Crc32cFunction)(uint32_t, const unsigned char*, size_t);
+
+static Crc32cFunction crc32c_select() {
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2"))
+		return crc32c_sse42;
+#endif
+	return crc32c_slicing;
+}
+
+uint32_t crc32c(uint32_t crc, const void *buffer, size_t length) {
+	static const Crc32cFunction function = crc32c_select();
+	return ~function(~crc, (const unsigned char *)buffer, length);
+}
+
+}
@@ -1,96 +1,390 @@
 #include "../include/v_db.h"
 #include "../include/record_lock.h"
+#include "../include/v_db_cache.h"
+#include "../include/v_db_pool.h"
+#include "../include/v_crc32c.h"
+#include "../include/v_change_log.h"
 
+#include <cerrno>
 #include <cstring>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <zlib.h>
 #include <fcntl.h>
 #include <stdarg.h>
 #include <unistd.h>
 #include <sys/uio.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
 
-const int kPtr_size = 7;                 //idxļеptrṹĴС
-const off_t kPtr_max = 9999999;          //ptrֵ7λ
-const int kHash_table_size = 137;        //ĬϵhashС
-const off_t kHash_offset = kPtr_size;    //idxļhashƫ
-const int kHash_multipy_factor = 31;     //hashֵʱ۳
-const int kIndex_length_size = 4;        //洢index¼ȵֽ
-const off_t kFree_offset = 0;            //ƫ
+const int kPtr_size = 7;                 //idx文件中的ptr结构的大小
+const off_t kPtr_max = 9999999;          //ptr的最大值，7位
+const int kHash_table_size = 137;        //默认的hash表大小
+const off_t kHash_offset = kPtr_size;    //idx文件中hash表的偏移量
+const int kHash_multipy_factor = 31;     //计算hash值时的累乘因子
+const int kIndex_length_size = 4;        //存储index记录长度的字节数
+const int kData_length_size = 4;         //存储data长度和容量的字节数
+const int kCrc_size = 8;                 //校验和的字节数，16进制的CRC32C
+const int kIndex_prefix_size = kPtr_size + kIndex_length_size + kCrc_size;   //index记录的前缀，下一个节点的偏移量+记录长度+校验和
+const int kData_header_size = kData_length_size + kCrc_size;   //data记录的头部，长度+校验和
+const int kIndex_key_offset = kPtr_size + kData_length_size;   //index记录中key的偏移量，前面是data的偏移量和容量
+const int kSlot_max = kData_header_size + vDB::kData_max;   //data记录所占空间的最大值
+const int kSlot_min = 8;                 //data记录所占空间的最小值，容量从这里开始按1.25倍增长
+const off_t kFree_offset = 0;            //空闲链表偏移量
+const off_t kDict_offset = (kHash_table_size + 1) * kPtr_size;   //idx文件中字典长度的偏移量，紧跟在hash表后面
+const off_t kIndex_header_size = kDict_offset + kPtr_size + 1;   //idx文件头的大小，空闲链表指针+hash表+字典长度+换行符，字典紧跟在后面
+const int kFind_check_depth = 1024;     //查找走过这么多节点之后开始检查链表是不是成环了
+const size_t kIndex_read_size = 1 << 16; //db_verify顺序扫idx文件时每次读的字节数
+const int kBulk_buffer_size = 1 << 20;   //批量导入时的写缓冲区大小
+const int kDict_max = 8192;              //字典的最大长度，每次压缩都要重新载入字典，所以不宜太大
+const int kDict_gram = 8;                //训练字典时统计的子串长度
+const int kDict_segment = 32;            //训练字典时候选片段的长度
+const int kPool_index_weight = 3;        //缓冲池里idx文件页的权重，hash表和链表节点比data更值得留下
+const int kPool_data_weight = 1;         //缓冲池里dat文件页的权重
+const unsigned kVerify_sample = 16;      //抽样校验时每这么多条记录校验一条
+const int kAdaptive_depth = 2;           //自适应模式下前面至少有这么多个节点才值得挪到链头
+const char kDump_magic[8] = "vDBDUMP";   //导出流的标志
+const uint32_t kDump_version = 2;        //导出流的版本，2在头部加了变更日志的序号
+const size_t kDump_block_size = 1 << 20; //导出流里一块的大小上限，每块单独校验
+const int kDump_block_header = 12;       //块头的大小，记录数+长度+校验和
 
-const char kNew_line = '\n';             //з
-const char kSeparate = ':';              //ָ
-const char kSpace = ' ';                 //ո
+const char kSpace = ' ';                 //空格符
+const char kData_raw = 'r';              //data记录的标志，原样存储
+const char kData_compressed = 'z';       //data记录的标志，用字典压缩后存储
 
 namespace vDB {
 
+/*
+ * 写入校验和字段，不写终止符
+ */
+static void format_crc(char *field, const char *buffer, int length) {
+	char crc[kCrc_size + 1];
+	sprintf(crc, "%08x", crc32c(0, buffer, length));
+	memcpy(field, crc, kCrc_size);
+}
+
+/*
+ * 比较校验和字段和buffer的CRC32C，一致返回true
+ */
+static bool check_crc(const char *field, const char *buffer, int length) {
+	char crc[kCrc_size + 1];
+	memcpy(crc, field, kCrc_size);
+	crc[kCrc_size] = 0;
+	char *end;
+	unsigned long value = strtoul(crc, &end, 16);
+	return end == crc + kCrc_size && value == crc32c(0, buffer, length);
+}
+
+/*
+ * 导出流里的整数都是小端的，和机器的字节序无关
+ */
+static void put_u32(char *buffer, uint32_t value) {
+	for (int i = 0; i < 4; ++i)
+		buffer[i] = (char)(value >> (i * 8));
+}
+
+static uint32_t get_u32(const char *buffer) {
+	uint32_t value = 0;
+	for (int i = 0; i < 4; ++i)
+		value |= (uint32_t)(unsigned char)buffer[i] << (i * 8);
+	return value;
+}
+
+static void put_u64(char *buffer, uint64_t value) {
+	put_u32(buffer, (uint32_t)value);
+	put_u32(buffer + 4, (uint32_t)(value >> 32));
+}
+
+static uint64_t get_u64(const char *buffer) {
+	return get_u32(buffer) | (uint64_t)get_u32(buffer + 4) << 32;
+}
+
+/*
+ * 写满或者读满n个字节，fd可以是管道
+ * 成功返回true，失败返回false，读的时候遇到文件结束也返回false
+ */
+static bool write_full(int fd, const char *buffer, size_t n) {
+	while (n) {
+		ssize_t written = write(fd, buffer, n);
+		if (written < 0 && EINTR == errno)
+			continue;
+		if (written <= 0)
+			return false;
+		buffer += written;
+		n -= written;
+	}
+	return true;
+}
+
+static bool read_full(int fd, char *buffer, size_t n) {
+	while (n) {
+		ssize_t got = read(fd, buffer, n);
+		if (got < 0 && EINTR == errno)
+			continue;
+		if (got <= 0)
+			return false;
+		buffer += got;
+		n -= got;
+	}
+	return true;
+}
+
+/*
+ * 在块的内容后面追加一条记录，key长度+value长度+key+value
+ */
+static void dump_record(string &payload, const string &key, const string &value) {
+	char lengths[8];
+	put_u32(lengths, key.length());
+	put_u32(lengths + 4, value.length());
+	payload.append(lengths, sizeof(lengths));
+	payload.append(key);
+	payload.append(value);
+}
+
+/*
+ * 写出一块，内容是data开始的length字节，count为0的空块是流的结束标志
+ */
+static bool dump_block(int fd, const char *data, size_t length, uint32_t count) {
+	char header[kDump_block_header];
+	put_u32(header, count);
+	put_u32(header + 4, length);
+	put_u32(header + 8, crc32c(0, data, length));
+	if (!write_full(fd, header, sizeof(header)) || !write_full(fd, data, length)) {
+		printf("dump_block: write error\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * 写出一块并清空payload
+ */
+static bool dump_block(int fd, string &payload, uint32_t count) {
+	if (!dump_block(fd, payload.data(), payload.length(), count))
+		return false;
+	payload.clear();
+	return true;
+}
+
+/*
+ * 头部是标志+版本+保留的4字节+导出开始时变更日志的序号
+ */
+static bool dump_header(int fd, long long sequence) {
+	char header[24];
+	memcpy(header, kDump_magic, sizeof(kDump_magic));
+	put_u32(header + 8, kDump_version);
+	put_u32(header + 12, 0);
+	put_u64(header + 16, sequence);
+	if (!write_full(fd, header, sizeof(header))) {
+		printf("dump_header: write error\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * 按顺序读出导出流里的记录
+ */
+struct DumpReader {
+	int fd;
+	string payload;           //当前块的内容
+	size_t position;          //下一条记录在payload中的位置
+	uint32_t left;            //当前块里还没读的记录数
+	bool started;             //是否已经读过流的头部
+	bool finished;            //是否读到了结束的空块
+	bool failed;              //是否出错
+	long long sequence;       //头部里的变更日志序号，版本1的流没有，当作0
+
+	explicit DumpReader(int file) : fd(file), position(0), left(0), started(false), finished(false), failed(false), sequence(0) {}
+	/*
+	 * 读出下一条记录，读到结束标志或者出错时返回false，用finished和failed区分
+	 */
+	bool next(string &key, string &value) {
+		if (finished || failed)
+			return false;
+		if (!started) {
+			char header[24];
+			if (!read_full(fd, header, 16) || memcmp(header, kDump_magic, sizeof(kDump_magic)) || get_u32(header + 8) < 1 || get_u32(header + 8) > kDump_version)
+				return fail("invalid dump header");
+			if (get_u32(header + 8) >= 2) {
+				if (!read_full(fd, header + 16, 8))
+					return fail("dump stream is truncated");
+				sequence = get_u64(header + 16);
+			}
+			started = true;
+		}
+		while (!left) {
+			char header[kDump_block_header];
+			if (!read_full(fd, header, sizeof(header)))
+				return fail("dump stream is truncated");
+			left = get_u32(header);
+			uint32_t length = get_u32(header + 4);
+			if (length > kDump_block_size + kIndex_max + kData_max + 8)
+				return fail("invalid block length");
+			payload.resize(length);
+			position = 0;
+			if (!read_full(fd, &payload[0], length))
+				return fail("dump stream is truncated");
+			if (crc32c(0, payload.data(), length) != get_u32(header + 8))
+				return fail("checksum mismatch of block");
+			if (!left) {
+				finished = true;
+				return false;
+			}
+		}
+		if (position + 8 > payload.length())
+			return fail("invalid record");
+		uint32_t key_length = get_u32(&payload[position]), value_length = get_u32(&payload[position + 4]);
+		position += 8;
+		if (key_length + value_length > payload.length() - position)
+			return fail("invalid record");
+		key.assign(payload, position, key_length);
+		value.assign(payload, position + key_length, value_length);
+		position += key_length + value_length;
+		--left;
+		return true;
+	}
+	bool fail(const char *message) {
+		printf("db_restore: %s\n", message);
+		failed = true;
+		return false;
+	}
+};
+
+/*
+ * 解码一条data记录的内容，第一个字节是标志，压缩的记录用stream和字典解压
+ * 成功返回true，失败返回false
+ */
+static bool decode_data(z_stream *stream, const string &dict, const char *record, int length, string &value) {
+	if (kData_raw == record[0]) {
+		value.assign(record + 1, length - 1);
+		return true;
+	}
+	if (kData_compressed != record[0] || !stream) {
+		printf("_db_decode_data: invalid data flag\n");
+		return false;
+	}
+	char buffer[vDB::kData_max];
+	if (inflateReset(stream) != Z_OK) {
+		printf("_db_decode_data: inflateReset error\n");
+		return false;
+	}
+	stream->next_in = (Bytef *)record + 1;
+	stream->avail_in = length - 1;
+	stream->next_out = (Bytef *)buffer;
+	stream->avail_out = vDB::kData_max;
+	//raw deflate没有字典标记，直接设置字典
+	if (inflateSetDictionary(stream, (const Bytef *)dict.data(), dict.length()) != Z_OK) {
+		printf("_db_decode_data: inflate dictionary error\n");
+		return false;
+	}
+	if (inflate(stream, Z_FINISH) != Z_STREAM_END) {
+		printf("_db_decode_data: inflate error\n");
+		return false;
+	}
+	value.assign(buffer, vDB::kData_max - stream->avail_out);
+	return true;
+}
+
 DB::DB() {
-	//ʼӳ亯
+	index_.fd = data_.fd = -1;
+	index_.buffer = data_.buffer = nullptr;
+	readonly_ = false;
+	deflate_stream_ = inflate_stream_ = nullptr;
+	cache_ = nullptr;
+	pool_ = nullptr;
+	change_log_ = nullptr;
+	verify_ = VERIFY_ALWAYS;
+	verify_count_ = 0;
+	adaptive_ = 0;
+	adaptive_seed_ = 2463534242u;
+	find_depth_ = 0;
+	index_error_ = false;
+	memset(&stats_, 0, sizeof(stats_));
+	//初始化映射函数
 	_db_bind_function();
 }
 DB::~DB() {
 	/*
-	 * 뿪ͷԴ
-	 * ûԼclose
+	 * 离开作用域会释放资源
+	 * 最好还是自己调用close吧
 	 */
 	_db_free();
 }
 
 bool DB::db_open(const string &pathname, int oflag, ...) {
-	//fpathnameΪ
+	//检查fpathname，不允许为空
 	if (!pathname.length()){
 		printf("db_open: pathname can not be blank\n");
 		return false;
 	}
-	//Դ
+	//分配资源
 	if (!_db_allocate())
 		return false;
 	/*
-	 * ʼ·fd
+	 * 初始化路径和fd
 	 */
 	pathname_ = pathname;
 	index_.fd = data_.fd = -1;
-	//oflag
+	readonly_ = (oflag & O_ACCMODE) == O_RDONLY;
+	//处理oflag
 	if (oflag & O_CREAT) {
 		va_list ap;
 		va_start(ap, oflag);
 		int mode = va_arg(ap, int);
 		va_end(ap);
 		
-		//idxļdatļ
+		//打开idx文件和dat文件
 		index_.fd = open((pathname_ + ".idx").c_str(), oflag, mode);
 		data_.fd = open((pathname_ + ".dat").c_str(), oflag, mode);
 	}
 	else {
-		//idxļdatļ
+		//打开idx文件和dat文件
 		index_.fd = open((pathname_ + ".idx").c_str(), oflag);
 		data_.fd = open((pathname_ + ".dat").c_str(), oflag);
 	}
 	if (index_.fd < 0 || data_.fd < 0) {
-		//ʧ
+		//打开失败
+		_db_free();
+		return false;
+	}
+	//共享的flock，开启了缓冲池的句柄会持有独占的flock，这时不能再打开
+	if (flock(index_.fd, LOCK_SH | LOCK_NB) < 0) {
+		printf("db_open: db is owned by a buffer pool\n");
 		_db_free();
 		return false;
 	}
+	bool initialized = false;     //数据库是不是刚刚初始化的
 	if ((oflag & (O_CREAT | O_TRUNC)) == (O_CREAT | O_TRUNC)) {
 		/*
-		 * ݿ´ģǱʼ
-		 * дסļǲͳҽгʼ
-		 * ĴСԶʼ
+		 * 如果数据库是重新创建的，我们必须初始化它
+		 * 写锁住整个文件，我们才能统计它并且进行初始化
+		 * 检查它的大小，并且自动初始化它
 		 */
 		struct stat statbuff;
-		char asciiptr[kPtr_size + 1], hash[(kHash_table_size + 1) * kPtr_size + 2];   //+2Ϊnullͻз
+		char asciiptr[kPtr_size + 1], hash[kIndex_header_size + 1];   //+1是为了null
 		asciiptr[kPtr_size] = 0;
 		RecordWritewLock writew_lock(index_.fd, 0, SEEK_SET, 0);
-		if (fstat(index_.fd, &statbuff) < 0) {
+		if (!writew_lock.locked() || fstat(index_.fd, &statbuff) < 0) {
 			printf("db_open: fstat error\n");
 			return false;
 		}
 		if (!statbuff.st_size) {
 			/*
-			 * Ǳ빹һֵΪ0kHashtablesize + 1
-			 * + 1ʾhash֮ǰĿбָ
+			 * 我们必须构建一个值为0的kHashtablesize + 2的链表
+			 * + 2表示hash表之前的空闲列表指针和hash表之后的字典长度
 			 */
 			sprintf(asciiptr, "%*d", kPtr_size, 0);
 			hash[0] = 0;
-			for (int i = 0; i < kHash_table_size + 1; i++)
+			for (int i = 0; i < kHash_table_size + 2; i++)
 				strcat(hash, asciiptr);
 			strcat(hash, "\n");
 			int size = strlen(hash);
@@ -98,8 +392,41 @@ bool DB::db_open(const string &pathname, int oflag, ...) {
 				printf("db_open: index file init write error\n");
 				return false;
 			}
+			initialized = true;
 		}
 	}
+	//共享缓存已经存在就自动连接，数据库是新建的就把缓存里旧的内容作废
+	SharedCache *cache = new SharedCache();
+	if (cache->cache_attach(index_.fd, 0, kHash_table_size)) {
+		cache_ = cache;
+		if (initialized) {
+			RecordWritewLock writew_lock(index_.fd, 0, SEEK_SET, 0);
+			if (writew_lock.locked())
+				cache_->cache_reset();
+			else {
+				//作废不了就不用缓存
+				cache_ = nullptr;
+				delete cache;
+			}
+		}
+	}
+	else
+		delete cache;
+	//变更日志同样自动打开，新建的数据库和旧的日志对不上，直接删掉
+	if (initialized)
+		unlink((pathname_ + ".clog").c_str());
+	else {
+		ChangeLog *log = new ChangeLog();
+		if (log->log_open(pathname_ + ".clog", readonly_ ? O_RDONLY : O_RDWR))
+			change_log_ = log;
+		else
+			delete log;
+	}
+	//载入字典，有字典就说明这个数据库开启了压缩
+	if (!_db_load_dict()) {
+		_db_free();
+		return false;
+	}
 	return true;
 }
 
@@ -114,7 +441,7 @@ bool DB::_db_allocate() {
 		printf("_db_allocate: malloc error for index buffer\n");
 		goto allocate_fail;
 	}
-	if (!(data_.buffer = new char[kData_max + 2])) {
+	if (!(data_.buffer = new char[kSlot_max])) {
 		printf("_db_allocate: malloc error for data buffer\n");
 		goto allocate_fail;
 	}
@@ -125,17 +452,45 @@ allocate_fail:
 }
 
 /*
- * ͷԴ
+ * 释放资源
  */
 void DB::_db_free() {
+	/*
+	 * 释放后要重置，db_close之后析构函数还会再调用一次
+	 * 缓冲池里的脏页要在关闭文件之前写回
+	 */
+	if (pool_) {
+		if (!pool_->pool_flush())
+			printf("_db_free: flush buffer pool error\n");
+		delete pool_;
+	}
+	pool_ = nullptr;
 	if (index_.fd >= 0)
 		close(index_.fd);
 	if (data_.fd >= 0)
 		close(data_.fd);
 	if (index_.buffer)
-		delete index_.buffer;
+		delete[] index_.buffer;
 	if (data_.buffer)
-		delete data_.buffer;
+		delete[] data_.buffer;
+	index_.fd = data_.fd = -1;
+	index_.buffer = data_.buffer = nullptr;
+	if (deflate_stream_) {
+		deflateEnd(deflate_stream_);
+		delete deflate_stream_;
+	}
+	if (inflate_stream_) {
+		inflateEnd(inflate_stream_);
+		delete inflate_stream_;
+	}
+	deflate_stream_ = inflate_stream_ = nullptr;
+	dict_.clear();
+	if (cache_)
+		delete cache_;
+	cache_ = nullptr;
+	if (change_log_)
+		delete change_log_;
+	change_log_ = nullptr;
 }
 
 void DB::db_close() {
@@ -143,209 +498,576 @@ void DB::db_close() {
 }
 
 string DB::db_fetch(const string &key) {
-	off_t start_offset = _db_hash(key) * kPtr_size + kHash_offset;
 	string value;
-	//Ӹֻһֽ
-	RecordReadwLock readw_lock(index_.fd, start_offset, SEEK_SET, 1);
-	if (_db_find(key, start_offset)) 
-		//ҳɹ
-		value = _db_read_data();
+	if (DB::db_try_fetch(key, value, -1))
+		return "";
+	//读锁不能直接升级成写锁，放掉读锁以后再挪
+	if (find_depth_ >= kAdaptive_depth && _db_should_promote())
+		_db_move_to_front(key, _db_hash(key) * kPtr_size + kHash_offset);
 	return value;
 }
 
 /*
- * keyhashֵ
+ * 等待时间小于0时一直等，db_fetch就是这样调用的
+ */
+int DB::db_try_fetch(const string &key, string &value, long long timeout) {
+	off_t start_offset = _db_hash(key) * kPtr_size + kHash_offset;
+	value.clear();
+	//加个读锁，只锁第一个字节
+	RecordTimedReadLock read_lock(index_.fd, start_offset, SEEK_SET, 1, timeout);
+	if (!read_lock.locked()) {
+		if (read_lock.busy())
+			return kDB_busy;
+		printf("db_try_fetch: lock error\n");
+		return -1;
+	}
+	if (!_db_find(key, start_offset))
+		return index_error_ ? -1 : 1;
+	//查找成功
+	value = _db_read_data();
+	return value.empty() ? -1 : 0;
+}
+
+/*
+ * 和db_verify一样每个线程认领一条hash链，直接读记录，不经过句柄里的缓冲区
+ * 持有链的读锁时只把整条链读进payload，记下哪些位置攒满了一块，放掉锁之后再加互斥锁写出
+ * 输出很慢或者其他线程在等互斥锁时也不会挡住这条链上的写，块之间的顺序不固定
+ */
+bool DB::db_dump(int fd, int threads) {
+	if (index_.fd < 0) {
+		printf("db_dump: db is not open\n");
+		return false;
+	}
+	//缓冲池里的脏页只有这个句柄看得到，退回单线程的db_scan
+	if (pool_)
+		return _db_dump_scan(fd);
+	struct stat statbuff;
+	if (fstat(index_.fd, &statbuff) < 0) {
+		printf("db_dump: fstat error\n");
+		return false;
+	}
+	//序号要在读任何一条链之前取，序号之后的修改跟随者都会重放
+	long long sequence = db_sequence();
+	if (sequence < 0 || !dump_header(fd, sequence))
+		return false;
+	long long max_steps = statbuff.st_size / (kIndex_prefix_size + kIndex_min) + 1;
+	std::atomic<int> next_chain(0);
+	std::atomic<bool> failed(false);
+	std::mutex output;
+	auto worker = [&]() {
+		char record[kIndex_prefix_size + kIndex_max], slot[kSlot_max], field[kPtr_size + 1];
+		z_stream stream;
+		memset(&stream, 0, sizeof(stream));
+		bool inflating = !dict_.empty() && inflateInit2(&stream, -MAX_WBITS) == Z_OK;
+		string payload, key, value;
+		uint32_t count = 0;
+		size_t block_start = 0;                              //还没攒满的块在payload里的起点
+		std::vector<std::pair<size_t, uint32_t> > blocks;    //攒满的块在payload里的终点和记录数
+		for (int chain; !failed && (chain = next_chain++) < kHash_table_size; ) {
+			off_t head = chain * kPtr_size + kHash_offset;
+			{
+				RecordReadwLock readw_lock(index_.fd, head, SEEK_SET, 1);
+				if (!readw_lock.locked() || pread(index_.fd, field, kPtr_size, head) != kPtr_size) {
+					printf("db_dump: read error of hash table\n");
+					failed = true;
+					break;
+				}
+				field[kPtr_size] = 0;
+				off_t offset = atol(field);
+				for (long long steps = 0; offset; ++steps) {
+					ssize_t n = pread(index_.fd, record, sizeof(record), offset);
+					memcpy(field, record + kPtr_size, kIndex_length_size);
+					field[kIndex_length_size] = 0;
+					int length = atoi(field);
+					if (steps > max_steps || n < kIndex_prefix_size || length < kIndex_min || length > kIndex_max || n < kIndex_prefix_size + length ||
+						!check_crc(record + kPtr_size + kIndex_length_size, record + kIndex_prefix_size, length)) {
+						printf("db_dump: index record at %lld is broken\n", (long long)offset);
+						failed = true;
+						break;
+					}
+					memcpy(field, record, kPtr_size);
+					field[kPtr_size] = 0;
+					off_t next_offset = atol(field);
+					memcpy(field, record + kIndex_prefix_size, kPtr_size);
+					off_t data_offset = atol(field);
+					memcpy(field, record + kIndex_prefix_size + kPtr_size, kData_length_size);
+					field[kData_length_size] = 0;
+					int capacity = atoi(field);
+					int data_length = -1;
+					if (capacity >= kData_header_size + kData_min && capacity <= kSlot_max && pread(data_.fd, slot, capacity, data_offset) == capacity) {
+						memcpy(field, slot, kData_length_size);
+						data_length = atoi(field);
+					}
+					if (data_length < kData_min || kData_header_size + data_length > capacity ||
+						!check_crc(slot + kData_length_size, slot + kData_header_size, data_length) ||
+						!decode_data(inflating ? &stream : nullptr, dict_, slot + kData_header_size, data_length, value)) {
+						printf("db_dump: data record at %lld is broken\n", (long long)data_offset);
+						failed = true;
+						break;
+					}
+					key.assign(record + kIndex_prefix_size + kIndex_key_offset, length - kIndex_key_offset);
+					dump_record(payload, key, value);
+					++count;
+					offset = next_offset;
+					//每条记录之后就检查，一条很长的链也不会让块超过读取时的上限
+					if (payload.length() - block_start >= kDump_block_size) {
+						blocks.push_back(std::make_pair(payload.length(), count));
+						block_start = payload.length();
+						count = 0;
+					}
+				}
+			}
+			if (failed || blocks.empty())
+				continue;
+			{
+				std::lock_guard<std::mutex> guard(output);
+				size_t start = 0;
+				for (size_t i = 0; i < blocks.size(); ++i) {
+					if (!dump_block(fd, payload.data() + start, blocks[i].first - start, blocks[i].second)) {
+						failed = true;
+						break;
+					}
+					start = blocks[i].first;
+				}
+			}
+			payload.erase(0, block_start);
+			block_start = 0;
+			blocks.clear();
+		}
+		if (!failed && count) {
+			std::lock_guard<std::mutex> guard(output);
+			if (!dump_block(fd, payload, count))
+				failed = true;
+		}
+		if (inflating)
+			inflateEnd(&stream);
+	};
+	std::vector<std::thread> workers;
+	for (int i = 1; i < threads; ++i)
+		workers.push_back(std::thread(worker));
+	worker();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	string end;
+	return !failed && dump_block(fd, end, 0);
+}
+
+bool DB::db_restore(int fd, long long &sequence) {
+	DumpReader reader(fd);
+	bool result = _db_bulk_load([&reader](string &key, string &value) {
+		return reader.next(key, value);
+	}, &reader.failed);
+	sequence = reader.sequence;
+	return result;
+}
+
+bool DB::_db_dump_scan(int fd) {
+	if (!dump_header(fd, 0))
+		return false;
+	string payload;
+	uint32_t count = 0;
+	bool written = true;
+	bool result = db_scan([fd, &payload, &count, &written](const string &key, const string &value) {
+		dump_record(payload, key, value);
+		if (++count, payload.length() >= kDump_block_size) {
+			written = dump_block(fd, payload, count);
+			count = 0;
+		}
+		return written;
+	});
+	if (!result || !written || (count && !dump_block(fd, payload, count)))
+		return false;
+	return dump_block(fd, payload, 0);
+}
+
+bool DB::_db_restore_read(int fd, long long &sequence, const std::function<bool(string&, string&)> &apply) {
+	DumpReader reader(fd);
+	string key, value;
+	while (reader.next(key, value))
+		if (!apply(key, value))
+			return false;
+	sequence = reader.sequence;
+	return reader.finished;
+}
+
+bool DB::db_change_log() {
+	if (change_log_)
+		return true;
+	if (readonly_ || index_.fd < 0) {
+		printf("db_change_log: db is readonly or not opened\n");
+		return false;
+	}
+	ChangeLog *log = new ChangeLog();
+	if (!log->log_open(pathname_ + ".clog", O_RDWR | O_CREAT)) {
+		printf("db_change_log: open change log error\n");
+		delete log;
+		return false;
+	}
+	change_log_ = log;
+	return true;
+}
+
+long long DB::db_sequence() {
+	return change_log_ ? change_log_->log_sequence() : 0;
+}
+
+bool DB::db_trim_log(long long sequence) {
+	if (!change_log_) {
+		printf("db_trim_log: change log is not open\n");
+		return false;
+	}
+	return change_log_->log_trim(sequence);
+}
+
+/*
+ * 修改成功后在持有hash链写锁时调用，没有开启日志时什么都不做
+ * 失败时修改已经生效，只能记到统计里，调用者照样返回失败
+ */
+bool DB::_db_log_change(char op, const string &key, const string &value) {
+	if (!change_log_ || change_log_->log_append(op, key, value))
+		return true;
+	printf("_db_log_change: append change log error\n");
+	stats_.log_errors++;
+	return false;
+}
+
+bool DB::db_set_adaptive(int sample) {
+	if (sample < 0) {
+		printf("db_set_adaptive: invalid sample\n");
+		return false;
+	}
+	adaptive_ = sample;
+	return true;
+}
+
+/*
+ * 自适应模式下按1/adaptive_的概率返回true，用xorshift生成随机数
+ */
+bool DB::_db_should_promote() {
+	if (!adaptive_ || readonly_)
+		return false;
+	adaptive_seed_ ^= adaptive_seed_ << 13;
+	adaptive_seed_ ^= adaptive_seed_ >> 17;
+	adaptive_seed_ ^= adaptive_seed_ << 5;
+	return !(adaptive_seed_ % adaptive_);
+}
+
+/*
+ * 把key的节点挪到hash链头，offset是hash链的起点
+ * 放掉读锁之后链可能被别人改过，所以加写锁后重新查找一次
+ * 直接改三个ptr时中途崩溃会把节点从链上丢掉，所以先像插入一样在链头挂一份拷贝，再像删除一样摘掉原来的节点
+ * 中途崩溃最多留下两份一样的记录，查找先遇到链头的拷贝，db_verify会报告重复的key
+ */
+void DB::_db_move_to_front(const string &key, off_t offset) {
+	RecordWritewLock writew_lock(index_.fd, offset, SEEK_SET, 1);
+	if (!writew_lock.locked() || !_db_find(key, offset) || pre_offset_ == offset)
+		return;
+	//data记录原样拷贝，不用重新编码
+	if (_db_read_data().empty())
+		return;
+	string data(data_.buffer + kData_header_size, data_.length);
+	off_t index_offset = index_.offset, pre_offset = pre_offset_, next_offset = next_offset_, data_offset = data_.offset;
+	int data_capacity = data_.capacity;
+	if (_db_store_insert(key, data, false, offset)) {
+		printf("_db_move_to_front: insert copy error\n");
+		return;
+	}
+	//原来的节点前后都没变，恢复句柄里的状态后按删除的方式摘掉
+	index_.offset = index_offset;
+	pre_offset_ = pre_offset;
+	next_offset_ = next_offset;
+	data_.offset = data_offset;
+	data_.capacity = data_capacity;
+	key_length_ = key.length();
+	if (!_db_do_delete()) {
+		printf("_db_move_to_front: delete original error\n");
+		return;
+	}
+	stats_.promotions++;
+}
+
+/*
+ * 先按hash链排序，同一条hash链上的key只加一次锁
+ */
+void DB::db_multi_fetch(const std::vector<string> &keys, std::vector<string> &values) {
+	values.assign(keys.size(), string());
+	std::vector<std::pair<DBHASH, size_t> > order(keys.size());
+	for (size_t i = 0; i < keys.size(); ++i)
+		order[i] = std::make_pair(_db_hash(keys[i]), i);
+	std::sort(order.begin(), order.end());
+	for (size_t i = 0; i < order.size(); ) {
+		DBHASH hash = order[i].first;
+		off_t start_offset = hash * kPtr_size + kHash_offset;
+		RecordReadwLock readw_lock(index_.fd, start_offset, SEEK_SET, 1);
+		for (; i < order.size() && order[i].first == hash; ++i)
+			if (readw_lock.locked() && _db_find(keys[order[i].second], start_offset))
+				values[order[i].second] = _db_read_data();
+	}
+}
+
+/*
+ * 计算key的hash值
  */
 DBHASH DB::_db_hash(const string &key) {
 	DBHASH hash_value = 0;
 	for (int i = 0; i < key.length(); ++i)
-		//ַhash
+		//字符串hash
 		hash_value = hash_value * kHash_multipy_factor + key[i];
 	hash_value %= kHash_table_size;
 	return hash_value;
 }
 
 /*
- * Ƿkey
- * õhash洢ĽṹoffsetΪӦhashʼƫҲǲҵ
- * ô˺ǰҪ
- * ɹtrueʧܷfalse
- * ҳɹصĽ洢index_data_
+ * 查找是否存在这个key
+ * 用的是hash表存储的结构，offset为对应的hash链表的起始偏移量，也就是查找的起点
+ * 调用此函数前需要自行上锁
+ * 成功返回true，失败返回false，失败时index_error_为true表示链上有损坏，调用者不能当成key不存在
+ * 查找成功后相关的结果存储在index_和data_中
  */
 bool DB::_db_find(const string& key, off_t offset) {
+	//每次查找是缓冲池里的一次操作
+	if (pool_)
+		pool_->pool_tick();
+	stats_.lookups++;
+	find_depth_ = 0;
+	index_error_ = false;
 	pre_offset_ = offset;
 	offset = _db_read_ptr(offset);
-	while (offset) {
+	while (offset && !index_error_) {
+		stats_.lookup_visits++;
 		off_t next_offset = _db_read_idx(offset);
-		if (!strcmp(index_.buffer, key.c_str())) 
-			//ָĵһԪkey
-			return true;
-		pre_offset_ = offset;                  //¼һread_idxǰһڵ
+		if (index_error_)
+			break;
+		if (key_length_ == key.length() && !memcmp(index_.buffer + kIndex_key_offset, key.data(), key_length_)) {
+			//先比较长度再比较内容
+			index_error_ = !_db_verify_idx();
+			return !index_error_;
+		}
+		pre_offset_ = offset;                  //记录最后一次read_idx的前一个节点
 		offset = next_offset;
+		//损坏的ptr可能让链表成环，走过的节点比文件里能放下的还多就是出错了
+		if (!(++find_depth_ % kFind_check_depth) &&
+			find_depth_ > _db_file_size(index_.fd) / (kIndex_prefix_size + kIndex_min)) {
+			printf("_db_find: hash chain has a loop\n");
+			index_error_ = true;
+		}
 	}
 	return false;
 }
 
 /*
- * .idxļеoffsetƫȡһkPtr_sizeһpointerһڵƫ
- * 0Ƕȡʧܻβڵˣɹ򷵻ضӦƫ
+ * 在.idx文件中的offset偏移量里读取一个kPtr_size的一个pointer（就是下一个节点的偏移量）
+ * 返回0则是读取失败或者是尾节点了，成功则返回对应的偏移量
  */
 off_t DB::_db_read_ptr(off_t offset) {
 	char asciiptr[kPtr_size + 1];
-	if (-1 == lseek(index_.fd, offset, SEEK_SET)) {
-		printf("_db_read_ptr: lseek error to ptr field\n");
-		return 0;
+	//hash链的头指针先查共享缓存
+	int bucket = (offset - kHash_offset) / kPtr_size;
+	bool cached = cache_ && offset >= kHash_offset && offset < kDict_offset;
+	off_t ptr;
+	if (cached && cache_->cache_get_bucket(bucket, ptr)) {
+		stats_.cache_hits++;
+		return ptr;
 	}
-	if (read(index_.fd, asciiptr, kPtr_size) != kPtr_size) {
+	if (_db_pread(index_.fd, asciiptr, kPtr_size, offset) != kPtr_size) {
 		printf("_db_read_ptr: read error of ptr field\n");
+		index_error_ = true;
 		return 0;
 	}
 	asciiptr[kPtr_size] = 0;
-	return atol(asciiptr);
+	ptr = atol(asciiptr);
+	if (cached) {
+		stats_.cache_misses++;
+		cache_->cache_set_bucket(bucket, ptr);
+	}
+	return ptr;
 }
 
 /*
- * idxļoffsetĽڵϢHandleĽṹ
- * һindexidxļƫʧܷ0
+ * 把idx文件里offset里的节点信息读入Handle的结构里
+ * 返回下一个index在idx文件里的偏移量，失败返回0并且把index_error_设为true
+ * VERIFY_ALWAYS或者要放进共享缓存时马上校验，否则校验留到确定要用这条记录的时候
  */
 off_t DB::_db_read_idx(off_t offset) {
+	//先查共享缓存，命中就不用读文件了，缓存里的记录放进去之前都校验过
+	if (cache_ && offset && cache_->cache_get_node(offset, index_.buffer, index_.length, next_offset_)) {
+		stats_.cache_hits++;
+		index_.offset = offset;
+		index_crc_.clear();
+		if (_db_parse_idx())
+			return next_offset_;
+		index_error_ = true;
+		return 0;
+	}
 	/*
-	 * λidxļҼ¼ƫ
-	 * 0 == offsetʾӵǰƫȡ
+	 * 记录偏移量，一次pread读出指向下一个节点的ptr，index记录的长度，校验和和最长的index记录
+	 * 文件末尾的记录读到的字节会少一些，只要够这条记录就行
 	 */
-	if (-1 == (index_.offset = lseek(index_.fd, offset, !offset ? SEEK_CUR : SEEK_SET))) {
-		printf("_db_read_idx: leek error\n");
+	index_.offset = offset;
+	char record[kIndex_prefix_size + kIndex_max];
+	ssize_t read_length = _db_pread(index_.fd, record, sizeof(record), offset);
+	index_error_ = true;
+	if (read_length < kIndex_prefix_size) {
+		printf("_db_read_idx: read error of index record\n");
 		return 0;
 	}
-	//ֳֶȡһָһڵptrڶindex¼ĳ
 	char asciiptr[kPtr_size + 1], ptr_length[kIndex_length_size + 1];
-	struct iovec iov[2];
-	iov[0].iov_base = asciiptr;
-	iov[0].iov_len = kPtr_size;
-	iov[1].iov_base = ptr_length;
-	iov[1].iov_len = kIndex_length_size;
-	size_t read_length;
-	if ((read_length = readv(index_.fd, iov, 2)) != kPtr_size + kIndex_length_size) {
-		/*
-		 * SEEK_CURoffset==0ʱܻEOF
-		 */
-		if (!read_length && !offset)
-			return 0;
-		printf("_db_read_idx: readv error of index record\n");
-		return 0;
-	}
-	//ֹ
+	memcpy(asciiptr, record, kPtr_size);
+	memcpy(ptr_length, record + kPtr_size, kIndex_length_size);
+	//终止符
 	asciiptr[kPtr_size] = 0;
 	ptr_length[kIndex_length_size] = 0;
-	next_offset_ = atol(asciiptr); //¼һread_idxһڵ
+	next_offset_ = atol(asciiptr); //记录最后一次read_idx的下一个节点
 	index_.length = atoi(ptr_length);
-	//ж
+	//长度条件判定
 	if ((index_.length < kIndex_min || index_.length > kIndex_max)) {
 		printf("_db_read_idx: index length =%d, index length not in range\n", index_.length);
 		return 0;
 	}
-	//ȡindex¼
-	if (read(index_.fd, index_.buffer, index_.length) != index_.length) {
+	if (read_length < kIndex_prefix_size + index_.length) {
 		printf("_db_read_idx: read error of index record\n");
 		return 0;
 	}
-	//Լ
-	if (index_.buffer[index_.length - 1] != kNew_line) {
-		printf("_db_read_idx: missing newline\n");
+	//ptr不在校验和里，至少要指向文件头之后
+	if (next_offset_ && next_offset_ < kIndex_header_size) {
+		printf("_db_read_idx: invalid next ptr %lld at %lld\n", (long long)next_offset_, (long long)offset);
 		return 0;
 	}
-	index_.buffer[index_.length - 1] = 0;  //з滻Ϊnull
-	char *ptr1, *ptr2;
-	ptr2 = index_.buffer + index_.length - 2;
-	while (ptr2 >= index_.buffer && kSeparate != *ptr2)
-		ptr2--;
-	if (ptr2 < index_.buffer){
-		printf("_db_read_idx: missing second separator\n");
+	memcpy(index_.buffer, record + kIndex_prefix_size, index_.length);
+	//校验和不包括ptr，ptr会被单独改写
+	index_crc_.assign(record + kPtr_size + kIndex_length_size, kCrc_size);
+	if ((VERIFY_ALWAYS == verify_ || (cache_ && offset)) && !_db_check_idx())
 		return 0;
-	}
-	*ptr2++ = 0;    //滻ָΪnull
-	ptr1 = ptr2 - 2;
-	while (ptr1 >= index_.buffer && kSeparate != *ptr1)
-		ptr1--;
-	if (ptr1 < index_.buffer){
-		printf("_db_read_idx: missing first separator\n");
+	if (!_db_parse_idx())
 		return 0;
+	index_error_ = false;
+	if (cache_ && offset) {
+		stats_.cache_misses++;
+		cache_->cache_put_node(offset, index_.buffer, index_.length, next_offset_);
+	}
+	return next_offset_;
+}
+
+/*
+ * 校验最后一次读出的index记录
+ * VERIFY_ALWAYS时读的时候已经校验过了，抽样时只有找到的那条记录才在这里校验，其余的记录交给db_verify
+ * 不需要校验或者校验通过返回true
+ */
+bool DB::_db_verify_idx() {
+	if (index_crc_.empty() || !_db_should_verify())
+		return true;
+	return _db_check_idx();
+}
+
+/*
+ * 无条件校验最后一次读出的index记录，校验过后清空index_crc_
+ * 校验通过返回true
+ */
+bool DB::_db_check_idx() {
+	if (!check_crc(index_crc_.data(), index_.buffer, index_.length)) {
+		printf("_db_read_idx: checksum mismatch of index record at %lld\n", (long long)index_.offset);
+		stats_.checksum_errors++;
+		return false;
 	}
-	*ptr1++ = 0;
+	index_crc_.clear();
+	return true;
+}
+
+/*
+ * 解析index_.buffer里的index记录，结果存到key_length_和data_里
+ * 成功返回true，失败返回false
+ */
+bool DB::_db_parse_idx() {
 	/*
-	 * ָֿݷֱkeydataƫdataĳ
-	 *dataƫͳȶdata_
+	 * 三个字段都在固定的位置，依次是data的偏移量，data的容量，key
+	 * key的长度由index记录的长度算出，不需要扫描分隔符
+	 * 这里把data的偏移量和容量读到data_里，data的实际长度存在data记录里
 	 */
-	if ((data_.offset = atol(ptr1)) < 0) {
+	char data_offset[kPtr_size + 1], data_capacity[kData_length_size + 1];
+	memcpy(data_offset, index_.buffer, kPtr_size);
+	data_offset[kPtr_size] = 0;
+	memcpy(data_capacity, index_.buffer + kPtr_size, kData_length_size);
+	data_capacity[kData_length_size] = 0;
+	key_length_ = index_.length - kIndex_key_offset;
+	if ((data_.offset = atol(data_offset)) < 0) {
 		printf("_db_read_idx: starting offset < 0\n");
-		return 0;
+		return false;
 	}
-	if ((data_.length = atol(ptr2)) <= 0) {
-		printf("_db_read_idx: invalid length\n");
-		return 0;
+	data_.capacity = atol(data_capacity);
+	if (data_.capacity < kData_header_size + kData_min || data_.capacity > kSlot_max) {
+		printf("_db_read_idx: invalid capacity\n");
+		return false;
 	}
-	return next_offset_;
+	return true;
 }
 
 /*
- * datadata_.bufferﲢ
- * ʧܷ""ַ
+ * 将data读到data_.buffer里，解码后返回value
+ * 一次读出整个data记录，前kData_length_size个字节是实际长度，接着是校验和
+ * 失败返回""字符串
  */
-char *DB::_db_read_data() {
-	if (-1 == lseek(data_.fd, data_.offset, SEEK_SET)) {
-		printf("_db_read_dat: lseek error\n");
+string DB::_db_read_data() {
+	if (_db_pread(data_.fd, data_.buffer, data_.capacity, data_.offset) != data_.capacity) {
+		printf("_db_read_dat: read error\n");
 		return "";
 	}
-	if (read(data_.fd, data_.buffer, data_.length) != data_.length) {
-		printf("_db_read_dat: read error\n");
+	char data_length[kData_length_size + 1];
+	memcpy(data_length, data_.buffer, kData_length_size);
+	data_length[kData_length_size] = 0;
+	data_.length = atoi(data_length);
+	if (data_.length < kData_min || kData_header_size + data_.length > data_.capacity) {
+		printf("_db_read_dat: invalid length\n");
 		return "";
 	}
-	if (data_.buffer[data_.length - 1] != kNew_line) {
-		//Լ
-		printf("_db_read_dat: missing newline\n");
+	if (_db_should_verify() && !check_crc(data_.buffer + kData_length_size, data_.buffer + kData_header_size, data_.length)) {
+		printf("_db_read_dat: checksum mismatch of data record at %lld\n", (long long)data_.offset);
+		stats_.checksum_errors++;
 		return "";
 	}
-	data_.buffer[data_.length - 1] = 0; //null滻з
-	return data_.buffer;
+	string value;
+	//头部后面的第一个字节是标志，再后面是value
+	if (!_db_decode_data(data_.buffer + kData_header_size, data_.length, value))
+		return "";
+	return value;
 }
 
 bool DB::db_delete(const string &key) {
 	off_t start_offset = _db_hash(key) * kPtr_size + kHash_offset;
-	//ΪҪɾԼӸдֻͬһֽ
-	RecordReadwLock writew_lock(index_.fd, start_offset, SEEK_SET, 1);
-	if (_db_find(key, start_offset)) 
-		//key
-		return _db_do_delete();
+	if (readonly_) {
+		printf("db_delete: db is readonly\n");
+		return false;
+	}
+	//因为要删除所以加个写锁，同样只锁第一个字节
+	RecordWritewLock writew_lock(index_.fd, start_offset, SEEK_SET, 1);
+	if (writew_lock.locked() && _db_find(key, start_offset))
+		//存在这个key
+		return _db_do_delete() && _db_log_change(kChange_delete, key, "");
 	return false;
 }
 
 /*
- * ɾ
- * ɹtrueʧܷfalse
+ * 真正的删除操作
+ * 成功返回true，失败返回false
  */
 bool DB::_db_do_delete() {
-	//databuffer
-	memset(data_.buffer, kSpace, data_.length);
-	data_.buffer[data_.length - 1] = 0;
-	//indexbuffer
-	char *ptr = index_.buffer;
-	while (*ptr)
-		*ptr++ = kSpace;
-	//ס
+	//锁住空闲链表
 	RecordWritewLock writew_lock(index_.fd, kFree_offset, SEEK_SET, 1);
-	//յdatabufferд
-	if (!_db_write_data(data_.buffer, data_.offset, SEEK_SET)) {
+	if (!writew_lock.locked())
+		return false;
+	//将空的data记录写入，占满整个容量
+	if (!_db_write_data(string(data_.capacity - kData_header_size, kSpace), data_.offset, SEEK_SET)) {
 		printf("_db_do_delete: db_write_data error\n");
 		return false;
 	}
-	off_t save_ptr = next_offset_;     //һԭڵһڵƫΪĵû޸ֵ
+	off_t save_ptr = next_offset_;     //保存一下原本节点的下一个节点的偏移量，因为下面的调用会修改这个值
 	/*
-	 * ýڵŵ
-	 * Ϊýڵptrָĵһڵ
-	 * ٽͷptrΪýڵƫ
+	 * 将该节点放到空闲链表里
+	 * 具体操作为将该节点的ptr部分指向空闲链表的第一个节点
+	 * 再将空闲链表头的ptr设置为该节点的偏移量
 	 */
 	off_t free_ptr = _db_read_ptr(kFree_offset);
-	if (!_db_write_idx(index_.buffer, index_.offset, SEEK_SET, free_ptr)) {
+	//key用等长的空格覆盖，data的偏移量和容量保留下来以便复用
+	if (!_db_write_idx(string(key_length_, kSpace), index_.offset, SEEK_SET, free_ptr)) {
 		printf("_db_do_delete: db write idx error\n");
 		return false;
 	}
@@ -354,8 +1076,8 @@ bool DB::_db_do_delete() {
 		return false;
 	}
 	/*
-	 * ԭýڵhashеǰһڵptrָԭýڵĺһڵ
-	 * Ҳǰhashɾ
+	 * 把原来该节点在hash链中的前一个节点的ptr指向原来该节点的后一个节点
+	 * 也就是把他从hash链中删除
 	 */
 	if (!_db_write_ptr(pre_offset_, save_ptr)) {
 		printf("_db_do_delete: db write ptr error\n");
@@ -365,49 +1087,84 @@ bool DB::_db_do_delete() {
 }
 
 /*
- * дһdata¼ƫΪoffsetwhence
- * ɹtrueʧܷfalse
- * ˰汾汾
+ * 写入一个data记录，偏移量为offset，操作起点whence
+ * data是已经编码好的记录，参考_db_encode_data
+ * 成功返回true，失败返回false
+ * 此版本是无锁版本
  */
-bool DB::_db_write_data(const char* data, off_t offset, int whence) {
-	if (-1 == (data_.offset = lseek(data_.fd, offset, whence))) {
-		printf("_db_write_data: lseek error\n");
+bool DB::_db_write_data(const string &data, off_t offset, int whence) {
+	static const char padding[kSlot_max] = {0};
+	/*
+	 * data记录的结构是长度+校验和+data，后面留有空闲空间
+	 * 追加时按长度分配容量并且把空闲空间也写出去，原地写时只写头部和data
+	 */
+	char prefix[kData_header_size + 1];
+	struct iovec iov[3];
+	data_.length = data.length();
+	int slot_length = kData_header_size + data_.length;
+	if (SEEK_END == whence)
+		data_.capacity = _db_data_capacity(slot_length);
+	else if (slot_length > data_.capacity) {
+		printf("_db_write_data: data is larger than capacity\n");
 		return false;
 	}
-	struct iovec iov[2];
-	char newline = kNew_line;
-	//dataд.datļÿdata¼ûз
-	data_.length = strlen(data) + 1;
-	iov[0].iov_base = (char *)data;
-	iov[0].iov_len = data_.length - 1;
-	iov[1].iov_base = &newline;
-	iov[1].iov_len = 1;
-	if (writev(data_.fd, iov, 2) != data_.length) {
-		printf("_db_write_data: writev error of data record\n");
+	sprintf(prefix, "%*d", kData_length_size, data_.length);
+	format_crc(prefix + kData_length_size, data.data(), data_.length);
+	iov[0].iov_base = prefix;
+	iov[0].iov_len = kData_header_size;
+	iov[1].iov_base = (char *)data.data();
+	iov[1].iov_len = data_.length;
+	iov[2].iov_base = (char *)padding;
+	iov[2].iov_len = SEEK_END == whence ? data_.capacity - slot_length : 0;
+	ssize_t write_length = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+	//追加时偏移量相对于文件末尾，调用者已经锁住了整个data文件
+	if (SEEK_END == whence) {
+		off_t size = _db_file_size(data_.fd);
+		if (-1 == size) {
+			printf("_db_write_data: file size error\n");
+			return false;
+		}
+		offset += size;
+	}
+	data_.offset = offset;
+	if (_db_pwritev(data_.fd, iov, 3, offset) != write_length) {
+		printf("_db_write_data: pwritev error of data record\n");
 		return false;
 	}
 	return true;
 }
 
 /*
- * ķļ
- * иҪĸ
+ * 计算长度为length的data记录应该分配的容量
+ * 容量从kSlot_min开始每次增长1.25倍，长度稍微变化的replace大多可以原地完成
+ * 同一个长度总是得到同一个容量，空闲节点可以按容量复用
+ */
+int DB::_db_data_capacity(int length) {
+	int capacity = kSlot_min;
+	while (capacity < length)
+		capacity += (capacity + 3) / 4;
+	return capacity < kSlot_max ? capacity : kSlot_max;
+}
+
+/*
+ * 上面的方法的加锁版
+ * 自行根据情况需要调用哪个函数
  */
-bool DB::_db_lock_and_write_data(const char* data, off_t offset, int whence) {
-	//סdataļ
+bool DB::_db_lock_and_write_data(const string &data, off_t offset, int whence) {
+	//锁住整个data文件
 	RecordWritewLock writew_lock(data_.fd, 0, SEEK_SET, 0);
-	return _db_write_data(data, offset, whence);
+	return writew_lock.locked() && _db_write_data(data, offset, whence);
 }
 
 /*
- * offsetλдһindex¼
- * keyǴkeyֵoffsetΪдλõƫwhence㣬next_offsetΪýڵһƫ
- * ɹtrueʧܷfalse
- * ˰汾Ϊ汾
+ * 在offset这个位置写一个index记录
+ * key是存的key值，offset为写入的位置的偏移量，whence起点，next_offset为该节点的下一个偏移量
+ * 成功返回true，失败返回false
+ * 此版本为无锁版本
  */
-bool DB::_db_write_idx(const char* key, off_t offset, int whence, off_t next_offset) {
+bool DB::_db_write_idx(const string &key, off_t offset, int whence, off_t next_offset) {
 	struct iovec iov[2];
-	char prefix[kPtr_size + kIndex_length_size + 1];
+	char prefix[kIndex_prefix_size + 1];
 	if (!_db_pre_write_idx(key, next_offset, iov, prefix)) {
 		printf("_db_writeidx: pre write idx error\n");
 		return false;
@@ -420,18 +1177,18 @@ bool DB::_db_write_idx(const char* key, off_t offset, int whence, off_t next_off
 }
 
 /*
- * _db_write_idxļ
+ * _db_write_idx的加锁版
  */
-bool DB::_db_lock_and_write_idx(const char* key, off_t offset, int whence, off_t next_offset) {
+bool DB::_db_lock_and_write_idx(const string &key, off_t offset, int whence, off_t next_offset) {
 	struct iovec iov[2];
-	char prefix[kPtr_size + kIndex_length_size + 1];
+	char prefix[kIndex_prefix_size + 1];
 	if (!_db_pre_write_idx(key, next_offset, iov, prefix)) {
 		printf("_db_writeidx: pre write idx error\n");
 		return false;
 	}
-	//ֻסݣסĳhash֮ǰм
-	RecordWritewLock writew_lock(index_.fd, ((kHash_table_size + 1) * kPtr_size) + 1, SEEK_SET, 0);
-	if (!_db_do_write_idx(offset, whence, iov)) {
+	//只锁住后面的内容，如需锁住某条hash链请在之前自行加锁
+	RecordWritewLock writew_lock(index_.fd, kIndex_header_size, SEEK_SET, 0);
+	if (!writew_lock.locked() || !_db_do_write_idx(offset, whence, iov)) {
 		printf("_db_writeidx: do write idx error\n");
 		return false;
 	}
@@ -439,53 +1196,72 @@ bool DB::_db_lock_and_write_idx(const char* key, off_t offset, int whence, off_t
 }
 
 /*
- * дindex¼֮ǰԤ
- * ҪжԼiovecṹдindex¼
- * οdb_write_idxڽ
- * ɹtrueʧܷfalseiovɢдĽṹ
+ * 真正写index记录之前的预处理
+ * 主要是做合理性判定以及返回iovec结构用于写index记录
+ * 参数参考db_write_idx，最后两个参数是用于结果返回
+ * 成功返回true，失败返回false，iov存散列写的结构
  */
-bool DB::_db_pre_write_idx(const char* key, off_t next_offset, struct iovec *iov, char *prefix) {
-	next_offset_ = next_offset;     //¼һһwrite_idx¼һڵ
+bool DB::_db_pre_write_idx(const string &key, off_t next_offset, struct iovec *iov, char *prefix) {
+	next_offset_ = next_offset;     //记录一下最后一次write_idx记录的下一个节点
 	if (next_offset < 0 || next_offset > kPtr_max) {
 		printf("_db_writeidx: invalid next_offset: %d", next_offset);
 		return false;
 	}
-	//ṹkey:dataƫ:dataĳ \nÿ¼ķָ
-	sprintf(index_.buffer, "%s%c%lld%c%d\n", key, kSeparate, (long long)data_.offset, kSeparate, data_.length);
-	index_.length = strlen(index_.buffer);
-	if (index_.length < kIndex_min || index_.length > kIndex_max) {
+	if ((index_.length = _db_format_idx(index_.buffer, key, data_.offset, data_.capacity)) < 0) {
 		printf("_db_writeidx: invalid length\n");
 		return false;
 	}
-	//index¼ǰ׺ṹnext_offset+index_length
+	//index记录的前缀，结构是next_offset+index_length+校验和
 	sprintf(prefix, "%*lld%*d", kPtr_size, (long long)next_offset, kIndex_length_size, index_.length);
+	format_crc(prefix + kPtr_size + kIndex_length_size, index_.buffer, index_.length);
 	iov[0].iov_base = prefix;
-	iov[0].iov_len = kPtr_size + kIndex_length_size;
+	iov[0].iov_len = kIndex_prefix_size;
 	iov[1].iov_base = index_.buffer;
 	iov[1].iov_len = index_.length;
 	return true;
 }
 
 /*
- * дindexļĺοdb_write_idx_db_pre_write_idx
- * ɹtrueʧܷfalse
+ * 把index记录的内容写到buffer里，buffer至少要有kIndex_max的大小
+ * 结构是data的偏移量+data的容量+key，前两个字段是定长的，key的长度由记录长度得出
+ * 返回记录的长度，长度不合法返回-1
+ */
+int DB::_db_format_idx(char *buffer, const string &key, off_t data_offset, int data_capacity) {
+	int length = kIndex_key_offset + key.length();
+	if (length < kIndex_min || length > kIndex_max)
+		return -1;
+	sprintf(buffer, "%*lld%*d", kPtr_size, (long long)data_offset, kData_length_size, data_capacity);
+	memcpy(buffer + kIndex_key_offset, key.data(), key.length());
+	return length;
+}
+
+/*
+ * 真正写入index文件的函数，参数参考db_write_idx和_db_pre_write_idx
+ * 成功返回true，失败返回false
  */
 bool DB::_db_do_write_idx(off_t offset, int whence, struct iovec *iov) {
-	//¼һµǰindex¼ƫ
-	if (-1 == (index_.offset = lseek(index_.fd, offset, whence))) {
-		printf("_db_writeidx: lseek error\n");
-		return false;
+	//记录一下当前index记录的偏移量
+	if (SEEK_END == whence) {
+		off_t size = _db_file_size(index_.fd);
+		if (-1 == size) {
+			printf("_db_writeidx: file size error\n");
+			return false;
+		}
+		offset += size;
 	}
-	if (writev(index_.fd, iov, 2) != kPtr_size + kIndex_length_size + index_.length) {
+	index_.offset = offset;
+	if (_db_pwritev(index_.fd, iov, 2, offset) != kIndex_prefix_size + index_.length) {
 		printf("_db_writeidx: writev error of index record\n");
 		return false;
 	}
+	if (cache_)
+		cache_->cache_invalidate_node(index_.offset);
 	return true;
 }
 
 /*
- * ڵǰλдptr
- * ɹtrueʧܷfalse
+ * 在当前位置写入ptr
+ * 成功返回true，失败返回false
  */
 bool DB::_db_write_ptr(off_t offset, off_t ptr) {
 	char asciiptr[kPtr_size + 1];
@@ -494,41 +1270,153 @@ bool DB::_db_write_ptr(off_t offset, off_t ptr) {
 		return false;
 	}
 	sprintf(asciiptr, "%*lld", kPtr_size, (long long)ptr);
-
-	if (-1 == lseek(index_.fd, offset, SEEK_SET)) {
-		printf("_db_write_ptr: lseek error to ptr field\n");
-		return false;
-	}
-	if (write(index_.fd, asciiptr, kPtr_size) != kPtr_size) {
+	if (_db_pwrite(index_.fd, asciiptr, kPtr_size, offset) != kPtr_size) {
 		printf("_db_write_ptr: write error of ptr field\n");
 		return false;
 	}
+	/*
+	 * 写的是hash链的头指针就更新缓存
+	 * 写的是某个节点的ptr就作废这个节点，空闲链表头和字典长度不缓存
+	 */
+	if (cache_ && offset >= kHash_offset && offset < kDict_offset)
+		cache_->cache_set_bucket((offset - kHash_offset) / kPtr_size, ptr);
+	else if (cache_ && offset >= kIndex_header_size)
+		cache_->cache_invalidate_node(offset);
 	return true;
 }
 
 int DB::db_store(const string &key, const string &data, int flag) {
-	//־Ϸ
+	return DB::db_try_store(key, data, flag, -1);
+}
+
+/*
+ * 只有hash链的锁是限时的，空闲链表和追加数据的锁持有时间很短，仍然阻塞等待
+ */
+int DB::db_try_store(const string &key, const string &data, int flag, long long timeout) {
+	if (readonly_) {
+		printf("db_store: db is readonly\n");
+		return -1;
+	}
+	//检查标志合法性
 	if (flag <= STORE_MIN_FLAG || flag >= STORE_MAX_FLAG) {
 		printf("_db_store: flag is invalid\n");
 		return -1;
 	}
-	//ݳ
-	int data_length = data.length() + 1;    //ǵз
+	//检查数据长度
+	int data_length = data.length() + 1;    //记得留个标志字节
 	if (data_length < kData_min || data_length > kData_max) {
 		printf("db_store: invalid data length\n");
 		return -1;
 	}
-	//ȶkeyhashϸд
+	//先对这个key的hash链上个写锁
 	off_t start_offset = _db_hash(key) * kPtr_size + kHash_offset;
-	RecordWritewLock writew_lock(index_.fd, start_offset, SEEK_SET, 1);
+	//按需压缩，后面的函数拿到的都是编码后的data记录
+	string record;
+	if (!_db_encode_data(data, record))
+		return -1;
+	RecordTimedWriteLock write_lock(index_.fd, start_offset, SEEK_SET, 1, timeout);
+	if (!write_lock.locked()) {
+		if (write_lock.busy())
+			return kDB_busy;
+		printf("db_try_store: lock error\n");
+		return -1;
+	}
 	bool can_find = _db_find(key, start_offset);
-	//ͬflagòͬĺ
-	return store_function_map[flag](key, data, can_find, start_offset);
+	if (!can_find && index_error_)
+		return -1;
+	//不同的flag调用不同的函数
+	int result = store_function_map[flag](key, record, can_find, start_offset);
+	if (!result)
+		_db_count_data(data, record, stats_);
+	if (!result && !_db_log_change(kChange_store, key, data))
+		return -1;
+	return result;
 }
 
 /*
- * insertֻdb_store˸Ƿڸkeyı(can_find)
- * ֵdb_storeһ
+ * _db_find之后data_里就是这条记录的位置和容量，读出value后直接交给_db_store_replace
+ * 新value放得下时原地写，放不下时和db_store一样先删除再插入
+ */
+int DB::db_update(const string &key, const std::function<bool(bool, string&)> &modify) {
+	if (readonly_) {
+		printf("db_update: db is readonly\n");
+		return -1;
+	}
+	off_t start_offset = _db_hash(key) * kPtr_size + kHash_offset;
+	RecordWritewLock writew_lock(index_.fd, start_offset, SEEK_SET, 1);
+	if (!writew_lock.locked())
+		return -1;
+	bool can_find = _db_find(key, start_offset);
+	if (!can_find && index_error_)
+		return -1;
+	string value;
+	if (can_find && (value = _db_read_data()).empty()) {
+		printf("db_update: read data error\n");
+		return -1;
+	}
+	if (!modify(can_find, value))
+		return 1;
+	int data_length = value.length() + 1;
+	if (data_length < kData_min || data_length > kData_max) {
+		printf("db_update: invalid data length\n");
+		return -1;
+	}
+	string record;
+	if (!_db_encode_data(value, record))
+		return -1;
+	int result = can_find ? _db_store_replace(key, record, true, start_offset) : _db_store_insert(key, record, false, start_offset);
+	if (!result)
+		_db_count_data(value, record, stats_);
+	if (!result && !_db_log_change(kChange_store, key, value))
+		return -1;
+	return result;
+}
+
+/*
+ * 下面三个操作都是用db_update实现的，其他存储引擎只要实现db_update就可以用
+ */
+bool DB::db_increment(const string &key, long long delta, long long &result) {
+	int ret = db_update(key, [delta, &result](bool exist, string &value) {
+		long long number = 0;
+		if (exist) {
+			char *end;
+			errno = 0;
+			number = strtoll(value.c_str(), &end, 10);
+			if (end == value.c_str() || *end || errno) {
+				printf("db_increment: value is not a number\n");
+				return false;
+			}
+		}
+		if (__builtin_add_overflow(number, delta, &result)) {
+			printf("db_increment: result overflow\n");
+			return false;
+		}
+		value = std::to_string(result);
+		return true;
+	});
+	return !ret;
+}
+
+bool DB::db_append(const string &key, const string &suffix) {
+	return !db_update(key, [&suffix](bool, string &value) {
+		value.append(suffix);
+		return true;
+	});
+}
+
+int DB::db_compare_and_swap(const string &key, const string &expected, const string &desired) {
+	return db_update(key, [&expected, &desired](bool, string &value) {
+		if (value != expected)
+			return false;
+		value = desired;
+		return true;
+	});
+}
+
+/*
+ * insert操作，参数只比db_store多了个是否存在该key的标记(can_find)
+ * 注意这里的data是编码后的data记录
+ * 返回值与db_store一致
  */
 int DB::_db_store_insert(const string &key, const string &data, bool can_find, off_t start_offset) {
 	if (can_find) {
@@ -536,34 +1424,38 @@ int DB::_db_store_insert(const string &key, const string &data, bool can_find, o
 		return 1;
 	}
 	int key_length = key.length();
-	int data_length = data.length() + 1;    //ǵз
-	off_t ptr = _db_read_ptr(start_offset);    //¼ǰhashĵһڵƫ
-	//ǷкʵĿнڵ
-	if (!_db_find_and_delete_free(key_length, data_length)) {
+	int data_capacity = _db_data_capacity(kData_header_size + data.length());
+	off_t ptr = _db_read_ptr(start_offset);    //记录当前hash链的第一个节点的偏移量
+	//先找是否有合适的空闲节点
+	if (!_db_find_and_delete_free(key_length, data_capacity)) {
+		if (index_error_) {
+			printf("_db_store_insert: find free node error\n");
+			return -1;
+		}
 		/*
-		 * ûҵѼ¼׷ӵ.idxļ.datļβ
-		 * ¼ŵhashͷ
-		 * ע⣬Ҫ
+		 * 没有找到则把记录追加到.idx文件和.dat文件结尾
+		 * 而且这个记录必须放到这个hash链的头
+		 * 注意，这里必须要用上锁版
 		 */
-		if (!_db_lock_and_write_data(data.c_str(), 0, SEEK_END)) {
+		if (!_db_lock_and_write_data(data, 0, SEEK_END)) {
 			printf("_db_store_insert: db lock and write data error\n");
 			return -1;
 		}
-		if (!_db_lock_and_write_idx(key.c_str(), 0, SEEK_END, ptr)) {
+		if (!_db_lock_and_write_idx(key, 0, SEEK_END, ptr)) {
 			printf("_db_store_insert: db lock and write idx error\n");
 			return -1;
 		}
 	}
 	else {
 		/*
-		 * ҵѸü¼дڵλ
-		 * ڵѾڿhashҲסˣֻҪò
+		 * 找到则把该记录写到这个节点的位置
+		 * 这个节点已经不存在空闲链表，而且hash链也锁住了，所以只需要调用不上锁版
 		 */
-		if (!_db_write_data(data.c_str(), data_.offset, SEEK_SET)) {
+		if (!_db_write_data(data, data_.offset, SEEK_SET)) {
 			printf("_db_store_insert: db write data error\n");
 			return -1;
 		}
-		if (!_db_write_idx(key.c_str(), index_.offset, SEEK_SET, ptr)) {
+		if (!_db_write_idx(key, index_.offset, SEEK_SET, ptr)) {
 			printf("_db_store_insert: db write idx error\n");
 			return -1;
 		}
@@ -576,20 +1468,19 @@ int DB::_db_store_insert(const string &key, const string &data, bool can_find, o
 }
 
 /*
- * ͷֵο_db_store_insert
- * replace
+ * 参数和返回值参考_db_store_insert
+ * replace操作
  */
 int DB::_db_store_replace(const string &key, const string &data, bool can_find, off_t start_offset) {
 	if (!can_find) {
 		printf("_db_store_replace: db can not find key\n");
 		return -1;
 	}
-	//dataĳǷ
-	int data_length = data.length() + 1;      //ǵз
-	if (data_length != data_.length) {
+	//检查原来的容量是否放得下
+	if (kData_header_size + (int)data.length() > data_.capacity) {
 		/*
-		 * Ȳһ
-		 * ɾݣȻٵinsert
+		 * 放不下
+		 * 先删除这个数据，然后再调用insert插入
 		 */
 		if (!_db_do_delete()) {
 			printf("_db_store_replace: db do delete error\n");
@@ -599,10 +1490,10 @@ int DB::_db_store_replace(const string &key, const string &data, bool can_find,
 	}
 	else {
 		/*
-		 * һ
-		 * ֱڵд
+		 * 放得下
+		 * 直接利用这个节点重写数据，index记录不需要修改
 		 */
-		if (!_db_write_data(data.c_str(), data_.offset, SEEK_SET)) {
+		if (!_db_write_data(data, data_.offset, SEEK_SET)) {
 			printf("_db_store_replace: db write data error\n");
 			return -1;
 		}
@@ -611,11 +1502,11 @@ int DB::_db_store_replace(const string &key, const string &data, bool can_find,
 }
 
 /*
- * οdb_store_insert
- * insertreplace
+ * 参数参考db_store_insert
+ * insert或者replace操作
  */
 int DB::_db_store_ins_or_rep(const string &key, const string &data, bool can_find, off_t start_offset) {
-	//ûʲô˵ģkey͵replaceڵinsert
+	//没什么好说的，存在key就调用replace，不存在调用insert
 	if (can_find)
 		return _db_store_replace(key, data, can_find, start_offset);
 	else
@@ -623,29 +1514,797 @@ int DB::_db_store_ins_or_rep(const string &key, const string &data, bool can_fin
 }
 
 /*
- * ǷкʵĿнڵ
- * ӿɾ
- * ҽӦϢдindex_data_
- * ɹtrueʧܷfalse
+ * 查找是否有合适的空闲节点
+ * 如果有则把他从空闲链表中删除
+ * 且将相应的信息写到index_和data_
+ * 成功返回true，失败返回false
  */
-bool DB::_db_find_and_delete_free(int key_length, int data_length) {
+bool DB::_db_find_and_delete_free(int key_length, int data_capacity) {
 	off_t offset, next_offset;
-	//ϸд
+	//先上个写锁，拿不到锁和读出错一样把index_error_设为true，调用者不能当成没有空闲节点
 	RecordWritewLock writew_lock(index_.fd, kFree_offset, SEEK_SET, 1);
+	index_error_ = !writew_lock.locked();
+	if (index_error_)
+		return false;
 	pre_offset_ = kFree_offset;
 	offset = _db_read_ptr(kFree_offset);
 	while (offset) {
 		next_offset = _db_read_idx(offset);
-		if (strlen(index_.buffer) == key_length && data_.length == data_length)
-			//ҵ˺ʵĿнڵ
+		if (index_error_)
+			return false;
+		if (key_length_ == key_length && data_.capacity == data_capacity)
+			//找到了合适的空闲节点
 			break;
-		pre_offset_ = offset;    //¼ǰһڵ
+		pre_offset_ = offset;    //记录前一个节点
 		offset = next_offset;
 	}
 	if (!offset)
 		return false;
-	//ҵ˾Ͱڵӿȥ
+	//找到了就把这个节点从空闲链表里去掉
 	return _db_write_ptr(pre_offset_, next_offset_);
 }
 
+/*
+ * 批量导入，参数参考db_bulk_load
+ * .dat按输入顺序一次顺序写完，index记录先按hash链分组缓存在内存里
+ * 最后每条hash链在.idx里连续写出，hash表只写一次
+ * 失败时把两个文件截断回空库的状态
+ */
+bool DB::db_bulk_load(const std::function<bool(string&, string&)> &next) {
+	return _db_bulk_load(next, nullptr);
+}
+
+/*
+ * failed为空时要求key严格递增
+ * db_restore的key本来就不会重复，不需要检查，生成器结束后*failed为true表示输入出错，这时导入失败
+ */
+bool DB::_db_bulk_load(const std::function<bool(string&, string&)> &next, const bool *failed) {
+	if (readonly_) {
+		printf("db_bulk_load: db is readonly\n");
+		return false;
+	}
+	//整个导入过程中锁住两个文件
+	RecordWritewLock index_lock(index_.fd, 0, SEEK_SET, 0);
+	RecordWritewLock data_lock(data_.fd, 0, SEEK_SET, 0);
+	if (!index_lock.locked() || !data_lock.locked())
+		return false;
+	off_t index_size = _db_file_size(index_.fd), data_size = _db_file_size(data_.fd);
+	if (-1 == index_size || -1 == data_size) {
+		printf("db_bulk_load: file size error\n");
+		return false;
+	}
+	if (index_size != kIndex_header_size + (off_t)dict_.length() || data_size) {
+		printf("db_bulk_load: db is not empty\n");
+		return false;
+	}
+	bool result = _db_bulk_write(next, failed);
+	if (!result && (!_db_truncate(index_.fd, kIndex_header_size + dict_.length()) || !_db_truncate(data_.fd, 0)))
+		printf("db_bulk_load: ftruncate error\n");
+	//hash表是直接写的，缓存里的内容全部作废
+	if (cache_)
+		cache_->cache_reset();
+	return result;
+}
+
+/*
+ * db_bulk_load的实际写入部分，调用前需要锁住两个文件
+ * 成功返回true，失败返回false
+ */
+bool DB::_db_bulk_write(const std::function<bool(string&, string&)> &next, const bool *failed) {
+	std::vector<std::vector<string> > chains(kHash_table_size);   //每条hash链的index记录，不含前缀
+	string key, data, last_key, buffer, encoded;
+	DBStats counted;     //导入成功后才算进统计
+	memset(&counted, 0, sizeof(counted));
+	char record[kIndex_max];
+	off_t data_offset = 0, write_offset = 0;
+	buffer.reserve(kBulk_buffer_size);
+	for (bool first = true; next(key, data); first = false) {
+		//key严格递增才能保证没有重复的key
+		if (!failed && !first && key <= last_key) {
+			printf("_db_bulk_write: keys are not strictly increasing\n");
+			return false;
+		}
+		int data_length = data.length() + 1;    //记得算上标志字节
+		if (data_length < kData_min || data_length > kData_max) {
+			printf("_db_bulk_write: invalid data length\n");
+			return false;
+		}
+		if (data_offset > kPtr_max) {
+			printf("_db_bulk_write: data offset overflow\n");
+			return false;
+		}
+		if (!_db_encode_data(data, encoded))
+			return false;
+		_db_count_data(data, encoded, counted);
+		//data记录的格式与_db_write_data追加时一致
+		int data_capacity = _db_data_capacity(kData_header_size + encoded.length());
+		int index_length = _db_format_idx(record, key, data_offset, data_capacity);
+		if (index_length < 0) {
+			printf("_db_bulk_write: invalid index length\n");
+			return false;
+		}
+		chains[_db_hash(key)].push_back(string(record, index_length));
+		sprintf(record, "%*d", kData_length_size, (int)encoded.length());
+		format_crc(record + kData_length_size, encoded.data(), encoded.length());
+		buffer.append(record, kData_header_size);
+		buffer.append(encoded);
+		buffer.append(data_capacity - kData_header_size - encoded.length(), 0);
+		data_offset += data_capacity;
+		if (buffer.length() >= kBulk_buffer_size && !_db_bulk_flush(data_.fd, buffer, write_offset))
+			return false;
+		last_key.swap(key);
+	}
+	//hash表还没写，这时失败调用者截断文件就恢复成了空库
+	if ((failed && *failed) || !_db_bulk_flush(data_.fd, buffer, write_offset))
+		return false;
+	/*
+	 * 依次写出每条hash链，同一条链上的节点是连续的
+	 * 同时记下每条链的起点，最后写hash表
+	 */
+	char hash[kHash_table_size * kPtr_size + 1];
+	char prefix[kIndex_prefix_size + 1];
+	off_t offset = kIndex_header_size + dict_.length();
+	write_offset = offset;
+	for (int i = 0; i < kHash_table_size; ++i) {
+		std::vector<string> &chain = chains[i];
+		if (offset > kPtr_max) {
+			printf("_db_bulk_write: index offset overflow\n");
+			return false;
+		}
+		sprintf(hash + i * kPtr_size, "%*lld", kPtr_size, chain.empty() ? 0LL : (long long)offset);
+		for (size_t j = 0; j < chain.size(); ++j) {
+			off_t record_length = kIndex_prefix_size + chain[j].length();
+			off_t next_offset = j + 1 < chain.size() ? offset + record_length : 0;
+			if (next_offset > kPtr_max) {
+				printf("_db_bulk_write: index offset overflow\n");
+				return false;
+			}
+			sprintf(prefix, "%*lld%*d", kPtr_size, (long long)next_offset, kIndex_length_size, (int)chain[j].length());
+			format_crc(prefix + kPtr_size + kIndex_length_size, chain[j].data(), chain[j].length());
+			buffer.append(prefix, kIndex_prefix_size);
+			buffer.append(chain[j]);
+			offset += record_length;
+			if (buffer.length() >= kBulk_buffer_size && !_db_bulk_flush(index_.fd, buffer, write_offset))
+				return false;
+		}
+		std::vector<string>().swap(chain);   //写完就释放
+	}
+	if (!_db_bulk_flush(index_.fd, buffer, write_offset))
+		return false;
+	if (_db_pwrite(index_.fd, hash, kHash_table_size * kPtr_size, kHash_offset) != kHash_table_size * kPtr_size) {
+		printf("_db_bulk_write: write error of hash table\n");
+		return false;
+	}
+	stats_.raw_bytes += counted.raw_bytes;
+	stats_.stored_bytes += counted.stored_bytes;
+	stats_.compressed_records += counted.compressed_records;
+	stats_.raw_records += counted.raw_records;
+	return true;
+}
+
+/*
+ * 把缓冲区写到fd的offset处并清空缓冲区，offset前进写入的长度
+ * 成功返回true，失败返回false
+ */
+bool DB::_db_bulk_flush(int fd, string &buffer, off_t &offset) {
+	const char *ptr = buffer.data();
+	size_t left = buffer.length();
+	while (left) {
+		ssize_t n = _db_pwrite(fd, ptr, left, offset);
+		if (n <= 0) {
+			printf("_db_bulk_flush: write error\n");
+			return false;
+		}
+		ptr += n;
+		left -= n;
+		offset += n;
+	}
+	buffer.clear();
+	return true;
+}
+
+/*
+ * 创建快照，参数参考db_snapshot
+ * 写操作都会先写锁住对应的hash链，所以读锁住整个idx文件就能挡住所有写操作
+ * 读操作不受影响，写操作只在克隆文件期间被阻塞
+ */
+bool DB::db_snapshot(const string &pathname, DB &snapshot) {
+	if (!pathname.length() || pathname == pathname_) {
+		printf("db_snapshot: invalid snapshot pathname\n");
+		return false;
+	}
+	{
+		RecordReadwLock readw_lock(index_.fd, 0, SEEK_SET, 0);
+		if (!readw_lock.locked())
+			return false;
+		//缓冲池里的脏页要先落盘，克隆的是磁盘上的文件
+		if (pool_ && !pool_->pool_flush()) {
+			printf("db_snapshot: flush buffer pool error\n");
+			return false;
+		}
+		if (!_db_clone_file(index_.fd, pathname + ".idx") || !_db_clone_file(data_.fd, pathname + ".dat")) {
+			printf("db_snapshot: clone file error\n");
+			return false;
+		}
+	}
+	return snapshot.db_open(pathname, O_RDONLY);
+}
+
+/*
+ * 把fd对应的文件完整地复制到pathname
+ * 优先使用FICLONE，只共享数据块，之后由文件系统负责写时复制
+ * 文件系统不支持时用sendfile在内核里拷贝
+ * 成功返回true，失败返回false
+ */
+bool DB::_db_clone_file(int fd, const string &pathname) {
+	struct stat statbuff;
+	if (fstat(fd, &statbuff) < 0) {
+		printf("_db_clone_file: fstat error\n");
+		return false;
+	}
+	int clone_fd = open(pathname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, statbuff.st_mode & 0777);
+	if (clone_fd < 0) {
+		printf("_db_clone_file: open %s error\n", pathname.c_str());
+		return false;
+	}
+	bool result = true;
+	//sendfile不能从O_DIRECT打开的文件读，拷贝期间先去掉这个标志
+	int flags = fcntl(fd, F_GETFL);
+	if (flags & O_DIRECT)
+		fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+#ifdef FICLONE
+	if (ioctl(clone_fd, FICLONE, fd) < 0)
+#endif
+	{
+		off_t offset = 0;
+		while (offset < statbuff.st_size) {
+			if (sendfile(clone_fd, fd, &offset, statbuff.st_size - offset) <= 0) {
+				printf("_db_clone_file: sendfile error\n");
+				result = false;
+				break;
+			}
+		}
+	}
+	if (flags & O_DIRECT)
+		fcntl(fd, F_SETFL, flags);
+	close(clone_fd);
+	return result;
+}
+
+/*
+ * 按hash链依次遍历，读锁住整个idx文件挡住所有写操作
+ */
+bool DB::db_scan(const std::function<bool(const string&, const string&)> &visit) {
+	RecordReadwLock readw_lock(index_.fd, 0, SEEK_SET, 0);
+	if (!readw_lock.locked())
+		return false;
+	//整个遍历只算缓冲池里的一次操作，扫过的页不会挤掉热页
+	if (pool_)
+		pool_->pool_tick();
+	for (int i = 0; i < kHash_table_size; ++i) {
+		off_t offset = _db_read_ptr(i * kPtr_size + kHash_offset);
+		while (offset) {
+			off_t next_offset = _db_read_idx(offset);
+			if (index_error_ || !_db_verify_idx()) {
+				printf("db_scan: read index error\n");
+				return false;
+			}
+			string key(index_.buffer + kIndex_key_offset, key_length_);
+			//value至少有一个字节，读出空的就是出错了
+			string value = _db_read_data();
+			if (value.empty()) {
+				printf("db_scan: read data error\n");
+				return false;
+			}
+			if (!visit(key, value))
+				return true;
+			offset = next_offset;
+		}
+	}
+	return true;
+}
+
+bool DB::db_share_cache(int nodes) {
+	if (nodes <= 0) {
+		printf("db_share_cache: invalid node count\n");
+		return false;
+	}
+	if (cache_)
+		return true;
+	SharedCache *cache = new SharedCache();
+	if (!cache->cache_attach(index_.fd, nodes, kHash_table_size)) {
+		printf("db_share_cache: attach cache error\n");
+		delete cache;
+		return false;
+	}
+	cache_ = cache;
+	return true;
+}
+
+bool DB::db_remove_cache() {
+	return SharedCache::cache_remove(index_.fd);
+}
+
+/*
+ * 换成O_DIRECT重新打开两个文件，再独占flock
+ * 文件系统不支持O_DIRECT时退回普通的打开方式，缓冲池照样可以用
+ */
+bool DB::db_buffer_pool(size_t bytes) {
+	if (pool_)
+		return true;
+	if (index_.fd < 0) {
+		printf("db_buffer_pool: db is not open\n");
+		return false;
+	}
+	int oflag = readonly_ ? O_RDONLY : O_RDWR;
+	int index_fd = open((pathname_ + ".idx").c_str(), oflag | O_DIRECT);
+	int data_fd = open((pathname_ + ".dat").c_str(), oflag | O_DIRECT);
+	if ((index_fd < 0 || data_fd < 0) && EINVAL == errno) {
+		if (index_fd >= 0)
+			close(index_fd);
+		if (data_fd >= 0)
+			close(data_fd);
+		index_fd = open((pathname_ + ".idx").c_str(), oflag);
+		data_fd = open((pathname_ + ".dat").c_str(), oflag);
+	}
+	if (index_fd < 0 || data_fd < 0) {
+		printf("db_buffer_pool: open error\n");
+		if (index_fd >= 0)
+			close(index_fd);
+		if (data_fd >= 0)
+			close(data_fd);
+		return false;
+	}
+	/*
+	 * 先放掉自己的共享锁才能拿到独占锁，失败时再拿回来
+	 * 放掉的这段时间里别的句柄可能拿走了独占锁，拿不回来时这个句柄已经不受保护，只能关掉
+	 */
+	auto take_back = [this]() {
+		if (flock(index_.fd, LOCK_SH | LOCK_NB) < 0) {
+			printf("db_buffer_pool: can not take back the shared lock, db is closed\n");
+			_db_free();
+		}
+	};
+	flock(index_.fd, LOCK_UN);
+	if (flock(index_fd, LOCK_EX | LOCK_NB) < 0) {
+		printf("db_buffer_pool: db is opened by other handles\n");
+		close(index_fd);
+		close(data_fd);
+		take_back();
+		return false;
+	}
+	BufferPool *pool = new BufferPool();
+	if (!pool->pool_open(bytes) || !pool->pool_add_file(index_fd, kPool_index_weight) || !pool->pool_add_file(data_fd, kPool_data_weight)) {
+		delete pool;
+		close(index_fd);
+		close(data_fd);
+		take_back();
+		return false;
+	}
+	close(index_.fd);
+	close(data_.fd);
+	index_.fd = index_fd;
+	data_.fd = data_fd;
+	pool_ = pool;
+	return true;
+}
+
+bool DB::db_flush() {
+	if (!pool_)
+		return true;
+	RecordWritewLock writew_lock(index_.fd, 0, SEEK_SET, 0);
+	return writew_lock.locked() && pool_->pool_flush();
+}
+
+bool DB::db_set_verify(int flag) {
+	if (flag < VERIFY_OFF || flag > VERIFY_ALWAYS) {
+		printf("db_set_verify: flag is invalid\n");
+		return false;
+	}
+	verify_ = flag;
+	return true;
+}
+
+/*
+ * 这一次读到的记录要不要校验
+ */
+bool DB::_db_should_verify() {
+	if (VERIFY_SAMPLED == verify_)
+		return !(++verify_count_ % kVerify_sample);
+	return VERIFY_ALWAYS == verify_;
+}
+
+/*
+ * 每个线程每次领一条链，最后一条是空闲链表
+ * 不用_db_read_idx，它会修改句柄里的状态，这里每个线程用自己的缓冲区直接读文件
+ * 一条index记录校验失败后它的ptr也不可信，这条链就不再往下走了
+ * 所有链都完整时再顺序扫一遍idx文件，找出哪条链都走不到的节点，比如插入、删除中途崩溃留下的
+ */
+bool DB::db_verify(int threads, long long &records, long long &errors) {
+	records = errors = 0;
+	if (index_.fd < 0) {
+		printf("db_verify: db is not open\n");
+		return false;
+	}
+	if (pool_) {
+		printf("db_verify: can not verify with buffer pool\n");
+		return false;
+	}
+	struct stat statbuff;
+	if (fstat(index_.fd, &statbuff) < 0) {
+		printf("db_verify: fstat error\n");
+		return false;
+	}
+	//链上的节点数不可能超过文件能放下的记录数，超过了就是链成了环
+	long long max_steps = statbuff.st_size / (kIndex_prefix_size + kIndex_min) + 1;
+	std::atomic<int> next_chain(0);
+	std::atomic<long long> checked(0), broken(0);
+	std::atomic<bool> failed(false), chain_broken(false);
+	std::mutex reached_mutex;
+	std::vector<off_t> reached;        //链上走到过的节点
+	auto worker = [&]() {
+		char record[kIndex_prefix_size + kIndex_max], slot[kSlot_max], field[kPtr_size + 1];
+		std::vector<off_t> visited;
+		std::unordered_set<string> keys;
+		for (int chain; !failed && (chain = next_chain++) <= kHash_table_size; ) {
+			off_t head = chain < kHash_table_size ? chain * kPtr_size + kHash_offset : kFree_offset;
+			keys.clear();
+			RecordReadwLock readw_lock(index_.fd, head, SEEK_SET, 1);
+			if (!readw_lock.locked() || pread(index_.fd, field, kPtr_size, head) != kPtr_size) {
+				failed = true;
+				break;
+			}
+			field[kPtr_size] = 0;
+			off_t offset = atol(field);
+			for (long long steps = 0; offset; ++steps) {
+				ssize_t n = pread(index_.fd, record, sizeof(record), offset);
+				memcpy(field, record + kPtr_size, kIndex_length_size);
+				field[kIndex_length_size] = 0;
+				int length = atoi(field);
+				if (steps > max_steps || n < kIndex_prefix_size || length < kIndex_min || length > kIndex_max || n < kIndex_prefix_size + length ||
+					!check_crc(record + kPtr_size + kIndex_length_size, record + kIndex_prefix_size, length)) {
+					printf("db_verify: index record at %lld is broken\n", (long long)offset);
+					broken++;
+					chain_broken = true;
+					break;
+				}
+				checked++;
+				visited.push_back(offset);
+				//空闲链表上的key都是空格
+				if (chain < kHash_table_size && !keys.insert(string(record + kIndex_prefix_size + kIndex_key_offset, length - kIndex_key_offset)).second) {
+					printf("db_verify: key of index record at %lld appears twice in its chain\n", (long long)offset);
+					broken++;
+				}
+				memcpy(field, record, kPtr_size);
+				field[kPtr_size] = 0;
+				off_t next_offset = atol(field);
+				//data记录的位置和容量在index记录的开头
+				memcpy(field, record + kIndex_prefix_size, kPtr_size);
+				off_t data_offset = atol(field);
+				memcpy(field, record + kIndex_prefix_size + kPtr_size, kData_length_size);
+				field[kData_length_size] = 0;
+				int capacity = atoi(field);
+				int data_length = -1;
+				if (capacity >= kData_header_size + kData_min && capacity <= kSlot_max && pread(data_.fd, slot, capacity, data_offset) == capacity) {
+					memcpy(field, slot, kData_length_size);
+					data_length = atoi(field);
+				}
+				if (data_length < kData_min || kData_header_size + data_length > capacity ||
+					!check_crc(slot + kData_length_size, slot + kData_header_size, data_length)) {
+					printf("db_verify: data record at %lld is broken\n", (long long)data_offset);
+					broken++;
+				}
+				offset = next_offset;
+			}
+		}
+		std::lock_guard<std::mutex> guard(reached_mutex);
+		reached.insert(reached.end(), visited.begin(), visited.end());
+	};
+	std::vector<std::thread> workers;
+	for (int i = 1; i < threads; ++i)
+		workers.push_back(std::thread(worker));
+	worker();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	records = checked;
+	errors = broken;
+	//链断了以后后面的节点本来就走不到，不再重复报告
+	if (!failed && !chain_broken)
+		errors += _db_verify_reached(reached, statbuff.st_size);
+	if (failed)
+		printf("db_verify: read error\n");
+	return !failed;
+}
+
+/*
+ * 顺序扫idx文件里size之前的记录，找出不在reached里的节点
+ * 校验时链是一条一条锁的，节点可能刚好在两条链之间挪动，所以找到的节点要锁住整个文件再走一遍所有链确认
+ * 返回确认走不到的节点数
+ */
+long long DB::_db_verify_reached(std::vector<off_t> &reached, off_t size) {
+	std::sort(reached.begin(), reached.end());
+	std::vector<off_t> candidates;
+	char chunk[kIndex_read_size], field[kPtr_size + 1];
+	off_t offset = kIndex_header_size + dict_.length();
+	while (offset < size) {
+		ssize_t n = pread(index_.fd, chunk, sizeof(chunk), offset);
+		if (n < kIndex_prefix_size) {
+			printf("db_verify: read error of index file\n");
+			return 1;
+		}
+		ssize_t position = 0;
+		while (position + kIndex_prefix_size <= n && offset + position < size) {
+			memcpy(field, chunk + position + kPtr_size, kIndex_length_size);
+			field[kIndex_length_size] = 0;
+			int length = atoi(field);
+			if (length < kIndex_min || length > kIndex_max) {
+				printf("db_verify: index record at %lld has invalid length\n", (long long)(offset + position));
+				return 1;
+			}
+			if (!std::binary_search(reached.begin(), reached.end(), offset + position))
+				candidates.push_back(offset + position);
+			position += kIndex_prefix_size + length;
+		}
+		offset += position;
+	}
+	if (candidates.empty())
+		return 0;
+	RecordReadwLock readw_lock(index_.fd, 0, SEEK_SET, 0);
+	if (!readw_lock.locked())
+		return 0;
+	long long max_steps = size / (kIndex_prefix_size + kIndex_min) + 1;
+	reached.clear();
+	for (int chain = 0; chain <= kHash_table_size; ++chain) {
+		off_t ptr = chain < kHash_table_size ? chain * kPtr_size + kHash_offset : kFree_offset;
+		for (long long steps = 0; steps <= max_steps && pread(index_.fd, field, kPtr_size, ptr) == kPtr_size; ++steps) {
+			field[kPtr_size] = 0;
+			if (!(ptr = atol(field)))
+				break;
+			reached.push_back(ptr);
+		}
+	}
+	std::sort(reached.begin(), reached.end());
+	long long unreached = 0;
+	for (size_t i = 0; i < candidates.size(); ++i)
+		if (!std::binary_search(reached.begin(), reached.end(), candidates[i])) {
+			printf("db_verify: index record at %lld is not reachable from any chain\n", (long long)candidates[i]);
+			++unreached;
+		}
+	return unreached;
+}
+
+/*
+ * 下面几个函数是所有文件读写的入口，开启了缓冲池就走缓冲池
+ */
+ssize_t DB::_db_pread(int fd, void *buffer, size_t length, off_t offset) {
+	return pool_ ? pool_->pool_pread(fd, buffer, length, offset) : pread(fd, buffer, length, offset);
+}
+
+ssize_t DB::_db_pwrite(int fd, const void *buffer, size_t length, off_t offset) {
+	return pool_ ? pool_->pool_pwrite(fd, buffer, length, offset) : pwrite(fd, buffer, length, offset);
+}
+
+ssize_t DB::_db_pwritev(int fd, const struct iovec *iov, int count, off_t offset) {
+	if (!pool_)
+		return pwritev(fd, iov, count, offset);
+	ssize_t total = 0;
+	for (int i = 0; i < count; ++i) {
+		if (!iov[i].iov_len)
+			continue;
+		ssize_t n = pool_->pool_pwrite(fd, iov[i].iov_base, iov[i].iov_len, offset + total);
+		if (n < 0)
+			return -1;
+		total += n;
+	}
+	return total;
+}
+
+off_t DB::_db_file_size(int fd) {
+	if (pool_)
+		return pool_->pool_size(fd);
+	struct stat statbuff;
+	return fstat(fd, &statbuff) < 0 ? -1 : statbuff.st_size;
+}
+
+bool DB::_db_truncate(int fd, off_t size) {
+	return pool_ ? pool_->pool_truncate(fd, size) : !ftruncate(fd, size);
+}
+
+DBStats DB::db_stats() {
+	DBStats stats = stats_;
+	if (pool_) {
+		stats.pool_hits = pool_->pool_hits();
+		stats.pool_misses = pool_->pool_misses();
+	}
+	if (stats.stored_bytes)
+		stats.compression_ratio = (double)stats.raw_bytes / stats.stored_bytes;
+	else
+		stats.compression_ratio = 1.0;
+	return stats;
+}
+
+/*
+ * 训练字典，参数参考db_train_dictionary
+ * 字典写在idx文件头的后面，字典长度写在hash表后面的字段里
+ */
+bool DB::db_train_dictionary(const std::vector<string> &samples) {
+	if (readonly_) {
+		printf("db_train_dictionary: db is readonly\n");
+		return false;
+	}
+	RecordWritewLock index_lock(index_.fd, 0, SEEK_SET, 0);
+	RecordWritewLock data_lock(data_.fd, 0, SEEK_SET, 0);
+	if (!index_lock.locked() || !data_lock.locked())
+		return false;
+	off_t index_size = _db_file_size(index_.fd), data_size = _db_file_size(data_.fd);
+	if (-1 == index_size || -1 == data_size) {
+		printf("db_train_dictionary: file size error\n");
+		return false;
+	}
+	if (index_size != kIndex_header_size || data_size) {
+		printf("db_train_dictionary: db is not empty or already has a dictionary\n");
+		return false;
+	}
+	string dict = _db_build_dict(samples);
+	if (dict.empty()) {
+		printf("db_train_dictionary: samples are too small\n");
+		return false;
+	}
+	if (_db_pwrite(index_.fd, dict.data(), dict.length(), kIndex_header_size) != (ssize_t)dict.length()) {
+		printf("db_train_dictionary: write error of dictionary\n");
+		return false;
+	}
+	//最后才写字典长度，中途失败的话数据库仍然是没有字典的
+	if (!_db_write_ptr(kDict_offset, dict.length()))
+		return false;
+	dict_ = dict;
+	return _db_init_stream();
+}
+
+/*
+ * 从样本中挑选出现次数最多的片段组成字典
+ * 先统计每个kDict_gram长度的子串在多少个样本里出现过
+ * 再把样本切成kDict_segment长度的片段，按片段包含的子串的出现次数打分
+ * 分数高的片段放在字典的末尾，deflate引用它们时距离更短
+ * 返回训练好的字典，样本不足时返回空字符串
+ */
+string DB::_db_build_dict(const std::vector<string> &samples) {
+	std::unordered_map<string, int> frequency;
+	for (size_t i = 0; i < samples.size(); ++i) {
+		std::unordered_map<string, bool> seen;    //每个样本里的子串只算一次
+		for (size_t j = 0; j + kDict_gram <= samples[i].length(); ++j) {
+			string gram = samples[i].substr(j, kDict_gram);
+			if (!seen[gram]) {
+				seen[gram] = true;
+				frequency[gram]++;
+			}
+		}
+	}
+	std::vector<std::pair<long long, string> > segments;
+	for (size_t i = 0; i < samples.size(); ++i) {
+		for (size_t j = 0; j + kDict_gram <= samples[i].length(); j += kDict_segment / 2) {
+			string segment = samples[i].substr(j, kDict_segment);
+			long long score = 0;
+			for (size_t k = 0; k + kDict_gram <= segment.length(); ++k) {
+				int count = frequency[segment.substr(k, kDict_gram)];
+				//只在一个样本里出现的子串对其他记录没有帮助
+				if (count > 1)
+					score += count;
+			}
+			if (score)
+				segments.push_back(std::make_pair(score, segment));
+		}
+	}
+	std::stable_sort(segments.begin(), segments.end(), [](const std::pair<long long, string> &a, const std::pair<long long, string> &b) {
+		return a.first > b.first;
+	});
+	string dict;
+	for (size_t i = 0; i < segments.size(); ++i) {
+		const string &segment = segments[i].second;
+		if (dict.length() + segment.length() > kDict_max)
+			break;
+		if (dict.find(segment) != string::npos)
+			continue;
+		//分数越高越靠后
+		dict.insert(0, segment);
+	}
+	return dict;
+}
+
+/*
+ * 读取idx文件头里的字典
+ * 成功返回true，失败返回false，没有字典也算成功
+ */
+bool DB::_db_load_dict() {
+	off_t dict_length = _db_read_ptr(kDict_offset);
+	if (dict_length <= 0)
+		return true;
+	if (dict_length > kDict_max) {
+		printf("_db_load_dict: invalid dictionary length\n");
+		return false;
+	}
+	dict_.resize(dict_length);
+	if (pread(index_.fd, &dict_[0], dict_length, kIndex_header_size) != dict_length) {
+		printf("_db_load_dict: read error of dictionary\n");
+		return false;
+	}
+	return _db_init_stream();
+}
+
+/*
+ * 初始化压缩和解压用的z_stream，整个句柄复用同一份
+ * 用的是raw deflate，不需要zlib头和校验和
+ * 成功返回true，失败返回false
+ */
+bool DB::_db_init_stream() {
+	deflate_stream_ = new z_stream();
+	if (deflateInit2(deflate_stream_, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		printf("_db_init_stream: deflateInit2 error\n");
+		delete deflate_stream_;
+		deflate_stream_ = nullptr;
+		return false;
+	}
+	inflate_stream_ = new z_stream();
+	if (inflateInit2(inflate_stream_, -MAX_WBITS) != Z_OK) {
+		printf("_db_init_stream: inflateInit2 error\n");
+		delete inflate_stream_;
+		inflate_stream_ = nullptr;
+		return false;
+	}
+	return true;
+}
+
+/*
+ * 把value编码成data记录，第一个字节是标志
+ * 有字典时尝试压缩，压缩后没有变小就原样存储
+ * 成功返回true，失败返回false
+ */
+bool DB::_db_encode_data(const string &value, string &record) {
+	if (deflate_stream_) {
+		record.resize(deflateBound(deflate_stream_, value.length()) + 1);
+		if (deflateReset(deflate_stream_) != Z_OK ||
+			deflateSetDictionary(deflate_stream_, (const Bytef *)dict_.data(), dict_.length()) != Z_OK) {
+			printf("_db_encode_data: deflate dictionary error\n");
+			return false;
+		}
+		deflate_stream_->next_in = (Bytef *)value.data();
+		deflate_stream_->avail_in = value.length();
+		deflate_stream_->next_out = (Bytef *)&record[1];
+		deflate_stream_->avail_out = record.length() - 1;
+		if (deflate(deflate_stream_, Z_FINISH) != Z_STREAM_END) {
+			printf("_db_encode_data: deflate error\n");
+			return false;
+		}
+		size_t compressed_length = record.length() - 1 - deflate_stream_->avail_out;
+		if (compressed_length < value.length()) {
+			record[0] = kData_compressed;
+			record.resize(compressed_length + 1);
+			return true;
+		}
+	}
+	record.assign(1, kData_raw);
+	record.append(value);
+	return true;
+}
+
+/*
+ * 写入成功之后把value和编码后的data记录算进压缩的统计，忙、重复和失败的写入都不算
+ */
+void DB::_db_count_data(const string &value, const string &record, DBStats &stats) {
+	stats.raw_bytes += value.length();
+	stats.stored_bytes += record.length() - 1;
+	if (kData_compressed == record[0])
+		stats.compressed_records++;
+	else
+		stats.raw_records++;
+}
+
+/*
+ * 把长度为length的data记录解码成value
+ * 成功返回true，失败返回false
+ */
+bool DB::_db_decode_data(const char *record, int length, string &value) {
+	return decode_data(inflate_stream_, dict_, record, length, value);
+}
+
 }
@@ -0,0 +1,279 @@
+#include "../include/v_db_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const uint32_t kCache_magic = 0x76444243;   //共享内存初始化完成的标志
+const int kCache_record = 100;              //能缓存的index记录的最大长度
+const int kCache_spin = 64;                 //作废槽时先自旋的次数，之后让出cpu
+const int kCache_yield = 1024;              //让出cpu的次数，之后每次睡一会
+const long kCache_sleep = 100000;           //每次睡眠的纳秒数
+const int kCache_check = 64;                //每退避这么多次检查一下持有槽的进程还在不在
+const int kCache_wait = 1000;               //等待创建者初始化的最大次数，每次让出一下cpu
+
+namespace vDB {
+
+/*
+ * 共享内存的头部，后面依次是hash链的头指针和index记录槽
+ */
+struct SharedCache::Header {
+	uint32_t magic;           //初始化完成后才写入
+	uint32_t generation;      //整体作废一次加1，槽里的generation和它不同就是无效的
+	uint32_t node_count;      //index记录槽的个数，2的幂
+	uint32_t bucket_count;    //hash表的大小
+};
+
+struct SharedCache::Node {
+	uint32_t seq;             //版本号，奇数表示正在写
+	int32_t owner;            //正在写这个槽的进程的pid，0表示没人在写
+	uint32_t generation;      //写入时的generation
+	int64_t offset;           //index记录的偏移量，0表示空槽
+	int64_t next;             //下一个节点的偏移量
+	int32_t length;           //index记录的长度
+	char record[kCache_record];
+};
+
+SharedCache::SharedCache() : header_(nullptr), buckets_(nullptr), nodes_(nullptr), size_(0) {}
+
+SharedCache::~SharedCache() {
+	cache_detach();
+}
+
+/*
+ * 用.idx文件的设备号和inode号命名，同一个文件不管用什么路径打开都是同一个缓存
+ */
+std::string SharedCache::_cache_name(int fd) {
+	struct stat statbuff;
+	if (fstat(fd, &statbuff) < 0)
+		return "";
+	char name[64];
+	sprintf(name, "/vdb.%llx.%llx", (unsigned long long)statbuff.st_dev, (unsigned long long)statbuff.st_ino);
+	return name;
+}
+
+bool SharedCache::cache_attach(int fd, int nodes, int buckets) {
+	cache_detach();
+	std::string name = _cache_name(fd);
+	if (name.empty()) {
+		printf("cache_attach: fstat error\n");
+		return false;
+	}
+	uint32_t node_count = 1;
+	while (node_count < (uint32_t)nodes)
+		node_count <<= 1;
+	size_t size = sizeof(Header) + buckets * sizeof(int64_t) + node_count * sizeof(Node);
+	//先尝试独占创建，已经存在就连接
+	bool create = nodes > 0;
+	int shm_fd = create ? shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR) : -1;
+	if (shm_fd < 0) {
+		create = false;
+		if (nodes > 0 && errno != EEXIST) {
+			printf("cache_attach: shm_open error\n");
+			return false;
+		}
+		if ((shm_fd = shm_open(name.c_str(), O_RDWR, 0)) < 0)
+			return false;
+	}
+	if (create && ftruncate(shm_fd, size) < 0) {
+		printf("cache_attach: ftruncate error\n");
+		close(shm_fd);
+		shm_unlink(name.c_str());
+		return false;
+	}
+	if (!create) {
+		//等创建者把大小设好
+		struct stat statbuff;
+		for (int i = 0; ; ++i) {
+			if (fstat(shm_fd, &statbuff) < 0 || i == kCache_wait) {
+				printf("cache_attach: cache is not ready\n");
+				close(shm_fd);
+				return false;
+			}
+			if (statbuff.st_size >= (off_t)sizeof(Header))
+				break;
+			sched_yield();
+		}
+		size = statbuff.st_size;
+	}
+	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	close(shm_fd);
+	if (MAP_FAILED == addr) {
+		printf("cache_attach: mmap error\n");
+		return false;
+	}
+	header_ = (Header *)addr;
+	size_ = size;
+	if (create) {
+		//ftruncate出来的内存都是0，只需要填好头部，magic最后写
+		header_->node_count = node_count;
+		header_->bucket_count = buckets;
+		__atomic_store_n(&header_->magic, kCache_magic, __ATOMIC_RELEASE);
+	}
+	else {
+		for (int i = 0; __atomic_load_n(&header_->magic, __ATOMIC_ACQUIRE) != kCache_magic; ++i) {
+			if (i == kCache_wait) {
+				printf("cache_attach: cache is not ready\n");
+				cache_detach();
+				return false;
+			}
+			sched_yield();
+		}
+		if (header_->bucket_count != (uint32_t)buckets || size != sizeof(Header) + buckets * sizeof(int64_t) + header_->node_count * sizeof(Node)) {
+			printf("cache_attach: cache layout mismatch\n");
+			cache_detach();
+			return false;
+		}
+	}
+	buckets_ = (int64_t *)(header_ + 1);
+	nodes_ = (Node *)(buckets_ + buckets);
+	return true;
+}
+
+void SharedCache::cache_detach() {
+	if (header_)
+		munmap(header_, size_);
+	header_ = nullptr;
+	buckets_ = nullptr;
+	nodes_ = nullptr;
+	size_ = 0;
+}
+
+bool SharedCache::cache_remove(int fd) {
+	std::string name = _cache_name(fd);
+	return !name.empty() && !shm_unlink(name.c_str());
+}
+
+bool SharedCache::cache_get_bucket(int i, off_t &ptr) {
+	int64_t value = __atomic_load_n(&buckets_[i], __ATOMIC_ACQUIRE);
+	if (!value)
+		return false;
+	ptr = value - 1;
+	return true;
+}
+
+void SharedCache::cache_set_bucket(int i, off_t ptr) {
+	__atomic_store_n(&buckets_[i], (int64_t)ptr + 1, __ATOMIC_RELEASE);
+}
+
+SharedCache::Node* SharedCache::_cache_node(off_t offset) {
+	//偏移量的低位变化太小，混合一下再取模
+	uint64_t hash = (uint64_t)offset * 0x9e3779b97f4a7c15ULL;
+	return &nodes_[(hash >> 32) & (header_->node_count - 1)];
+}
+
+/*
+ * seqlock的读：版本号是偶数，复制完后版本号没变，generation也对得上才算命中
+ */
+bool SharedCache::cache_get_node(off_t offset, char *buffer, int &length, off_t &next) {
+	Node *node = _cache_node(offset);
+	uint32_t seq = __atomic_load_n(&node->seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+		return false;
+	uint32_t generation = __atomic_load_n(&header_->generation, __ATOMIC_ACQUIRE);
+	if (node->offset != offset || node->generation != generation)
+		return false;
+	int node_length = node->length;
+	if (node_length <= 0 || node_length > kCache_record)
+		return false;
+	off_t node_next = node->next;
+	memcpy(buffer, node->record, node_length);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&node->seq, __ATOMIC_RELAXED) != seq)
+		return false;
+	length = node_length;
+	next = node_next;
+	return true;
+}
+
+/*
+ * 把自己的pid写进owner来独占一个槽，成功后版本号是奇数
+ * wait为false时有人在写就直接返回false
+ * wait为true时退避等待：先自旋，再让出cpu，再睡眠，期间发现持有者已经不在了就接手
+ * 接手时上一次写入可能只写了一半，版本号还是奇数，槽的内容不能再用
+ */
+bool SharedCache::_cache_lock_node(Node *node, bool wait) {
+	int32_t pid = getpid();
+	for (int i = 0; ; ++i) {
+		int32_t owner = 0;
+		if (__atomic_compare_exchange_n(&node->owner, &owner, pid, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+		if (!wait)
+			return false;
+		if (i % kCache_check == kCache_check - 1 && kill(owner, 0) < 0 && ESRCH == errno &&
+			__atomic_compare_exchange_n(&node->owner, &owner, pid, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			printf("cache_lock_node: writer %d is gone, take over the node\n", owner);
+			node->offset = 0;
+			break;
+		}
+		if (i >= kCache_spin + kCache_yield) {
+			struct timespec ts = {0, kCache_sleep};
+			nanosleep(&ts, NULL);
+		}
+		else if (i >= kCache_spin)
+			sched_yield();
+	}
+	uint32_t seq = __atomic_load_n(&node->seq, __ATOMIC_RELAXED);
+	if (!(seq & 1))
+		__atomic_store_n(&node->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return true;
+}
+
+/*
+ * 版本号改回偶数，再释放owner
+ */
+void SharedCache::_cache_unlock_node(Node *node) {
+	__atomic_store_n(&node->seq, __atomic_load_n(&node->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&node->owner, 0, __ATOMIC_RELEASE);
+}
+
+void SharedCache::cache_put_node(off_t offset, const char *record, int length, off_t next) {
+	if (length > kCache_record)
+		return;
+	Node *node = _cache_node(offset);
+	//别人正在写就算了，缓存不是必须的
+	if (!_cache_lock_node(node, false))
+		return;
+	uint32_t seq = __atomic_load_n(&node->seq, __ATOMIC_RELAXED);
+	uint32_t generation = __atomic_load_n(&header_->generation, __ATOMIC_ACQUIRE);
+	node->generation = generation;
+	node->offset = offset;
+	node->next = next;
+	node->length = length;
+	memcpy(node->record, record, length);
+	//写的过程中被整体作废了，这条记录可能是作废之前读的，不能发布
+	if (__atomic_load_n(&header_->generation, __ATOMIC_ACQUIRE) != generation)
+		node->offset = 0;
+	//只从自己设的奇数版本号发布，被认为已经崩溃、槽被别人接手时什么都不做
+	if (!__atomic_compare_exchange_n(&node->seq, &seq, seq + 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		return;
+	__atomic_store_n(&node->owner, 0, __ATOMIC_RELEASE);
+}
+
+void SharedCache::cache_invalidate_node(off_t offset) {
+	Node *node = _cache_node(offset);
+	//不是这条记录就不用管，正在写的槽版本号是奇数，要等它写完再看
+	uint32_t seq = __atomic_load_n(&node->seq, __ATOMIC_ACQUIRE);
+	if (!(seq & 1) && node->offset != offset)
+		return;
+	_cache_lock_node(node, true);
+	if (node->offset == offset)
+		node->offset = 0;
+	_cache_unlock_node(node);
+}
+
+void SharedCache::cache_reset() {
+	__atomic_add_fetch(&header_->generation, 1, __ATOMIC_ACQ_REL);
+	for (uint32_t i = 0; i < header_->bucket_count; ++i)
+		__atomic_store_n(&buckets_[i], 0, __ATOMIC_RELEASE);
+}
+
+}
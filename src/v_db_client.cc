@@ -0,0 +1,167 @@
+#include "../include/v_db_client.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+const int kClient_read_size = 64 * 1024;   //每次从socket读取的最大字节数
+
+namespace vDB {
+
+Client::Client() : fd_(-1) {}
+
+Client::~Client() {
+	client_close();
+}
+
+bool Client::client_connect(const string &host, int port) {
+	client_close();
+	struct sockaddr_in addr;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+		printf("client_connect: invalid host %s\n", host.c_str());
+		return false;
+	}
+	if ((fd_ = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		printf("client_connect: socket error\n");
+		return false;
+	}
+	if (connect(fd_, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		printf("client_connect: connect error\n");
+		client_close();
+		return false;
+	}
+	//请求都是自己攒批发出的，不需要Nagle
+	int flag = 1;
+	setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+	return true;
+}
+
+void Client::client_close() {
+	if (fd_ >= 0)
+		close(fd_);
+	fd_ = -1;
+	output_.clear();
+	input_.clear();
+	ops_.clear();
+}
+
+int Client::client_get(const string &key, string &value) {
+	Request request;
+	Response response;
+	request.op = OP_GET;
+	request.keys.push_back(key);
+	int status = _client_call(request, response);
+	if (STATUS_OK == status)
+		value = response.values[0];
+	return status;
+}
+
+int Client::client_set(const string &key, const string &value) {
+	Request request;
+	Response response;
+	request.op = OP_SET;
+	request.keys.push_back(key);
+	request.value = value;
+	return _client_call(request, response);
+}
+
+int Client::client_del(const string &key) {
+	Request request;
+	Response response;
+	request.op = OP_DEL;
+	request.keys.push_back(key);
+	return _client_call(request, response);
+}
+
+int Client::client_mget(const std::vector<string> &keys, std::vector<string> &values) {
+	Request request;
+	Response response;
+	request.op = OP_MGET;
+	request.keys = keys;
+	int status = _client_call(request, response);
+	if (STATUS_OK == status)
+		values.swap(response.values);
+	return status;
+}
+
+/*
+ * 发送一个请求并等待它的回复
+ * 之前流水线里还没取走的回复会被丢弃
+ * 返回状态码，网络错误返回-1
+ */
+int Client::_client_call(const Request &request, Response &response) {
+	client_send(request);
+	while (ops_.size() > 1)
+		if (!client_receive(response))
+			return -1;
+	if (!client_receive(response))
+		return -1;
+	return response.status;
+}
+
+void Client::client_send(const Request &request) {
+	encode_request(request, output_);
+	ops_.push_back(request.op);
+}
+
+bool Client::client_flush() {
+	if (fd_ < 0) {
+		printf("client_flush: not connected\n");
+		return false;
+	}
+	size_t offset = 0;
+	while (offset < output_.length()) {
+		ssize_t n = send(fd_, output_.data() + offset, output_.length() - offset, MSG_NOSIGNAL);
+		if (n < 0 && EINTR == errno)
+			continue;
+		if (n <= 0) {
+			printf("client_flush: send error\n");
+			return false;
+		}
+		offset += n;
+	}
+	output_.clear();
+	return true;
+}
+
+bool Client::client_receive(Response &response) {
+	if (ops_.empty()) {
+		printf("client_receive: no outstanding request\n");
+		return false;
+	}
+	if (!output_.empty() && !client_flush())
+		return false;
+	char buffer[kClient_read_size];
+	while (true) {
+		int length = decode_response(ops_.front(), input_.data(), input_.length(), response);
+		if (length < 0) {
+			printf("client_receive: invalid response\n");
+			return false;
+		}
+		if (length > 0) {
+			input_.erase(0, length);
+			ops_.pop_front();
+			return true;
+		}
+		ssize_t n = read(fd_, buffer, sizeof(buffer));
+		if (n < 0 && EINTR == errno)
+			continue;
+		if (n <= 0) {
+			printf("client_receive: read error\n");
+			return false;
+		}
+		input_.append(buffer, n);
+	}
+}
+
+size_t Client::client_outstanding() {
+	return ops_.size();
+}
+
+}
@@ -0,0 +1,321 @@
+#include "../include/v_db_pool.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/uio.h>
+
+const size_t kPage_size = 4096;          //页的大小，也是O_DIRECT要求的对齐
+const size_t kPool_min = 16;             //缓冲池最少的页数
+const size_t kWrite_back_batch = 256;    //淘汰脏页时一次最多写回的页数
+const int kWrite_back_iov = 64;          //一次pwritev最多的页数
+
+namespace vDB {
+
+/*
+ * (文件, 页号)合成hash表的key
+ */
+static unsigned long long page_key(int file, off_t page) {
+	return ((unsigned long long)file << 48) | (unsigned long long)page;
+}
+
+BufferPool::BufferPool() : memory_(nullptr), hand_(0), tick_(1), hits_(0), misses_(0) {}
+
+BufferPool::~BufferPool() {
+	pool_close();
+}
+
+bool BufferPool::pool_open(size_t bytes) {
+	pool_close();
+	size_t count = std::max(bytes / kPage_size, kPool_min);
+	void *memory;
+	if (posix_memalign(&memory, kPage_size, count * kPage_size)) {
+		printf("pool_open: malloc error for buffer pool\n");
+		return false;
+	}
+	memory_ = (char *)memory;
+	frames_.resize(count);
+	for (size_t i = 0; i < count; ++i) {
+		frames_[i].file = -1;
+		frames_[i].data = memory_ + i * kPage_size;
+		free_.push_back(count - 1 - i);
+	}
+	return true;
+}
+
+void BufferPool::pool_close() {
+	free(memory_);
+	memory_ = nullptr;
+	frames_.clear();
+	free_.clear();
+	table_.clear();
+	a1_.clear();
+	files_.clear();
+	hand_ = 0;
+}
+
+bool BufferPool::pool_add_file(int fd, int weight) {
+	off_t size = lseek(fd, 0, SEEK_END);
+	if (-1 == size) {
+		printf("pool_add_file: lseek error\n");
+		return false;
+	}
+	files_.push_back(File{fd, size, size, std::max(weight, 1)});
+	return true;
+}
+
+int BufferPool::_pool_file(int fd) {
+	for (size_t i = 0; i < files_.size(); ++i)
+		if (files_[i].fd == fd)
+			return i;
+	return -1;
+}
+
+void BufferPool::pool_tick() {
+	++tick_;
+}
+
+long long BufferPool::pool_hits() {
+	return hits_;
+}
+
+long long BufferPool::pool_misses() {
+	return misses_;
+}
+
+/*
+ * 命中时调整页在2Q中的位置，同一次操作里的访问只算一次
+ */
+void BufferPool::_pool_touch(Frame &frame) {
+	if (frame.tick == tick_)
+		return;
+	frame.tick = tick_;
+	if (!frame.hot) {
+		a1_.erase(frame.a1);
+		frame.hot = true;
+		frame.usage = 1;
+	}
+	else
+		frame.usage = std::min(frame.usage + 1, files_[frame.file].weight);
+}
+
+/*
+ * 选一个要淘汰的页框
+ * 有空闲的直接用，A1超过四分之一或者Am为空时淘汰A1的队头，否则在Am里转CLOCK
+ */
+int BufferPool::_pool_victim() {
+	if (!free_.empty()) {
+		int index = free_.back();
+		free_.pop_back();
+		return index;
+	}
+	if (a1_.size() * 4 > frames_.size() || a1_.size() == frames_.size())
+		return a1_.front();
+	while (true) {
+		Frame &frame = frames_[hand_];
+		int index = hand_;
+		hand_ = (hand_ + 1) % frames_.size();
+		if (!frame.hot)
+			continue;
+		if (!frame.usage)
+			return index;
+		--frame.usage;
+	}
+}
+
+/*
+ * 把页框从hash表和A1里去掉，变成空闲的
+ */
+void BufferPool::_pool_drop(int index) {
+	Frame &frame = frames_[index];
+	if (frame.file < 0)
+		return;
+	table_.erase(page_key(frame.file, frame.page));
+	if (!frame.hot)
+		a1_.erase(frame.a1);
+	frame.file = -1;
+	frame.dirty = false;
+}
+
+/*
+ * 找到文件file的第page页，不在缓冲池里就淘汰一个页框读进来
+ * read为false表示调用者会覆盖整个页，不需要读
+ * 返回页框的下标，失败返回-1
+ */
+int BufferPool::_pool_get(int file, off_t page, bool read) {
+	auto it = table_.find(page_key(file, page));
+	if (it != table_.end()) {
+		++hits_;
+		_pool_touch(frames_[it->second]);
+		return it->second;
+	}
+	++misses_;
+	int index = _pool_victim();
+	Frame &frame = frames_[index];
+	if (frame.file >= 0 && frame.dirty) {
+		//淘汰脏页时顺便把别的脏页也写回去，攒成大块的顺序写
+		std::vector<int> batch(1, index);
+		for (size_t i = 0; i < frames_.size() && batch.size() < kWrite_back_batch; ++i)
+			if (frames_[i].file >= 0 && frames_[i].dirty && (int)i != index)
+				batch.push_back(i);
+		if (!_pool_write_back(batch))
+			return -1;
+	}
+	_pool_drop(index);
+	File &f = files_[file];
+	off_t offset = page * kPage_size;
+	memset(frame.data, 0, kPage_size);
+	if (read && offset < f.disk_size) {
+		//O_DIRECT只能整页读，文件末尾的页会读到较少的字节
+		if (pread(f.fd, frame.data, kPage_size, offset) < 0) {
+			printf("_pool_get: pread error\n");
+			free_.push_back(index);
+			return -1;
+		}
+	}
+	frame.file = file;
+	frame.page = page;
+	frame.dirty = false;
+	frame.hot = false;
+	frame.usage = 0;
+	frame.tick = tick_;
+	frame.a1 = a1_.insert(a1_.end(), index);
+	table_[page_key(file, page)] = index;
+	return index;
+}
+
+ssize_t BufferPool::pool_pread(int fd, void *buffer, size_t length, off_t offset) {
+	int file = _pool_file(fd);
+	if (file < 0)
+		return -1;
+	if (offset >= files_[file].size)
+		return 0;
+	length = std::min((off_t)length, files_[file].size - offset);
+	size_t done = 0;
+	while (done < length) {
+		off_t position = offset + done;
+		int index = _pool_get(file, position / kPage_size, true);
+		if (index < 0)
+			return -1;
+		size_t skip = position % kPage_size;
+		size_t n = std::min(length - done, kPage_size - skip);
+		memcpy((char *)buffer + done, frames_[index].data + skip, n);
+		done += n;
+	}
+	return done;
+}
+
+ssize_t BufferPool::pool_pwrite(int fd, const void *buffer, size_t length, off_t offset) {
+	int file = _pool_file(fd);
+	if (file < 0)
+		return -1;
+	size_t done = 0;
+	while (done < length) {
+		off_t position = offset + done;
+		size_t skip = position % kPage_size;
+		size_t n = std::min(length - done, kPage_size - skip);
+		//整页覆盖时不需要先读
+		int index = _pool_get(file, position / kPage_size, n != kPage_size);
+		if (index < 0)
+			return -1;
+		memcpy(frames_[index].data + skip, (const char *)buffer + done, n);
+		frames_[index].dirty = true;
+		done += n;
+	}
+	files_[file].size = std::max(files_[file].size, (off_t)(offset + length));
+	return done;
+}
+
+off_t BufferPool::pool_size(int fd) {
+	int file = _pool_file(fd);
+	return file < 0 ? -1 : files_[file].size;
+}
+
+/*
+ * 截断文件，超出部分的页直接丢掉，最后一页超出的部分清零
+ */
+bool BufferPool::pool_truncate(int fd, off_t size) {
+	int file = _pool_file(fd);
+	if (file < 0)
+		return false;
+	for (size_t i = 0; i < frames_.size(); ++i) {
+		Frame &frame = frames_[i];
+		if (frame.file != file)
+			continue;
+		off_t offset = frame.page * kPage_size;
+		if (offset >= size) {
+			_pool_drop(i);
+			free_.push_back(i);
+		}
+		else if (offset + (off_t)kPage_size > size) {
+			memset(frame.data + (size - offset), 0, offset + kPage_size - size);
+			frame.dirty = true;
+		}
+	}
+	if (ftruncate(fd, size) < 0) {
+		printf("pool_truncate: ftruncate error\n");
+		return false;
+	}
+	files_[file].size = files_[file].disk_size = size;
+	return true;
+}
+
+/*
+ * 按(文件, 页号)排序后写回，连续的页合成一次pwritev
+ * 成功返回true，失败返回false
+ */
+bool BufferPool::_pool_write_back(std::vector<int> &batch) {
+	std::sort(batch.begin(), batch.end(), [this](int a, int b) {
+		return page_key(frames_[a].file, frames_[a].page) < page_key(frames_[b].file, frames_[b].page);
+	});
+	struct iovec iov[kWrite_back_iov];
+	for (size_t i = 0; i < batch.size(); ) {
+		Frame &first = frames_[batch[i]];
+		size_t j = i;
+		int count = 0;
+		for (; j < batch.size() && count < kWrite_back_iov; ++j, ++count) {
+			Frame &frame = frames_[batch[j]];
+			if (frame.file != first.file || frame.page != first.page + count)
+				break;
+			iov[count].iov_base = frame.data;
+			iov[count].iov_len = kPage_size;
+		}
+		File &f = files_[first.file];
+		off_t offset = first.page * kPage_size;
+		if (pwritev(f.fd, iov, count, offset) != (ssize_t)(count * kPage_size)) {
+			printf("_pool_write_back: pwritev error\n");
+			return false;
+		}
+		f.disk_size = std::max(f.disk_size, (off_t)(offset + count * kPage_size));
+		for (; i < j; ++i)
+			frames_[batch[i]].dirty = false;
+	}
+	return true;
+}
+
+bool BufferPool::pool_flush() {
+	std::vector<int> batch;
+	for (size_t i = 0; i < frames_.size(); ++i)
+		if (frames_[i].file >= 0 && frames_[i].dirty)
+			batch.push_back(i);
+	if (!_pool_write_back(batch))
+		return false;
+	//整页写回会让文件变长，截回逻辑大小
+	for (size_t i = 0; i < files_.size(); ++i) {
+		File &f = files_[i];
+		if (f.disk_size != f.size && ftruncate(f.fd, f.size) < 0) {
+			printf("pool_flush: ftruncate error\n");
+			return false;
+		}
+		f.disk_size = f.size;
+		if (fdatasync(f.fd) < 0) {
+			printf("pool_flush: fdatasync error\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+}
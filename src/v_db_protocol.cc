@@ -0,0 +1,185 @@
+#include "../include/v_db_protocol.h"
+
+#include <cstring>
+#include <arpa/inet.h>
+
+namespace vDB {
+
+/*
+ * 追加一个网络字节序的4字节整数
+ */
+static void append_u32(string &out, uint32_t value) {
+	value = htonl(value);
+	out.append((const char *)&value, sizeof(value));
+}
+
+/*
+ * 读取一个网络字节序的4字节整数，调用前需要保证长度足够
+ */
+static uint32_t read_u32(const char *buffer) {
+	uint32_t value;
+	memcpy(&value, buffer, sizeof(value));
+	return ntohl(value);
+}
+
+/*
+ * 读取一个带4字节长度的字符串，ptr和left会前移
+ * 成功返回true，长度不够返回false
+ */
+static bool read_string(const char *&ptr, size_t &left, string &result) {
+	if (left < 4)
+		return false;
+	uint32_t length = read_u32(ptr);
+	if (left - 4 < length)
+		return false;
+	result.assign(ptr + 4, length);
+	ptr += 4 + length;
+	left -= 4 + length;
+	return true;
+}
+
+/*
+ * 写帧头，长度先占位，由end_frame补上
+ */
+static size_t begin_frame(string &out, int code) {
+	size_t start = out.length();
+	append_u32(out, 0);
+	out.push_back((char)code);
+	return start;
+}
+
+static void end_frame(string &out, size_t start) {
+	uint32_t length = htonl(out.length() - start - 4);
+	memcpy(&out[start], &length, sizeof(length));
+}
+
+/*
+ * 检查帧头，返回整帧的长度，数据不完整返回0，格式错误返回-1
+ */
+static int check_frame(const char *buffer, size_t length) {
+	if (length < kFrame_header_size)
+		return 0;
+	uint32_t frame_length = read_u32(buffer);
+	if (frame_length < 1 || frame_length > kFrame_max)
+		return -1;
+	if (length - 4 < frame_length)
+		return 0;
+	return frame_length + 4;
+}
+
+void encode_request(const Request &request, string &out) {
+	size_t start = begin_frame(out, request.op);
+	switch (request.op) {
+	case OP_GET:
+	case OP_DEL:
+		out.append(request.keys[0]);
+		break;
+	case OP_SET:
+		append_u32(out, request.keys[0].length());
+		out.append(request.keys[0]);
+		out.append(request.value);
+		break;
+	case OP_MGET:
+		append_u32(out, request.keys.size());
+		for (size_t i = 0; i < request.keys.size(); ++i) {
+			append_u32(out, request.keys[i].length());
+			out.append(request.keys[i]);
+		}
+		break;
+	}
+	end_frame(out, start);
+}
+
+int decode_request(const char *buffer, size_t length, Request &request) {
+	int frame_length = check_frame(buffer, length);
+	if (frame_length <= 0)
+		return frame_length;
+	request.op = (unsigned char)buffer[4];
+	request.keys.clear();
+	request.value.clear();
+	const char *ptr = buffer + kFrame_header_size;
+	size_t left = frame_length - kFrame_header_size;
+	switch (request.op) {
+	case OP_GET:
+	case OP_DEL:
+		request.keys.push_back(string(ptr, left));
+		break;
+	case OP_SET:
+		request.keys.resize(1);
+		if (!read_string(ptr, left, request.keys[0]))
+			return -1;
+		request.value.assign(ptr, left);
+		break;
+	case OP_MGET: {
+		if (left < 4)
+			return -1;
+		uint32_t count = read_u32(ptr);
+		ptr += 4;
+		left -= 4;
+		//每个key至少占4个字节，先检查一下以免count过大
+		if (count > left / 4)
+			return -1;
+		request.keys.resize(count);
+		for (uint32_t i = 0; i < count; ++i)
+			if (!read_string(ptr, left, request.keys[i]))
+				return -1;
+		if (left)
+			return -1;
+		break;
+	}
+	default:
+		return -1;
+	}
+	return frame_length;
+}
+
+void encode_response(int op, const Response &response, string &out) {
+	size_t start = begin_frame(out, response.status);
+	if (STATUS_OK == response.status) {
+		if (OP_GET == op)
+			out.append(response.values[0]);
+		else if (OP_MGET == op) {
+			append_u32(out, response.values.size());
+			for (size_t i = 0; i < response.values.size(); ++i) {
+				append_u32(out, response.values[i].length());
+				out.append(response.values[i]);
+			}
+		}
+	}
+	//MGET的回复可能超过一帧的上限，对方会当成格式错误断开，改成回复STATUS_ERROR
+	if (out.length() - start - 4 > kFrame_max) {
+		out.resize(start);
+		begin_frame(out, STATUS_ERROR);
+	}
+	end_frame(out, start);
+}
+
+int decode_response(int op, const char *buffer, size_t length, Response &response) {
+	int frame_length = check_frame(buffer, length);
+	if (frame_length <= 0)
+		return frame_length;
+	response.status = (unsigned char)buffer[4];
+	response.values.clear();
+	const char *ptr = buffer + kFrame_header_size;
+	size_t left = frame_length - kFrame_header_size;
+	if (STATUS_OK != response.status || (OP_GET != op && OP_MGET != op))
+		return left ? -1 : frame_length;
+	if (OP_GET == op) {
+		response.values.push_back(string(ptr, left));
+		return frame_length;
+	}
+	if (left < 4)
+		return -1;
+	uint32_t count = read_u32(ptr);
+	ptr += 4;
+	left -= 4;
+	if (count > left / 4)
+		return -1;
+	response.values.resize(count);
+	for (uint32_t i = 0; i < count; ++i)
+		if (!read_string(ptr, left, response.values[i]))
+			return -1;
+	return left ? -1 : frame_length;
+}
+
+}
@@ -0,0 +1,429 @@
+#include "../include/v_db_server.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+const int kMax_events = 256;               //每次epoll_wait最多处理的事件数
+const int kServer_read_size = 64 * 1024;   //每次从socket读取的最大字节数
+const size_t kBatch_max = 256;             //一个批次最多包含的请求数
+const size_t kPending_max = 4096;          //每个连接最多积压的请求数，超过后暂停读
+const uint64_t kListen_id = 0;             //epoll事件里监听fd的编号
+const uint64_t kEvent_id = 1;              //epoll事件里event_fd的编号
+
+namespace vDB {
+
+Server::Server()
+	:	listen_fd_(-1),
+		epoll_fd_(-1),
+		event_fd_(-1),
+		running_(false),
+		stopping_(false),
+		next_id_(kEvent_id + 1)
+{
+	pthread_rwlock_init(&db_lock_, NULL);
+}
+
+Server::~Server() {
+	server_close();
+	pthread_rwlock_destroy(&db_lock_);
+}
+
+bool Server::server_open(const string &pathname, int port, int worker_number, bool create) {
+	if (worker_number <= 0) {
+		printf("server_open: worker number must be positive\n");
+		return false;
+	}
+	if (create) {
+		DB db;
+		if (!db.db_open(pathname, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) {
+			printf("server_open: create db error\n");
+			return false;
+		}
+	}
+	for (int i = 0; i < worker_number; ++i) {
+		dbs_.push_back(new DB());
+		if (!dbs_.back()->db_open(pathname, O_RDWR)) {
+			printf("server_open: open db error\n");
+			server_close();
+			return false;
+		}
+	}
+	struct sockaddr_in addr;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	int flag = 1;
+	if ((listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0 ||
+		setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)) < 0 ||
+		bind(listen_fd_, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		listen(listen_fd_, SOMAXCONN) < 0) {
+		printf("server_open: listen on port %d error\n", port);
+		server_close();
+		return false;
+	}
+	if ((epoll_fd_ = epoll_create1(0)) < 0 || (event_fd_ = eventfd(0, EFD_NONBLOCK)) < 0) {
+		printf("server_open: epoll or eventfd error\n");
+		server_close();
+		return false;
+	}
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.u64 = kListen_id;
+	epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+	event.data.u64 = kEvent_id;
+	epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &event);
+	stopping_ = false;
+	for (int i = 0; i < worker_number; ++i)
+		workers_.push_back(std::thread(&Server::_server_worker, this, dbs_[i]));
+	running_ = true;
+	return true;
+}
+
+void Server::server_run() {
+	struct epoll_event events[kMax_events];
+	while (running_) {
+		int n = epoll_wait(epoll_fd_, events, kMax_events, -1);
+		if (n < 0) {
+			if (EINTR == errno)
+				continue;
+			printf("server_run: epoll_wait error\n");
+			break;
+		}
+		for (int i = 0; i < n; ++i) {
+			uint64_t id = events[i].data.u64;
+			if (kListen_id == id) {
+				_server_accept();
+				continue;
+			}
+			if (kEvent_id == id) {
+				uint64_t count;
+				while (read(event_fd_, &count, sizeof(count)) > 0)
+					;
+				_server_complete();
+				continue;
+			}
+			auto element = connections_.find(id);
+			if (element == connections_.end() || element->second->closed)
+				continue;
+			Connection *connection = element->second;
+			if (events[i].events & EPOLLOUT)
+				_server_write(connection);
+			if (!connection->closed && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+				_server_read(connection);
+		}
+		//这一轮关闭的连接，没有批次在执行的可以释放了
+		for (size_t i = 0; i < closed_.size(); ++i) {
+			auto element = connections_.find(closed_[i]);
+			if (element != connections_.end() && !element->second->busy) {
+				delete element->second;
+				connections_.erase(element);
+			}
+		}
+		closed_.clear();
+	}
+}
+
+void Server::server_stop() {
+	running_ = false;
+	//write是异步信号安全的，写失败说明已经有未处理的唤醒
+	uint64_t count = 1;
+	if (event_fd_ >= 0)
+		(void)!write(event_fd_, &count, sizeof(count));
+}
+
+void Server::server_close() {
+	running_ = false;
+	{
+		std::lock_guard<std::mutex> guard(task_mutex_);
+		stopping_ = true;
+	}
+	task_cond_.notify_all();
+	for (size_t i = 0; i < workers_.size(); ++i)
+		workers_[i].join();
+	workers_.clear();
+	for (size_t i = 0; i < tasks_.size(); ++i)
+		delete tasks_[i];
+	tasks_.clear();
+	for (size_t i = 0; i < done_.size(); ++i)
+		delete done_[i];
+	done_.clear();
+	for (auto element = connections_.begin(); element != connections_.end(); ++element) {
+		if (!element->second->closed)
+			close(element->second->fd);
+		delete element->second;
+	}
+	connections_.clear();
+	for (size_t i = 0; i < dbs_.size(); ++i)
+		delete dbs_[i];
+	dbs_.clear();
+	if (listen_fd_ >= 0)
+		close(listen_fd_);
+	if (epoll_fd_ >= 0)
+		close(epoll_fd_);
+	if (event_fd_ >= 0)
+		close(event_fd_);
+	listen_fd_ = epoll_fd_ = event_fd_ = -1;
+}
+
+void Server::_server_accept() {
+	while (true) {
+		int fd = accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0) {
+			if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)
+				printf("_server_accept: accept error\n");
+			return;
+		}
+		int flag = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+		Connection *connection = new Connection();
+		connection->fd = fd;
+		connection->id = next_id_++;
+		connection->busy = connection->closed = connection->eof = false;
+		connection->reading = true;
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.u64 = connection->id;
+		if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+			printf("_server_accept: epoll_ctl error\n");
+			close(fd);
+			delete connection;
+			continue;
+		}
+		connections_[connection->id] = connection;
+	}
+}
+
+/*
+ * 读取所有可读的数据并解析出完整的请求
+ * 读到EOF时对方可能只是关闭了写端，已经收到的请求照常执行，回复写完后再关闭
+ */
+void Server::_server_read(Connection *connection) {
+	char buffer[kServer_read_size];
+	while (!connection->eof) {
+		ssize_t n = read(connection->fd, buffer, sizeof(buffer));
+		if (n > 0) {
+			connection->input.append(buffer, n);
+			continue;
+		}
+		if (!n) {
+			connection->eof = true;
+			break;
+		}
+		if (EINTR == errno)
+			continue;
+		if (EAGAIN == errno || EWOULDBLOCK == errno)
+			break;
+		//出错了就不用再回复了
+		_server_close_connection(connection);
+		return;
+	}
+	size_t offset = 0;
+	while (offset < connection->input.length()) {
+		Request request;
+		int length = decode_request(connection->input.data() + offset, connection->input.length() - offset, request);
+		if (length < 0) {
+			printf("_server_read: invalid request\n");
+			_server_close_connection(connection);
+			return;
+		}
+		if (!length)
+			break;
+		offset += length;
+		connection->pending.push_back(request);
+	}
+	connection->input.erase(0, offset);
+	//EOF之后不再监听可读事件，否则会一直触发
+	if ((connection->eof || connection->pending.size() >= kPending_max) && connection->reading) {
+		connection->reading = false;
+		_server_update_events(connection);
+	}
+	_server_dispatch(connection);
+	_server_finish(connection);
+}
+
+/*
+ * 尽量把回复写出去，写不完就等可写事件
+ */
+void Server::_server_write(Connection *connection) {
+	size_t offset = 0;
+	while (offset < connection->output.length()) {
+		ssize_t n = send(connection->fd, connection->output.data() + offset, connection->output.length() - offset, MSG_NOSIGNAL);
+		if (n > 0) {
+			offset += n;
+			continue;
+		}
+		if (n < 0 && EINTR == errno)
+			continue;
+		if (n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno))
+			break;
+		_server_close_connection(connection);
+		return;
+	}
+	connection->output.erase(0, offset);
+	_server_update_events(connection);
+	_server_finish(connection);
+}
+
+/*
+ * 连接上没有正在执行的批次时，把积压的请求打包交给工作线程
+ */
+void Server::_server_dispatch(Connection *connection) {
+	if (connection->busy || connection->pending.empty())
+		return;
+	Task *task = new Task();
+	task->id = connection->id;
+	while (!connection->pending.empty() && task->requests.size() < kBatch_max) {
+		task->requests.push_back(Request());
+		task->requests.back().op = connection->pending.front().op;
+		task->requests.back().keys.swap(connection->pending.front().keys);
+		task->requests.back().value.swap(connection->pending.front().value);
+		connection->pending.pop_front();
+	}
+	connection->busy = true;
+	if (!connection->reading && !connection->eof && connection->pending.size() < kPending_max) {
+		connection->reading = true;
+		_server_update_events(connection);
+	}
+	{
+		std::lock_guard<std::mutex> guard(task_mutex_);
+		tasks_.push_back(task);
+	}
+	task_cond_.notify_one();
+}
+
+/*
+ * 处理工作线程执行完的批次
+ */
+void Server::_server_complete() {
+	std::deque<Task*> done;
+	{
+		std::lock_guard<std::mutex> guard(done_mutex_);
+		done.swap(done_);
+	}
+	for (size_t i = 0; i < done.size(); ++i) {
+		Task *task = done[i];
+		auto element = connections_.find(task->id);
+		if (element != connections_.end()) {
+			Connection *connection = element->second;
+			connection->busy = false;
+			if (connection->closed) {
+				//连接在批次执行期间关闭了
+				connections_.erase(element);
+				delete connection;
+			}
+			else {
+				connection->output.append(task->output);
+				_server_write(connection);
+				if (!connection->closed) {
+					_server_dispatch(connection);
+					_server_finish(connection);
+				}
+			}
+		}
+		delete task;
+	}
+}
+
+void Server::_server_update_events(Connection *connection) {
+	struct epoll_event event;
+	event.events = (connection->reading ? (uint32_t)EPOLLIN : 0) | (connection->output.empty() ? 0 : (uint32_t)EPOLLOUT);
+	event.data.u64 = connection->id;
+	epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+/*
+ * 对方已经EOF，请求都执行完、回复都写出去之后关闭连接
+ */
+void Server::_server_finish(Connection *connection) {
+	if (connection->eof && !connection->closed && !connection->busy && connection->pending.empty() && connection->output.empty())
+		_server_close_connection(connection);
+}
+
+/*
+ * 关闭连接，调用者可能还在使用这个对象，所以不在这里释放
+ * 没有批次在执行的话在这一轮事件处理完后释放，否则等批次结束后释放
+ */
+void Server::_server_close_connection(Connection *connection) {
+	if (connection->closed)
+		return;
+	epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection->fd, NULL);
+	close(connection->fd);
+	connection->closed = true;
+	closed_.push_back(connection->id);
+}
+
+void Server::_server_worker(DB *db) {
+	while (true) {
+		Task *task;
+		{
+			std::unique_lock<std::mutex> lock(task_mutex_);
+			while (!stopping_ && tasks_.empty())
+				task_cond_.wait(lock);
+			if (stopping_)
+				return;
+			task = tasks_.front();
+			tasks_.pop_front();
+		}
+		_server_execute(db, task);
+		{
+			std::lock_guard<std::mutex> guard(done_mutex_);
+			done_.push_back(task);
+		}
+		uint64_t count = 1;
+		if (write(event_fd_, &count, sizeof(count)) < 0)
+			printf("_server_worker: write eventfd error\n");
+	}
+}
+
+/*
+ * 执行一个批次，把回复编码到task->output
+ * 连续的读请求合并成一次db_multi_fetch，连续的写请求在一次加锁里完成
+ */
+void Server::_server_execute(DB *db, Task *task) {
+	std::vector<Request> &requests = task->requests;
+	size_t i = 0;
+	while (i < requests.size()) {
+		size_t j = i;
+		if (OP_GET == requests[i].op || OP_MGET == requests[i].op) {
+			std::vector<string> keys, values;
+			for (; j < requests.size() && (OP_GET == requests[j].op || OP_MGET == requests[j].op); ++j)
+				keys.insert(keys.end(), requests[j].keys.begin(), requests[j].keys.end());
+			pthread_rwlock_rdlock(&db_lock_);
+			db->db_multi_fetch(keys, values);
+			pthread_rwlock_unlock(&db_lock_);
+			size_t next_value = 0;
+			for (; i < j; ++i) {
+				Response response;
+				response.status = STATUS_OK;
+				response.values.assign(values.begin() + next_value, values.begin() + next_value + requests[i].keys.size());
+				next_value += requests[i].keys.size();
+				if (OP_GET == requests[i].op && response.values[0].empty())
+					response.status = STATUS_NOT_FOUND;
+				encode_response(requests[i].op, response, task->output);
+			}
+		}
+		else {
+			pthread_rwlock_wrlock(&db_lock_);
+			for (; j < requests.size() && OP_GET != requests[j].op && OP_MGET != requests[j].op; ++j) {
+				Response response;
+				if (OP_SET == requests[j].op)
+					response.status = db->db_store(requests[j].keys[0], requests[j].value, DB_STORE) ? STATUS_ERROR : STATUS_OK;
+				else
+					response.status = db->db_delete(requests[j].keys[0]) ? STATUS_OK : STATUS_NOT_FOUND;
+				encode_response(requests[j].op, response, task->output);
+			}
+			pthread_rwlock_unlock(&db_lock_);
+			i = j;
+		}
+	}
+}
+
+}
@@ -0,0 +1,987 @@
+#include "../include/v_log_db.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <zlib.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+const int kLog_key_length_size = 4;      //记录中key长度的字节数
+const int kLog_value_length_size = 4;    //记录中value长度的字节数，为0表示墓碑
+const int kLog_crc_size = 8;             //记录中校验和的字节数，16进制
+const int kLog_header_size = kLog_key_length_size + kLog_value_length_size + kLog_crc_size;   //记录头的大小
+const int kLog_offset_size = 10;         //hint文件中记录偏移量的字节数
+const int kHint_header_size = kLog_key_length_size + kLog_value_length_size + kLog_offset_size;   //hint记录头的大小
+const int kLog_key_max = vDB::kIndex_max - vDB::kIndex_min + 1;   //key的最大长度，和DB保持一致
+const off_t kSegment_max = 64 << 20;     //段文件的最大长度，超过就换一个新段
+const unsigned long long kSegment_step = 1 << 16;   //普通段的段号间隔，合并出来的段用中间的段号
+const int kLog_buffer_size = 1 << 20;    //扫描段文件和批量写入时的缓冲区大小
+
+namespace vDB {
+
+/*
+ * pthread读写锁的RAII封装，离开作用域自动解锁
+ */
+class LogReadGuard {
+public:
+	explicit LogReadGuard(pthread_rwlock_t *lock) : lock_(lock) { pthread_rwlock_rdlock(lock_); }
+	~LogReadGuard() { pthread_rwlock_unlock(lock_); }
+private:
+	pthread_rwlock_t *lock_;
+};
+
+class LogWriteGuard {
+public:
+	explicit LogWriteGuard(pthread_rwlock_t *lock) : lock_(lock) { pthread_rwlock_wrlock(lock_); }
+	~LogWriteGuard() { pthread_rwlock_unlock(lock_); }
+private:
+	pthread_rwlock_t *lock_;
+};
+
+/*
+ * 限时加锁的版本，第三个参数是最多等待的微秒数，0表示只试一次，小于0表示一直等
+ * 用result检查是否拿到锁，0表示拿到了，没拿到锁时析构不会解锁
+ */
+class LogTimedGuard {
+public:
+	explicit LogTimedGuard(pthread_rwlock_t *lock, bool write, long long timeout) : lock_(lock) {
+		if (timeout < 0)
+			result_ = write ? pthread_rwlock_wrlock(lock_) : pthread_rwlock_rdlock(lock_);
+		else if (!timeout)
+			result_ = write ? pthread_rwlock_trywrlock(lock_) : pthread_rwlock_tryrdlock(lock_);
+		else {
+			//pthread的超时是CLOCK_REALTIME的绝对时间
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += timeout / 1000000;
+			deadline.tv_nsec += timeout % 1000000 * 1000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			result_ = write ? pthread_rwlock_timedwrlock(lock_, &deadline) : pthread_rwlock_timedrdlock(lock_, &deadline);
+		}
+	}
+	~LogTimedGuard() {
+		if (!result_)
+			pthread_rwlock_unlock(lock_);
+	}
+	int result() { return result_; }
+private:
+	pthread_rwlock_t *lock_;
+	int result_;
+};
+
+/*
+ * 读取定长的十进制或16进制字段，格式不对返回-1
+ */
+static long long parse_field(const char *buffer, int length, int base) {
+	char field[16];
+	memcpy(field, buffer, length);
+	field[length] = 0;
+	char *end;
+	long long value = strtoll(field, &end, base);
+	if (end == field || *end)
+		return -1;
+	return value;
+}
+
+/*
+ * 一条记录占的字节数
+ */
+static off_t record_size(size_t key_length, int value_length) {
+	return kLog_header_size + key_length + value_length;
+}
+
+LogDB::LogDB() : readonly_(false), lock_fd_(-1), active_(0), merging_(false), segment_max_(kSegment_max) {
+	pthread_rwlock_init(&lock_, NULL);
+	memset(&stats_, 0, sizeof(stats_));
+}
+
+LogDB::~LogDB() {
+	_log_free();
+	pthread_rwlock_destroy(&lock_);
+}
+
+bool LogDB::db_open(const string &pathname, int oflag, ...) {
+	if (!pathname.length()){
+		printf("db_open: pathname can not be blank\n");
+		return false;
+	}
+	_log_free();
+	pathname_ = pathname;
+	readonly_ = (oflag & O_ACCMODE) == O_RDONLY;
+	/*
+	 * pathname.lock标志着数据库存在，读写方式打开时还用它加flock
+	 * 只读方式打开不加锁，看到的是打开那一刻的数据
+	 */
+	if (oflag & O_CREAT) {
+		va_list ap;
+		va_start(ap, oflag);
+		int mode = va_arg(ap, int);
+		va_end(ap);
+		lock_fd_ = open((pathname_ + ".lock").c_str(), O_RDWR | O_CREAT, mode);
+	}
+	else
+		lock_fd_ = open((pathname_ + ".lock").c_str(), readonly_ ? O_RDONLY : O_RDWR);
+	if (lock_fd_ < 0) {
+		printf("db_open: open %s.lock error\n", pathname_.c_str());
+		return false;
+	}
+	if (!readonly_ && flock(lock_fd_, LOCK_EX | LOCK_NB) < 0) {
+		printf("db_open: db is opened by another process\n");
+		_log_free();
+		return false;
+	}
+	std::vector<unsigned long long> ids;
+	if (!_log_list_segments(ids)) {
+		_log_free();
+		return false;
+	}
+	if ((oflag & (O_CREAT | O_TRUNC)) == (O_CREAT | O_TRUNC) && !readonly_) {
+		//重新创建数据库，删掉所有的段和hint文件
+		for (size_t i = 0; i < ids.size(); ++i) {
+			unlink(_log_segment_name(ids[i], ".log").c_str());
+			unlink(_log_segment_name(ids[i], ".hint").c_str());
+		}
+		ids.clear();
+	}
+	//按段号从小到大载入，后面的记录覆盖前面的
+	for (size_t i = 0; i < ids.size(); ++i) {
+		int fd = open(_log_segment_name(ids[i], ".log").c_str(), readonly_ ? O_RDONLY : O_RDWR);
+		if (fd < 0) {
+			printf("db_open: open segment %llu error\n", ids[i]);
+			_log_free();
+			return false;
+		}
+		segments_[ids[i]] = Segment{fd, 0, 0};
+		int hint_fd = open(_log_segment_name(ids[i], ".hint").c_str(), O_RDONLY);
+		bool loaded = hint_fd >= 0 ? _log_load_hint(ids[i], hint_fd) : _log_load_segment(ids[i], fd);
+		if (hint_fd >= 0)
+			close(hint_fd);
+		if (!loaded) {
+			_log_free();
+			return false;
+		}
+	}
+	if (readonly_) {
+		active_ = segments_.empty() ? 0 : segments_.rbegin()->first;
+		return true;
+	}
+	//每次打开都从一个新段开始写，旧段都不再修改
+	unsigned long long id = segments_.empty() ? kSegment_step : (segments_.rbegin()->first / kSegment_step + 1) * kSegment_step;
+	if (!_log_open_active(id)) {
+		_log_free();
+		return false;
+	}
+	return true;
+}
+
+void LogDB::db_close() {
+	_log_free();
+}
+
+/*
+ * 释放资源，当前段是空的就直接删掉
+ */
+void LogDB::_log_free() {
+	if (merger_.joinable())
+		merger_.join();
+	if (!readonly_ && segments_.count(active_) && !segments_[active_].size)
+		unlink(_log_segment_name(active_, ".log").c_str());
+	for (auto it = segments_.begin(); it != segments_.end(); ++it)
+		close(it->second.fd);
+	segments_.clear();
+	keydir_.clear();
+	active_ = 0;
+	if (lock_fd_ >= 0)
+		close(lock_fd_);
+	lock_fd_ = -1;
+}
+
+/*
+ * 段文件名，suffix是.log或.hint
+ */
+string LogDB::_log_segment_name(unsigned long long id, const char *suffix) {
+	char name[32];
+	sprintf(name, ".%llu", id);
+	return pathname_ + name + suffix;
+}
+
+/*
+ * 列出pathname所在目录下所有的段，结果按段号排序
+ * 成功返回true，失败返回false
+ */
+bool LogDB::_log_list_segments(std::vector<unsigned long long> &ids) {
+	size_t slash = pathname_.rfind('/');
+	string dir = slash == string::npos ? "." : pathname_.substr(0, slash + 1);
+	string prefix = (slash == string::npos ? pathname_ : pathname_.substr(slash + 1)) + ".";
+	DIR *dp = opendir(dir.c_str());
+	if (!dp) {
+		printf("_log_list_segments: opendir %s error\n", dir.c_str());
+		return false;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(dp))) {
+		string name = entry->d_name;
+		if (name.compare(0, prefix.length(), prefix) || name.length() <= prefix.length() + 4)
+			continue;
+		string number = name.substr(prefix.length(), name.length() - prefix.length() - 4);
+		if (name.compare(name.length() - 4, 4, ".log") || number.find_first_not_of("0123456789") != string::npos)
+			continue;
+		ids.push_back(strtoull(number.c_str(), NULL, 10));
+	}
+	closedir(dp);
+	std::sort(ids.begin(), ids.end());
+	return true;
+}
+
+/*
+ * 扫描一个段文件，把里面的记录加到key目录
+ * 遇到不完整或者校验和不对的记录就停下，这是写到一半时崩溃留下的，读写方式打开时会截断掉
+ * 成功返回true，失败返回false
+ */
+bool LogDB::_log_load_segment(unsigned long long id, int fd) {
+	string buffer;
+	off_t offset = 0, read_offset = 0;
+	size_t position = 0;
+	std::vector<char> chunk(kLog_buffer_size);
+	while (true) {
+		const char *ptr = buffer.data() + position;
+		size_t left = buffer.length() - position;
+		long long key_length = -1, value_length = -1;
+		if (left >= (size_t)kLog_header_size) {
+			key_length = parse_field(ptr, kLog_key_length_size, 10);
+			value_length = parse_field(ptr + kLog_key_length_size, kLog_value_length_size, 10);
+			if (key_length <= 0 || key_length > kLog_key_max || value_length < 0 || value_length >= kData_max)
+				break;
+		}
+		if (key_length < 0 || left < (size_t)record_size(key_length, value_length)) {
+			//数据不够一条完整的记录，再读一块
+			buffer.erase(0, position);
+			position = 0;
+			ssize_t n = pread(fd, &chunk[0], chunk.size(), read_offset);
+			if (n < 0) {
+				printf("_log_load_segment: read error of segment %llu\n", id);
+				return false;
+			}
+			if (!n)
+				break;
+			buffer.append(&chunk[0], n);
+			read_offset += n;
+			continue;
+		}
+		uLong crc = crc32(0L, (const Bytef *)ptr + kLog_header_size, key_length + value_length);
+		if ((long long)crc != parse_field(ptr + kLog_key_length_size + kLog_value_length_size, kLog_crc_size, 16))
+			break;
+		Entry entry = {id, offset, (int)value_length};
+		_log_apply(string(ptr + kLog_header_size, key_length), entry, record_size(key_length, value_length));
+		position += record_size(key_length, value_length);
+		offset += record_size(key_length, value_length);
+	}
+	struct stat statbuff;
+	if (fstat(fd, &statbuff) < 0) {
+		printf("_log_load_segment: fstat error\n");
+		return false;
+	}
+	if (statbuff.st_size != offset) {
+		printf("_log_load_segment: segment %llu has a broken tail at %lld\n", id, (long long)offset);
+		if (!readonly_ && ftruncate(fd, offset) < 0) {
+			printf("_log_load_segment: ftruncate error\n");
+			return false;
+		}
+	}
+	segments_[id].size = offset;
+	return true;
+}
+
+/*
+ * 读取段对应的hint文件，hint记录是key长度+value长度+偏移量+key
+ * hint文件是写完后改名得到的，不会不完整
+ * 成功返回true，失败返回false
+ */
+bool LogDB::_log_load_hint(unsigned long long id, int fd) {
+	string buffer;
+	std::vector<char> chunk(kLog_buffer_size);
+	ssize_t n;
+	while ((n = read(fd, &chunk[0], chunk.size())) > 0)
+		buffer.append(&chunk[0], n);
+	if (n < 0) {
+		printf("_log_load_hint: read error of hint %llu\n", id);
+		return false;
+	}
+	off_t size = 0;
+	for (size_t position = 0; position < buffer.length(); ) {
+		const char *ptr = buffer.data() + position;
+		if (buffer.length() - position < (size_t)kHint_header_size) {
+			printf("_log_load_hint: hint %llu is broken\n", id);
+			return false;
+		}
+		long long key_length = parse_field(ptr, kLog_key_length_size, 10);
+		long long value_length = parse_field(ptr + kLog_key_length_size, kLog_value_length_size, 10);
+		long long offset = parse_field(ptr + kLog_key_length_size + kLog_value_length_size, kLog_offset_size, 10);
+		if (key_length <= 0 || value_length <= 0 || offset < 0 || buffer.length() - position - kHint_header_size < (size_t)key_length) {
+			printf("_log_load_hint: hint %llu is broken\n", id);
+			return false;
+		}
+		Entry entry = {id, offset, (int)value_length};
+		_log_apply(string(ptr + kHint_header_size, key_length), entry, record_size(key_length, value_length));
+		size = std::max(size, (off_t)(offset + record_size(key_length, value_length)));
+		position += kHint_header_size + key_length;
+	}
+	segments_[id].size = size;
+	return true;
+}
+
+/*
+ * 创建一个新的当前段
+ * 成功返回true，失败返回false
+ */
+bool LogDB::_log_open_active(unsigned long long id) {
+	int fd = open(_log_segment_name(id, ".log").c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		printf("_log_open_active: open segment %llu error\n", id);
+		return false;
+	}
+	//旧的当前段是空的就不要了
+	if (segments_.count(active_) && !segments_[active_].size) {
+		close(segments_[active_].fd);
+		unlink(_log_segment_name(active_, ".log").c_str());
+		segments_.erase(active_);
+	}
+	segments_[id] = Segment{fd, 0, 0};
+	active_ = id;
+	return true;
+}
+
+/*
+ * 把一条记录应用到key目录，size是这条记录的大小
+ * 被覆盖的旧记录和墓碑都算作失效的数据
+ */
+void LogDB::_log_apply(const string &key, const Entry &entry, off_t size) {
+	auto it = keydir_.find(key);
+	if (it != keydir_.end()) {
+		auto segment = segments_.find(it->second.segment);
+		if (segment != segments_.end())
+			segment->second.dead += record_size(key.length(), it->second.length);
+	}
+	if (entry.length)
+		keydir_[key] = entry;
+	else {
+		if (it != keydir_.end())
+			keydir_.erase(it);
+		segments_[entry.segment].dead += size;
+	}
+}
+
+/*
+ * 格式化记录头到buffer，value为空表示墓碑
+ * 返回记录头的长度
+ */
+int LogDB::_log_format_header(char *buffer, const string &key, const string &value) {
+	uLong crc = crc32(0L, (const Bytef *)key.data(), key.length());
+	crc = crc32(crc, (const Bytef *)value.data(), value.length());
+	sprintf(buffer, "%*d%*d%0*lx", kLog_key_length_size, (int)key.length(), kLog_value_length_size, (int)value.length(), kLog_crc_size, (unsigned long)crc);
+	return kLog_header_size;
+}
+
+/*
+ * 追加一条记录到当前段，当前段满了就先换一个新段，调用前需要加写锁
+ * 成功返回true，位置写到entry里，失败返回false
+ */
+bool LogDB::_log_append(const string &key, const string &value, Entry &entry) {
+	off_t size = record_size(key.length(), value.length());
+	if (segments_[active_].size + size > segment_max_ && !_log_open_active(active_ + kSegment_step))
+		return false;
+	Segment &segment = segments_[active_];
+	char header[kLog_header_size + 1];
+	_log_format_header(header, key, value);
+	//一次write写完整条记录，都是顺序追加
+	string record;
+	record.reserve(size);
+	record.append(header, kLog_header_size);
+	record.append(key);
+	record.append(value);
+	if (pwrite(segment.fd, record.data(), size, segment.size) != size) {
+		printf("_log_append: write error of segment %llu\n", active_);
+		return false;
+	}
+	entry.segment = active_;
+	entry.offset = segment.size;
+	entry.length = value.length();
+	segment.size += size;
+	return true;
+}
+
+/*
+ * 读取entry指向的value，会检查校验和，调用前需要加锁
+ * 失败返回空string
+ */
+string LogDB::_log_read_value(const Entry &entry) {
+	auto segment = segments_.find(entry.segment);
+	if (segment == segments_.end())
+		return "";
+	char buffer[kLog_header_size + kLog_key_max + kData_max];
+	ssize_t n = pread(segment->second.fd, buffer, sizeof(buffer), entry.offset);
+	if (n < kLog_header_size) {
+		printf("_log_read_value: read error of segment %llu\n", entry.segment);
+		return "";
+	}
+	long long key_length = parse_field(buffer, kLog_key_length_size, 10);
+	if (key_length <= 0 || n < record_size(key_length, entry.length)) {
+		printf("_log_read_value: record is broken\n");
+		return "";
+	}
+	uLong crc = crc32(0L, (const Bytef *)buffer + kLog_header_size, key_length + entry.length);
+	if ((long long)crc != parse_field(buffer + kLog_key_length_size + kLog_value_length_size, kLog_crc_size, 16)) {
+		printf("_log_read_value: checksum mismatch\n");
+		return "";
+	}
+	return string(buffer + kLog_header_size + key_length, entry.length);
+}
+
+string LogDB::db_fetch(const string &key) {
+	LogReadGuard guard(&lock_);
+	auto it = keydir_.find(key);
+	if (it == keydir_.end())
+		return "";
+	return _log_read_value(it->second);
+}
+
+/*
+ * key目录的锁只在进程内，所以只会和本进程的其他线程冲突，比如正在合并的线程
+ */
+int LogDB::db_try_fetch(const string &key, string &value, long long timeout) {
+	value.clear();
+	LogTimedGuard guard(&lock_, false, timeout);
+	if (guard.result()) {
+		if (EBUSY == guard.result() || ETIMEDOUT == guard.result())
+			return kDB_busy;
+		printf("db_try_fetch: lock error\n");
+		return -1;
+	}
+	auto it = keydir_.find(key);
+	if (it == keydir_.end())
+		return 1;
+	value = _log_read_value(it->second);
+	return value.empty() ? -1 : 0;
+}
+
+/*
+ * 只加一次读锁
+ */
+void LogDB::db_multi_fetch(const std::vector<string> &keys, std::vector<string> &values) {
+	values.assign(keys.size(), string());
+	LogReadGuard guard(&lock_);
+	for (size_t i = 0; i < keys.size(); ++i) {
+		auto it = keydir_.find(keys[i]);
+		if (it != keydir_.end())
+			values[i] = _log_read_value(it->second);
+	}
+}
+
+bool LogDB::db_delete(const string &key) {
+	if (readonly_) {
+		printf("db_delete: db is readonly\n");
+		return false;
+	}
+	LogWriteGuard guard(&lock_);
+	if (!keydir_.count(key))
+		return false;
+	//追加一条墓碑记录
+	Entry entry;
+	if (!_log_append(key, "", entry))
+		return false;
+	_log_apply(key, entry, record_size(key.length(), 0));
+	return true;
+}
+
+int LogDB::db_store(const string &key, const string &data, int flag) {
+	return LogDB::db_try_store(key, data, flag, -1);
+}
+
+int LogDB::db_try_store(const string &key, const string &data, int flag, long long timeout) {
+	if (readonly_) {
+		printf("db_store: db is readonly\n");
+		return -1;
+	}
+	if (flag <= STORE_MIN_FLAG || flag >= STORE_MAX_FLAG) {
+		printf("_db_store: flag is invalid\n");
+		return -1;
+	}
+	//长度限制和DB一致
+	int data_length = data.length() + 1;
+	if (data_length < kData_min || data_length > kData_max) {
+		printf("db_store: invalid data length\n");
+		return -1;
+	}
+	if (!key.length() || (int)key.length() > kLog_key_max) {
+		printf("db_store: invalid key length\n");
+		return -1;
+	}
+	LogTimedGuard guard(&lock_, true, timeout);
+	if (guard.result()) {
+		if (EBUSY == guard.result() || ETIMEDOUT == guard.result())
+			return kDB_busy;
+		printf("db_try_store: lock error\n");
+		return -1;
+	}
+	bool can_find = keydir_.count(key);
+	if (can_find && DB_INSERT == flag) {
+		printf("_db_store_insert: key is exist in db\n");
+		return 1;
+	}
+	if (!can_find && DB_REPLACE == flag) {
+		printf("_db_store_replace: db can not find key\n");
+		return -1;
+	}
+	return _log_put(key, data);
+}
+
+/*
+ * 追加一条记录并更新key目录，调用前需要持有写锁
+ * 成功返回0，失败返回-1
+ */
+int LogDB::_log_put(const string &key, const string &data) {
+	Entry entry;
+	if (!_log_append(key, data, entry))
+		return -1;
+	_log_apply(key, entry, record_size(key.length(), data.length()));
+	stats_.raw_bytes += data.length();
+	stats_.stored_bytes += data.length();
+	stats_.raw_records++;
+	return 0;
+}
+
+int LogDB::db_update(const string &key, const std::function<bool(bool, string&)> &modify) {
+	if (readonly_) {
+		printf("db_update: db is readonly\n");
+		return -1;
+	}
+	if (!key.length() || (int)key.length() > kLog_key_max) {
+		printf("db_update: invalid key length\n");
+		return -1;
+	}
+	LogWriteGuard guard(&lock_);
+	auto it = keydir_.find(key);
+	bool can_find = it != keydir_.end();
+	string value;
+	if (can_find && (value = _log_read_value(it->second)).empty())
+		return -1;
+	if (!modify(can_find, value))
+		return 1;
+	int data_length = value.length() + 1;
+	if (data_length < kData_min || data_length > kData_max) {
+		printf("db_update: invalid data length\n");
+		return -1;
+	}
+	return _log_put(key, value);
+}
+
+/*
+ * 批量导入，参数参考DB::db_bulk_load
+ * 记录本来就是顺序追加的，这里只是攒成大块再写，省掉每条记录一次的系统调用
+ */
+bool LogDB::db_bulk_load(const std::function<bool(string&, string&)> &next) {
+	if (readonly_) {
+		printf("db_bulk_load: db is readonly\n");
+		return false;
+	}
+	LogWriteGuard guard(&lock_);
+	if (!keydir_.empty() || segments_.size() != 1 || segments_[active_].size) {
+		printf("db_bulk_load: db is not empty\n");
+		return false;
+	}
+	string key, data, last_key, buffer;
+	char header[kLog_header_size + 1];
+	std::vector<std::pair<string, Entry> > entries;
+	bool result = true;
+	buffer.reserve(kLog_buffer_size);
+	for (bool first = true; next(key, data); first = false) {
+		if (!first && key <= last_key) {
+			printf("db_bulk_load: keys are not strictly increasing\n");
+			result = false;
+			break;
+		}
+		int data_length = data.length() + 1;
+		if (data_length < kData_min || data_length > kData_max || !key.length() || (int)key.length() > kLog_key_max) {
+			printf("db_bulk_load: invalid key or data length\n");
+			result = false;
+			break;
+		}
+		off_t size = record_size(key.length(), data.length());
+		if (segments_[active_].size + buffer.length() + size > segment_max_) {
+			//当前段写满了，先把缓冲区写出去再换段
+			if (!_log_write_all(segments_[active_].fd, buffer)) {
+				result = false;
+				break;
+			}
+			segments_[active_].size += buffer.length();
+			buffer.clear();
+			if (!_log_open_active(active_ + kSegment_step)) {
+				result = false;
+				break;
+			}
+		}
+		Entry entry = {active_, segments_[active_].size + (off_t)buffer.length(), (int)data.length()};
+		_log_format_header(header, key, data);
+		buffer.append(header, kLog_header_size);
+		buffer.append(key);
+		buffer.append(data);
+		entries.push_back(std::make_pair(key, entry));
+		if (buffer.length() >= kLog_buffer_size) {
+			if (!_log_write_all(segments_[active_].fd, buffer)) {
+				result = false;
+				break;
+			}
+			segments_[active_].size += buffer.length();
+			buffer.clear();
+		}
+		last_key.swap(key);
+	}
+	if (result && !buffer.empty()) {
+		result = _log_write_all(segments_[active_].fd, buffer);
+		segments_[active_].size += buffer.length();
+	}
+	if (!result) {
+		//失败时删掉写过的段，恢复成空库
+		for (auto it = segments_.begin(); it != segments_.end(); ++it) {
+			close(it->second.fd);
+			unlink(_log_segment_name(it->first, ".log").c_str());
+		}
+		segments_.clear();
+		active_ = 0;
+		_log_open_active(kSegment_step);
+		return false;
+	}
+	for (size_t i = 0; i < entries.size(); ++i)
+		keydir_[entries[i].first] = entries[i].second;
+	stats_.raw_records += entries.size();
+	return true;
+}
+
+/*
+ * 把buffer追加写到fd的结尾
+ * 成功返回true，失败返回false
+ */
+bool LogDB::_log_write_all(int fd, const string &buffer) {
+	const char *ptr = buffer.data();
+	size_t left = buffer.length();
+	off_t offset = lseek(fd, 0, SEEK_END);
+	while (left) {
+		ssize_t n = pwrite(fd, ptr, left, offset);
+		if (n <= 0) {
+			printf("_log_write_all: write error\n");
+			return false;
+		}
+		ptr += n;
+		left -= n;
+		offset += n;
+	}
+	return true;
+}
+
+bool LogDB::db_snapshot(const string &pathname, DB &snapshot) {
+	if (!pathname.length() || pathname == pathname_) {
+		printf("db_snapshot: invalid snapshot pathname\n");
+		return false;
+	}
+	{
+		LogWriteGuard guard(&lock_);
+		//换一个新段，之后所有已有的段都不会再被修改
+		if (!readonly_ && segments_[active_].size && !_log_open_active(active_ + kSegment_step))
+			return false;
+		int fd = open((pathname + ".lock").c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+		if (fd < 0) {
+			printf("db_snapshot: open %s.lock error\n", pathname.c_str());
+			return false;
+		}
+		close(fd);
+		for (auto it = segments_.begin(); it != segments_.end(); ++it) {
+			if (it->first == active_ && !readonly_)
+				continue;
+			char name[32];
+			sprintf(name, ".%llu", it->first);
+			if (link(_log_segment_name(it->first, ".log").c_str(), (pathname + name + ".log").c_str()) < 0) {
+				printf("db_snapshot: link segment %llu error\n", it->first);
+				return false;
+			}
+			//hint文件可能不存在
+			link(_log_segment_name(it->first, ".hint").c_str(), (pathname + name + ".hint").c_str());
+		}
+	}
+	return snapshot.db_open(pathname, O_RDONLY);
+}
+
+bool LogDB::db_train_dictionary(const std::vector<string> &) {
+	printf("db_train_dictionary: LogDB does not support compression\n");
+	return false;
+}
+
+DBStats LogDB::db_stats() {
+	LogReadGuard guard(&lock_);
+	DBStats stats = stats_;
+	stats.compression_ratio = 1.0;
+	return stats;
+}
+
+/*
+ * 遍历key目录，遍历期间持有读锁
+ */
+bool LogDB::db_scan(const std::function<bool(const string&, const string&)> &visit) {
+	LogReadGuard guard(&lock_);
+	for (auto it = keydir_.begin(); it != keydir_.end(); ++it) {
+		string value = _log_read_value(it->second);
+		if (value.empty())
+			return false;
+		if (!visit(it->first, value))
+			return true;
+	}
+	return true;
+}
+
+double LogDB::db_dead_ratio() {
+	LogReadGuard guard(&lock_);
+	off_t size = 0, dead = 0;
+	for (auto it = segments_.begin(); it != segments_.end(); ++it) {
+		size += it->second.size;
+		dead += it->second.dead;
+	}
+	return size ? (double)dead / size : 0.0;
+}
+
+void LogDB::db_set_segment_size(off_t size) {
+	LogWriteGuard guard(&lock_);
+	if (size > 0)
+		segment_max_ = size;
+}
+
+bool LogDB::db_merge_background() {
+	{
+		LogReadGuard guard(&lock_);
+		if (merging_ || readonly_)
+			return false;
+	}
+	if (merger_.joinable())
+		merger_.join();
+	merger_ = std::thread([this]() { db_merge(); });
+	return true;
+}
+
+/*
+ * 合并分三步
+ * 1. 加写锁换一个新段，之前的段就是这次合并的输入，它们不会再被修改
+ * 2. 不加写锁，顺序扫描输入段，key目录还指向的记录才写到新段，新段的段号比输入段大，比当前段小
+ * 3. 加写锁更新key目录，合并期间又被改写过的key保持不变，然后从旧到新删除输入段
+ * 任何时候崩溃，重新打开时看到的数据都是对的：新段覆盖输入段，当前段覆盖新段
+ * 输入段从旧到新删除，这样墓碑总是比它删掉的value后删
+ */
+bool LogDB::db_merge() {
+	std::vector<unsigned long long> inputs;
+	{
+		LogWriteGuard guard(&lock_);
+		if (readonly_ || merging_) {
+			printf("db_merge: db is readonly or merging\n");
+			return false;
+		}
+		if (segments_[active_].size && !_log_open_active(active_ + kSegment_step))
+			return false;
+		for (auto it = segments_.begin(); it != segments_.end(); ++it)
+			if (it->first != active_)
+				inputs.push_back(it->first);
+		if (inputs.empty())
+			return true;
+		merging_ = true;
+	}
+	std::vector<Moved> moved;
+	std::vector<unsigned long long> outputs;
+	bool result = _log_merge_segments(inputs, moved, outputs);
+	LogWriteGuard guard(&lock_);
+	merging_ = false;
+	if (!result) {
+		for (size_t i = 0; i < outputs.size(); ++i) {
+			unlink(_log_segment_name(outputs[i], ".log").c_str());
+			unlink(_log_segment_name(outputs[i], ".hint").c_str());
+		}
+		return false;
+	}
+	for (size_t i = 0; i < outputs.size(); ++i) {
+		int fd = open(_log_segment_name(outputs[i], ".log").c_str(), O_RDWR);
+		struct stat statbuff;
+		if (fd < 0 || fstat(fd, &statbuff) < 0) {
+			printf("db_merge: open segment %llu error\n", outputs[i]);
+			return false;
+		}
+		segments_[outputs[i]] = Segment{fd, statbuff.st_size, 0};
+	}
+	for (size_t i = 0; i < moved.size(); ++i) {
+		const Moved &record = moved[i];
+		auto it = keydir_.find(record.key);
+		if (it != keydir_.end() && it->second.segment == record.from.segment && it->second.offset == record.from.offset)
+			it->second = record.to;
+		else
+			segments_[record.to.segment].dead += record_size(record.key.length(), record.to.length);
+	}
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		close(segments_[inputs[i]].fd);
+		segments_.erase(inputs[i]);
+		unlink(_log_segment_name(inputs[i], ".log").c_str());
+		unlink(_log_segment_name(inputs[i], ".hint").c_str());
+	}
+	return true;
+}
+
+/*
+ * 合并的第二步，把输入段里存活的记录写到新段，并写好hint文件
+ * moved按写入的顺序记下每条搬过的记录原来的位置，outputs是新段的段号
+ * 成功返回true，失败返回false
+ */
+bool LogDB::_log_merge_segments(const std::vector<unsigned long long> &inputs, std::vector<Moved> &moved, std::vector<unsigned long long> &outputs) {
+	unsigned long long id = inputs.back();
+	int out_fd = -1;
+	off_t out_size = 0;
+	size_t hint_begin = 0;
+	string buffer;
+	std::vector<char> chunk(kLog_buffer_size);
+	bool result = true;
+	for (size_t i = 0; result && i < inputs.size(); ++i) {
+		int fd;
+		off_t size;
+		{
+			LogReadGuard guard(&lock_);
+			fd = segments_[inputs[i]].fd;
+			size = segments_[inputs[i]].size;
+		}
+		string input;
+		off_t offset = 0, read_offset = 0;
+		size_t position = 0;
+		while (offset < size) {
+			const char *ptr = input.data() + position;
+			size_t left = input.length() - position;
+			long long key_length = -1, value_length = -1;
+			if (left >= (size_t)kLog_header_size) {
+				key_length = parse_field(ptr, kLog_key_length_size, 10);
+				value_length = parse_field(ptr + kLog_key_length_size, kLog_value_length_size, 10);
+			}
+			if (key_length < 0 || left < (size_t)record_size(key_length, value_length)) {
+				input.erase(0, position);
+				position = 0;
+				ssize_t n = pread(fd, &chunk[0], std::min((off_t)chunk.size(), size - read_offset), read_offset);
+				if (n <= 0) {
+					printf("_log_merge_segments: read error of segment %llu\n", inputs[i]);
+					result = false;
+					break;
+				}
+				input.append(&chunk[0], n);
+				read_offset += n;
+				continue;
+			}
+			off_t length = record_size(key_length, value_length);
+			string key(ptr + kLog_header_size, key_length);
+			bool live = false;
+			if (value_length) {
+				LogReadGuard guard(&lock_);
+				auto it = keydir_.find(key);
+				live = it != keydir_.end() && it->second.segment == inputs[i] && it->second.offset == offset;
+			}
+			if (live) {
+				if (out_fd < 0 || out_size + buffer.length() + length > segment_max_) {
+					//换一个新的输出段，之前的段写完后生成hint文件
+					if (out_fd >= 0) {
+						bool ok = _log_write_all(out_fd, buffer) && !fsync(out_fd);
+						close(out_fd);
+						out_fd = -1;
+						buffer.clear();
+						if (!ok || !_log_write_hint(outputs.back(), moved, hint_begin, moved.size())) {
+							result = false;
+							break;
+						}
+						hint_begin = moved.size();
+					}
+					out_fd = open(_log_segment_name(++id, ".log").c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+					if (out_fd < 0) {
+						printf("_log_merge_segments: open segment %llu error\n", id);
+						result = false;
+						break;
+					}
+					outputs.push_back(id);
+					out_size = 0;
+				}
+				Entry to = {id, out_size + (off_t)buffer.length(), (int)value_length};
+				moved.push_back(Moved{key, Entry{inputs[i], offset, (int)value_length}, to});
+				buffer.append(ptr, length);
+				if (buffer.length() >= kLog_buffer_size) {
+					if (!_log_write_all(out_fd, buffer)) {
+						result = false;
+						break;
+					}
+					out_size += buffer.length();
+					buffer.clear();
+				}
+			}
+			position += length;
+			offset += length;
+		}
+	}
+	if (out_fd >= 0) {
+		if (result)
+			result = _log_write_all(out_fd, buffer) && !fsync(out_fd) && _log_write_hint(outputs.back(), moved, hint_begin, moved.size());
+		close(out_fd);
+	}
+	return result;
+}
+
+/*
+ * 为合并出来的段写hint文件，moved中[begin, end)的记录在这个段里，按顺序排列
+ * 先写临时文件再改名，hint文件要么不存在要么是完整的
+ * 成功返回true，失败返回false
+ */
+bool LogDB::_log_write_hint(unsigned long long id, const std::vector<Moved> &moved, size_t begin, size_t end) {
+	string buffer;
+	char header[kHint_header_size + 1];
+	for (size_t i = begin; i < end; ++i) {
+		const Moved &record = moved[i];
+		sprintf(header, "%*d%*d%*lld", kLog_key_length_size, (int)record.key.length(), kLog_value_length_size, record.to.length, kLog_offset_size, (long long)record.to.offset);
+		buffer.append(header, kHint_header_size);
+		buffer.append(record.key);
+	}
+	string name = _log_segment_name(id, ".hint");
+	int fd = open((name + ".tmp").c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		printf("_log_write_hint: open hint %llu error\n", id);
+		return false;
+	}
+	bool result = _log_write_all(fd, buffer) && !fsync(fd);
+	close(fd);
+	if (!result || rename((name + ".tmp").c_str(), name.c_str()) < 0) {
+		printf("_log_write_hint: write hint %llu error\n", id);
+		unlink((name + ".tmp").c_str());
+		return false;
+	}
+	return true;
+}
+
+bool LogDB::db_dump(int fd, int) {
+	return _db_dump_scan(fd);
+}
+
+bool LogDB::db_restore(int fd, long long &sequence) {
+	return _db_restore_read(fd, sequence, [this](string &key, string &value) {
+		return !db_store(key, value, DB_INSERT);
+	});
+}
+
+bool LogDB::db_change_log() {
+	printf("db_change_log: change log is not supported\n");
+	return false;
+}
+
+}
@@ -0,0 +1,545 @@
+#include "../include/v_mem_db.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+const int kMem_key_max = vDB::kIndex_max - vDB::kIndex_min + 1;   //key的最大长度，和DB保持一致
+const size_t kTable_min = 1024;          //hash表的初始槽数
+const size_t kSlab_size = 1 << 20;       //每个slab的大小
+const int kLevel_min = 16;               //最小的记录容量，容量从这里开始按1.25倍增长
+const int kLevel_align = 8;              //记录容量按8字节对齐
+
+namespace vDB {
+
+MemDB::MemDB()
+	:	readonly_(false),
+		table_(nullptr),
+		capacity_(0),
+		size_(0),
+		slab_ptr_(nullptr),
+		slab_left_(0),
+		saver_(-1),
+		save_interval_(0),
+		last_save_(0)
+{
+	memset(&stats_, 0, sizeof(stats_));
+	//记录的最大容量是记录头加上最长的key和value
+	int level_max = (sizeof(Record) + kMem_key_max + kData_max + kLevel_align - 1) / kLevel_align * kLevel_align;
+	for (int capacity = kLevel_min; ; capacity += (capacity / 4 + kLevel_align - 1) / kLevel_align * kLevel_align) {
+		levels_.push_back(std::min(capacity, level_max));
+		if (capacity >= level_max)
+			break;
+	}
+	free_.assign(levels_.size(), nullptr);
+}
+
+MemDB::~MemDB() {
+	_mem_free();
+}
+
+bool MemDB::db_open(const string &pathname, int oflag, ...) {
+	_mem_free();
+	pathname_ = pathname;
+	readonly_ = false;
+	last_save_ = time(NULL);
+	if (!_mem_grow())
+		return false;
+	//载入快照，写入的统计不算在内
+	if (pathname_.length() && !(oflag & O_TRUNC) && !access((pathname_ + ".idx").c_str(), F_OK)) {
+		DB snapshot;
+		if (!snapshot.db_open(pathname_, O_RDONLY)) {
+			printf("db_open: open snapshot %s error\n", pathname_.c_str());
+			return false;
+		}
+		//载入时不能触发自动保存，否则后台进程会把只载入了一半的表写回快照
+		bool result = snapshot.db_scan([this](const string &key, const string &value) {
+			return 0 == _mem_store(key, value, DB_INSERT);
+		});
+		if (!result) {
+			printf("db_open: load snapshot %s error\n", pathname_.c_str());
+			_mem_free();
+			return false;
+		}
+		memset(&stats_, 0, sizeof(stats_));
+		last_save_ = time(NULL);
+	}
+	readonly_ = (oflag & O_ACCMODE) == O_RDONLY;
+	return true;
+}
+
+void MemDB::db_close() {
+	_mem_free();
+}
+
+/*
+ * 释放所有的slab和hash表，之后可以重新open
+ */
+void MemDB::_mem_free() {
+	_mem_reap(true);
+	for (size_t i = 0; i < slabs_.size(); ++i)
+		delete[] slabs_[i];
+	slabs_.clear();
+	if (table_)
+		delete[] table_;
+	table_ = nullptr;
+	capacity_ = size_ = 0;
+	slab_ptr_ = nullptr;
+	slab_left_ = 0;
+	free_.assign(levels_.size(), nullptr);
+}
+
+/*
+ * FNV-1a，再混合一下高位，开放寻址只用低位
+ */
+uint64_t MemDB::_mem_hash(const char *key, size_t length) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= (unsigned char)key[i];
+		hash *= 1099511628211ULL;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/*
+ * 线性探测查找key
+ * 找到返回所在的槽，找不到返回探测到的第一个空槽，可以直接插入
+ */
+size_t MemDB::_mem_find(const string &key, uint64_t hash) {
+	size_t mask = capacity_ - 1;
+	for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+		Record *record = table_[i].record;
+		if (!record)
+			return i;
+		if (table_[i].hash == hash && record->key_length == key.length() && !memcmp(record + 1, key.data(), key.length()))
+			return i;
+	}
+}
+
+/*
+ * hash表扩大一倍，只搬指针，记录本身不动
+ * 成功返回true，失败返回false
+ */
+bool MemDB::_mem_grow() {
+	size_t capacity = capacity_ ? capacity_ * 2 : kTable_min;
+	Slot *table = new (std::nothrow) Slot[capacity];
+	if (!table) {
+		printf("_mem_grow: malloc error for hash table\n");
+		return false;
+	}
+	memset(table, 0, capacity * sizeof(Slot));
+	for (size_t i = 0; i < capacity_; ++i) {
+		if (!table_[i].record)
+			continue;
+		size_t j = table_[i].hash & (capacity - 1);
+		while (table[j].record)
+			j = (j + 1) & (capacity - 1);
+		table[j] = table_[i];
+	}
+	if (table_)
+		delete[] table_;
+	table_ = table;
+	capacity_ = capacity;
+	return true;
+}
+
+/*
+ * 返回放得下length字节的最小级别
+ */
+int MemDB::_mem_level(size_t length) {
+	return std::lower_bound(levels_.begin(), levels_.end(), (int)length) - levels_.begin();
+}
+
+/*
+ * 分配一个level级别的记录，优先用空闲链表，没有就从当前slab切
+ * 失败返回nullptr
+ */
+MemDB::Record* MemDB::_mem_alloc(int level) {
+	Record *record = free_[level];
+	if (record) {
+		memcpy(&free_[level], record, sizeof(Record*));
+		record->level = level;
+		return record;
+	}
+	size_t capacity = levels_[level];
+	if (slab_left_ < capacity) {
+		//当前slab剩下的一点空间不要了
+		char *slab = new (std::nothrow) char[kSlab_size];
+		if (!slab) {
+			printf("_mem_alloc: malloc error for slab\n");
+			return nullptr;
+		}
+		slabs_.push_back(slab);
+		slab_ptr_ = slab;
+		slab_left_ = kSlab_size;
+	}
+	record = (Record *)slab_ptr_;
+	slab_ptr_ += capacity;
+	slab_left_ -= capacity;
+	record->level = level;
+	return record;
+}
+
+/*
+ * 把记录挂到对应级别的空闲链表上
+ */
+void MemDB::_mem_release(Record *record) {
+	int level = record->level;
+	memcpy(record, &free_[level], sizeof(Record*));
+	free_[level] = record;
+}
+
+MemDB::Record* MemDB::_mem_make_record(const string &key, const string &value) {
+	Record *record = _mem_alloc(_mem_level(sizeof(Record) + key.length() + value.length()));
+	if (!record)
+		return nullptr;
+	record->key_length = key.length();
+	record->value_length = value.length();
+	memcpy(record + 1, key.data(), key.length());
+	memcpy((char *)(record + 1) + key.length(), value.data(), value.length());
+	return record;
+}
+
+/*
+ * 删除第index个槽，后面同一串里的槽往前移，这样不需要墓碑
+ */
+void MemDB::_mem_erase(size_t index) {
+	size_t mask = capacity_ - 1;
+	size_t j = index;
+	while (true) {
+		table_[index].record = nullptr;
+		while (true) {
+			j = (j + 1) & mask;
+			if (!table_[j].record)
+				return;
+			//j上的记录原本应该在的位置落在(index, j]里就不用动
+			size_t home = table_[j].hash & mask;
+			if (index <= j ? (index < home && home <= j) : (index < home || home <= j))
+				continue;
+			break;
+		}
+		table_[index] = table_[j];
+		index = j;
+	}
+}
+
+string MemDB::db_fetch(const string &key) {
+	if (!table_)
+		return "";
+	Record *record = table_[_mem_find(key, _mem_hash(key.data(), key.length()))].record;
+	if (!record)
+		return "";
+	return string((char *)(record + 1) + record->key_length, record->value_length);
+}
+
+int MemDB::db_try_fetch(const string &key, string &value, long long) {
+	if (!table_)
+		return -1;
+	value = db_fetch(key);
+	return value.empty() ? 1 : 0;
+}
+
+int MemDB::db_try_store(const string &key, const string &data, int flag, long long) {
+	return db_store(key, data, flag);
+}
+
+void MemDB::db_multi_fetch(const std::vector<string> &keys, std::vector<string> &values) {
+	values.resize(keys.size());
+	for (size_t i = 0; i < keys.size(); ++i)
+		values[i] = db_fetch(keys[i]);
+}
+
+bool MemDB::db_delete(const string &key) {
+	if (readonly_ || !table_) {
+		printf("db_delete: db is readonly or not opened\n");
+		return false;
+	}
+	size_t index = _mem_find(key, _mem_hash(key.data(), key.length()));
+	if (!table_[index].record)
+		return false;
+	_mem_release(table_[index].record);
+	_mem_erase(index);
+	--size_;
+	_mem_auto_save();
+	return true;
+}
+
+int MemDB::db_store(const string &key, const string &data, int flag) {
+	int result = _mem_store(key, data, flag);
+	if (!result)
+		_mem_auto_save();
+	return result;
+}
+
+/*
+ * db_store去掉自动保存，载入快照和批量导入时用，整个表写完之后才能保存
+ */
+int MemDB::_mem_store(const string &key, const string &data, int flag) {
+	if (readonly_ || !table_) {
+		printf("db_store: db is readonly or not opened\n");
+		return -1;
+	}
+	if (flag <= STORE_MIN_FLAG || flag >= STORE_MAX_FLAG) {
+		printf("_db_store: flag is invalid\n");
+		return -1;
+	}
+	//长度限制和DB一致，这样总能保存成快照
+	int data_length = data.length() + 1;
+	if (data_length < kData_min || data_length > kData_max) {
+		printf("db_store: invalid data length\n");
+		return -1;
+	}
+	if (!key.length() || (int)key.length() > kMem_key_max) {
+		printf("db_store: invalid key length\n");
+		return -1;
+	}
+	uint64_t hash = _mem_hash(key.data(), key.length());
+	size_t index = _mem_find(key, hash);
+	Record *record = table_[index].record;
+	if (record && DB_INSERT == flag) {
+		printf("_db_store_insert: key is exist in db\n");
+		return 1;
+	}
+	if (!record && DB_REPLACE == flag) {
+		printf("_db_store_replace: db can not find key\n");
+		return -1;
+	}
+	if (record && sizeof(Record) + key.length() + data.length() <= (size_t)levels_[record->level]) {
+		//原来的记录放得下就原地改写
+		record->value_length = data.length();
+		memcpy((char *)(record + 1) + key.length(), data.data(), data.length());
+	}
+	else if (record) {
+		Record *replace = _mem_make_record(key, data);
+		if (!replace)
+			return -1;
+		_mem_release(record);
+		table_[index].record = replace;
+	}
+	else {
+		//装载因子超过3/4就扩大
+		if ((size_ + 1) * 4 > capacity_ * 3) {
+			if (!_mem_grow())
+				return -1;
+			index = _mem_find(key, hash);
+		}
+		if (!(record = _mem_make_record(key, data)))
+			return -1;
+		table_[index].hash = hash;
+		table_[index].record = record;
+		++size_;
+	}
+	stats_.raw_bytes += data.length();
+	stats_.stored_bytes += data.length();
+	stats_.raw_records++;
+	return 0;
+}
+
+/*
+ * MemDB本来就是单线程使用的，不需要加锁，修改后直接交给db_store
+ */
+int MemDB::db_update(const string &key, const std::function<bool(bool, string&)> &modify) {
+	if (readonly_ || !table_) {
+		printf("db_update: db is readonly or not opened\n");
+		return -1;
+	}
+	Record *record = table_[_mem_find(key, _mem_hash(key.data(), key.length()))].record;
+	string value;
+	if (record)
+		value.assign((char *)(record + 1) + record->key_length, record->value_length);
+	if (!modify(record, value))
+		return 1;
+	return db_store(key, value, DB_STORE);
+}
+
+/*
+ * 参数参考DB::db_bulk_load，只是依次插入，失败时清空所有记录
+ */
+bool MemDB::db_bulk_load(const std::function<bool(string&, string&)> &next) {
+	if (readonly_ || !table_ || size_) {
+		printf("db_bulk_load: db is readonly or not empty\n");
+		return false;
+	}
+	string key, data, last_key;
+	for (bool first = true; next(key, data); first = false) {
+		if ((!first && key <= last_key) || _mem_store(key, data, DB_INSERT)) {
+			printf("db_bulk_load: keys are not strictly increasing or store error\n");
+			string pathname = pathname_;
+			_mem_free();
+			pathname_ = pathname;
+			_mem_grow();
+			return false;
+		}
+		last_key.swap(key);
+	}
+	_mem_auto_save();
+	return true;
+}
+
+/*
+ * 写快照后以只读方式打开，第二个参数一般是DB
+ */
+bool MemDB::db_snapshot(const string &pathname, DB &snapshot) {
+	if (!pathname.length() || !_mem_write_snapshot(pathname))
+		return false;
+	return snapshot.db_open(pathname, O_RDONLY);
+}
+
+bool MemDB::db_train_dictionary(const std::vector<string> &) {
+	printf("db_train_dictionary: MemDB does not support compression\n");
+	return false;
+}
+
+DBStats MemDB::db_stats() {
+	DBStats stats = stats_;
+	stats.compression_ratio = 1.0;
+	return stats;
+}
+
+bool MemDB::db_scan(const std::function<bool(const string&, const string&)> &visit) {
+	for (size_t i = 0; i < capacity_; ++i) {
+		Record *record = table_[i].record;
+		if (!record)
+			continue;
+		const char *key = (const char *)(record + 1);
+		if (!visit(string(key, record->key_length), string(key + record->key_length, record->value_length)))
+			return true;
+	}
+	return true;
+}
+
+/*
+ * 把所有记录按key排好序后用DB的批量导入写成快照
+ * 先写到pathname.tmp，成功后再改名，改名前旧的快照一直是完整的
+ * 成功返回true，失败返回false
+ */
+bool MemDB::_mem_write_snapshot(const string &pathname) {
+	std::vector<Record*> records;
+	records.reserve(size_);
+	for (size_t i = 0; i < capacity_; ++i)
+		if (table_[i].record)
+			records.push_back(table_[i].record);
+	//和string的比较规则一致，按字节比较，前缀短的在前
+	std::sort(records.begin(), records.end(), [](const Record *a, const Record *b) {
+		int result = memcmp(a + 1, b + 1, std::min(a->key_length, b->key_length));
+		return result ? result < 0 : a->key_length < b->key_length;
+	});
+	string temp = pathname + ".tmp";
+	DB snapshot;
+	if (!snapshot.db_open(temp, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) {
+		printf("_mem_write_snapshot: open %s error\n", temp.c_str());
+		return false;
+	}
+	size_t i = 0;
+	bool result = snapshot.db_bulk_load([&](string &key, string &value) {
+		if (i == records.size())
+			return false;
+		const char *ptr = (const char *)(records[i] + 1);
+		key.assign(ptr, records[i]->key_length);
+		value.assign(ptr + records[i]->key_length, records[i]->value_length);
+		++i;
+		return true;
+	});
+	snapshot.db_close();
+	//.idx最后改名，没有.idx的快照不会被载入
+	if (!result || rename((temp + ".dat").c_str(), (pathname + ".dat").c_str()) < 0 || rename((temp + ".idx").c_str(), (pathname + ".idx").c_str()) < 0) {
+		printf("_mem_write_snapshot: write snapshot %s error\n", pathname.c_str());
+		unlink((temp + ".idx").c_str());
+		unlink((temp + ".dat").c_str());
+		return false;
+	}
+	return true;
+}
+
+bool MemDB::db_save() {
+	if (!pathname_.length()) {
+		printf("db_save: no snapshot pathname\n");
+		return false;
+	}
+	last_save_ = time(NULL);
+	return _mem_write_snapshot(pathname_);
+}
+
+/*
+ * 子进程继承了fork那一刻的内存，由内核负责写时复制
+ */
+bool MemDB::db_save_background() {
+	_mem_reap(false);
+	if (!pathname_.length() || saver_ != -1) {
+		printf("db_save_background: no snapshot pathname or saving\n");
+		return false;
+	}
+	//先清空stdout的缓冲区，不然子进程会再输出一遍
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		printf("db_save_background: fork error\n");
+		return false;
+	}
+	if (!pid) {
+		bool result = _mem_write_snapshot(pathname_);
+		fflush(stdout);
+		_exit(result ? 0 : 1);
+	}
+	saver_ = pid;
+	last_save_ = time(NULL);
+	return true;
+}
+
+void MemDB::db_set_save_interval(int seconds) {
+	save_interval_ = seconds;
+}
+
+/*
+ * 回收后台保存的子进程，wait为true时阻塞等待它结束
+ */
+void MemDB::_mem_reap(bool wait) {
+	if (-1 == saver_)
+		return;
+	int status;
+	pid_t pid = waitpid(saver_, &status, wait ? 0 : WNOHANG);
+	if (!pid)
+		return;
+	if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		printf("_mem_reap: background save failed\n");
+	saver_ = -1;
+}
+
+/*
+ * 写操作之后调用，到了间隔就在后台保存
+ */
+void MemDB::_mem_auto_save() {
+	if (save_interval_ <= 0 || !pathname_.length() || time(NULL) - last_save_ < save_interval_)
+		return;
+	_mem_reap(false);
+	if (-1 == saver_)
+		db_save_background();
+}
+
+bool MemDB::db_dump(int fd, int) {
+	return _db_dump_scan(fd);
+}
+
+bool MemDB::db_restore(int fd, long long &sequence) {
+	bool result = _db_restore_read(fd, sequence, [this](string &key, string &value) {
+		return !_mem_store(key, value, DB_INSERT);
+	});
+	if (result)
+		_mem_auto_save();
+	return result;
+}
+
+bool MemDB::db_change_log() {
+	printf("db_change_log: change log is not supported\n");
+	return false;
+}
+
+}
@@ -0,0 +1,695 @@
+#include "../include/v_page_db.h"
+#include "../include/record_lock.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const off_t kPage_size = 4096;           //index页的大小
+const int kPage_slots = 240;             //每页的槽数，16字节页头+240字节指纹+240个16字节的槽正好一页
+const uint32_t kPage_buckets = 4096;     //新建数据库时hash桶的个数，约一百万条记录以内不会有溢出页
+const char kPage_magic[8] = "vDBPAGE";   //文件头的标志
+const int kPage_record_header = 8;       //data记录头的大小，key长度和value长度各4字节
+const int kPage_key_max = vDB::kIndex_max - vDB::kIndex_min + 1;   //key的最大长度，和DB保持一致
+const size_t kPage_buffer_size = 1 << 20;   //批量导入时的写缓冲区大小
+
+namespace vDB {
+
+/*
+ * 第0页开头的文件头
+ */
+struct PageDB::Header {
+	char magic[8];
+	uint32_t page_size;       //页的大小，打开时检查
+	uint32_t bucket_count;    //hash桶的个数，创建后不再改变
+	uint64_t page_count;      //页的总数，包括文件头和溢出页，分配溢出页时加1
+};
+
+/*
+ * 页里的一个槽，指向.pdat里的一条记录
+ */
+struct PageDB::Slot {
+	uint64_t offset;          //记录在.pdat中的偏移量
+	uint16_t key_length;      //key的长度，比较key之前先比较长度
+	uint16_t reserved;
+	uint32_t value_length;    //value的长度
+};
+
+/*
+ * 一个index页，指纹和槽一一对应，前count个有效
+ * 指纹单独连续存放，这样可以16个一组用SIMD比较
+ */
+struct PageDB::Page {
+	uint16_t count;                       //有效的槽数
+	uint16_t reserved;
+	uint32_t reserved2;
+	uint64_t overflow;                    //下一个溢出页的页号，0表示没有
+	uint8_t fingerprints[kPage_slots];    //key的指纹
+	Slot slots[kPage_slots];
+};
+
+PageDB::PageDB() : readonly_(false), index_fd_(-1), data_fd_(-1), bucket_count_(0), bucket_init_(kPage_buckets) {
+	static_assert(sizeof(Page) == kPage_size, "page layout must fill exactly one page");
+	memset(&stats_, 0, sizeof(stats_));
+}
+
+PageDB::~PageDB() {
+	_page_free();
+}
+
+void PageDB::_page_free() {
+	if (index_fd_ >= 0)
+		close(index_fd_);
+	if (data_fd_ >= 0)
+		close(data_fd_);
+	index_fd_ = data_fd_ = -1;
+	bucket_count_ = 0;
+}
+
+bool PageDB::db_open(const string &pathname, int oflag, ...) {
+	if (!pathname.length()){
+		printf("db_open: pathname can not be blank\n");
+		return false;
+	}
+	_page_free();
+	pathname_ = pathname;
+	readonly_ = (oflag & O_ACCMODE) == O_RDONLY;
+	if (oflag & O_CREAT) {
+		va_list ap;
+		va_start(ap, oflag);
+		int mode = va_arg(ap, int);
+		va_end(ap);
+		index_fd_ = open((pathname_ + ".pidx").c_str(), oflag, mode);
+		data_fd_ = open((pathname_ + ".pdat").c_str(), oflag, mode);
+	}
+	else {
+		index_fd_ = open((pathname_ + ".pidx").c_str(), oflag);
+		data_fd_ = open((pathname_ + ".pdat").c_str(), oflag);
+	}
+	if (index_fd_ < 0 || data_fd_ < 0) {
+		_page_free();
+		return false;
+	}
+	if (!readonly_) {
+		//文件为空就初始化，写锁住整个文件，防止两个进程同时初始化
+		RecordWritewLock writew_lock(index_fd_, 0, SEEK_SET, 0);
+		struct stat statbuff;
+		if (!writew_lock.locked() || fstat(index_fd_, &statbuff) < 0) {
+			printf("db_open: fstat error\n");
+			_page_free();
+			return false;
+		}
+		if (!statbuff.st_size) {
+			//hash桶的页都是空的，直接ftruncate出空洞就行
+			Header header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.magic, kPage_magic, sizeof(header.magic));
+			header.page_size = kPage_size;
+			header.bucket_count = bucket_init_;
+			header.page_count = bucket_init_ + 1;
+			if (ftruncate(index_fd_, (off_t)(bucket_init_ + 1) * kPage_size) < 0 || pwrite(index_fd_, &header, sizeof(header), 0) != sizeof(header)) {
+				printf("db_open: index file init write error\n");
+				_page_free();
+				return false;
+			}
+		}
+	}
+	//文件头里除了页数都不会再改变，不需要加锁
+	Header header;
+	if (pread(index_fd_, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, kPage_magic, sizeof(header.magic)) || header.page_size != kPage_size || !header.bucket_count) {
+		printf("db_open: invalid page index file\n");
+		_page_free();
+		return false;
+	}
+	bucket_count_ = header.bucket_count;
+	return true;
+}
+
+void PageDB::db_close() {
+	_page_free();
+}
+
+/*
+ * FNV-1a再混合一下，低位选桶，高8位做指纹，两者互不相关
+ */
+uint64_t PageDB::_page_hash(const string &key) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < key.length(); ++i) {
+		hash ^= (unsigned char)key[i];
+		hash *= 0x100000001b3ULL;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/*
+ * hash桶的页在.pidx中的偏移量，也是这个桶的锁的位置
+ */
+off_t PageDB::_page_bucket_offset(uint64_t hash) {
+	return (off_t)(hash % bucket_count_ + 1) * kPage_size;
+}
+
+bool PageDB::_page_read(uint64_t page_number, Page &page) {
+	if (pread(index_fd_, &page, kPage_size, page_number * kPage_size) != kPage_size) {
+		printf("_page_read: read error of page %llu\n", (unsigned long long)page_number);
+		return false;
+	}
+	return true;
+}
+
+bool PageDB::_page_write(uint64_t page_number, const Page &page) {
+	if (pwrite(index_fd_, &page, kPage_size, page_number * kPage_size) != kPage_size) {
+		printf("_page_write: write error of page %llu\n", (unsigned long long)page_number);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * 找出页里指纹等于fingerprint的槽，下标写到matches里，返回个数
+ * 有SSE2时16个指纹一起比较，得到的位图再去掉count之后的部分
+ */
+int PageDB::_page_match(const Page &page, uint8_t fingerprint, int *matches) {
+	int n = 0;
+#ifdef __SSE2__
+	__m128i target = _mm_set1_epi8((char)fingerprint);
+	for (int i = 0; i < page.count; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(page.fingerprints + i));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, target));
+		if (page.count - i < 16)
+			mask &= (1u << (page.count - i)) - 1;
+		while (mask) {
+			matches[n++] = i + __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+#else
+	for (int i = 0; i < page.count; ++i)
+		if (page.fingerprints[i] == fingerprint)
+			matches[n++] = i;
+#endif
+	return n;
+}
+
+/*
+ * 用一次pread读出槽指向的记录，key写到key，value不为空时写到value
+ * 成功返回true，失败返回false
+ */
+bool PageDB::_page_read_record(const Slot &slot, string &key, string *value) {
+	size_t length = kPage_record_header + slot.key_length + (value ? slot.value_length : 0);
+	std::vector<char> buffer(length);
+	if (pread(data_fd_, &buffer[0], length, slot.offset) != (ssize_t)length) {
+		printf("_page_read_record: read error of data record\n");
+		return false;
+	}
+	uint32_t lengths[2];
+	memcpy(lengths, &buffer[0], sizeof(lengths));
+	if (lengths[0] != slot.key_length || lengths[1] != slot.value_length) {
+		printf("_page_read_record: data record is broken\n");
+		return false;
+	}
+	key.assign(&buffer[kPage_record_header], slot.key_length);
+	if (value)
+		value->assign(&buffer[kPage_record_header + slot.key_length], slot.value_length);
+	return true;
+}
+
+/*
+ * 沿着桶的页和溢出页查找key，调用前需要锁住这个桶
+ * 找到时page是key所在的页，page_number是它的页号，slot是槽的下标，value不为空时顺便读出value
+ * 没找到时page和page_number是链上的最后一页
+ * 找到返回0，没找到返回1，读出错或者记录损坏返回-1，这时page不完整，调用者不能再写回
+ */
+int PageDB::_page_find(const string &key, uint64_t hash, Page &page, uint64_t &page_number, int &slot, string *value) {
+	uint8_t fingerprint = hash >> 56;
+	int matches[kPage_slots];
+	string found_key;
+	page_number = _page_bucket_offset(hash) / kPage_size;
+	while (true) {
+		if (!_page_read(page_number, page))
+			return -1;
+		int n = _page_match(page, fingerprint, matches);
+		for (int i = 0; i < n; ++i) {
+			const Slot &candidate = page.slots[matches[i]];
+			if (candidate.key_length != key.length())
+				continue;
+			if (!_page_read_record(candidate, found_key, value))
+				return -1;
+			if (found_key == key) {
+				slot = matches[i];
+				return 0;
+			}
+		}
+		if (!page.overflow)
+			return 1;
+		page_number = page.overflow;
+	}
+}
+
+/*
+ * 把一条记录追加到.pdat的结尾，偏移量写到offset
+ * 追加期间锁住整个.pdat，和DB的_db_lock_and_write_data一样
+ * 成功返回true，失败返回false
+ */
+bool PageDB::_page_append(const string &key, const string &value, off_t &offset) {
+	string buffer;
+	uint32_t lengths[2] = {(uint32_t)key.length(), (uint32_t)value.length()};
+	buffer.append((const char *)lengths, sizeof(lengths));
+	buffer.append(key);
+	buffer.append(value);
+	RecordWritewLock writew_lock(data_fd_, 0, SEEK_SET, 0);
+	struct stat statbuff;
+	if (!writew_lock.locked() || fstat(data_fd_, &statbuff) < 0) {
+		printf("_page_append: fstat error\n");
+		return false;
+	}
+	offset = statbuff.st_size;
+	if (pwrite(data_fd_, buffer.data(), buffer.length(), offset) != (ssize_t)buffer.length()) {
+		printf("_page_append: write error of data record\n");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * 在文件末尾分配一个溢出页，锁住文件头的第一个字节修改页数
+ * 新页由调用者写入，返回页号，失败返回0
+ */
+uint64_t PageDB::_page_allocate() {
+	RecordWritewLock writew_lock(index_fd_, 0, SEEK_SET, 1);
+	Header header;
+	if (!writew_lock.locked() || pread(index_fd_, &header, sizeof(header), 0) != sizeof(header)) {
+		printf("_page_allocate: read error of header\n");
+		return 0;
+	}
+	uint64_t page_number = header.page_count++;
+	if (pwrite(index_fd_, &header, sizeof(header), 0) != sizeof(header)) {
+		printf("_page_allocate: write error of header\n");
+		return 0;
+	}
+	return page_number;
+}
+
+string PageDB::db_fetch(const string &key) {
+	string value;
+	if (PageDB::db_try_fetch(key, value, -1))
+		value.clear();
+	return value;
+}
+
+int PageDB::db_try_fetch(const string &key, string &value, long long timeout) {
+	uint64_t hash = _page_hash(key);
+	value.clear();
+	RecordTimedReadLock read_lock(index_fd_, _page_bucket_offset(hash), SEEK_SET, 1, timeout);
+	if (!read_lock.locked()) {
+		if (read_lock.busy())
+			return kDB_busy;
+		printf("db_try_fetch: lock error\n");
+		return -1;
+	}
+	Page page;
+	uint64_t page_number;
+	int slot;
+	int result = _page_find(key, hash, page, page_number, slot, &value);
+	//指纹相同的其他key会读到value里
+	if (result)
+		value.clear();
+	return result;
+}
+
+/*
+ * 先按桶排序，同一个桶的key只加一次锁
+ */
+void PageDB::db_multi_fetch(const std::vector<string> &keys, std::vector<string> &values) {
+	values.assign(keys.size(), string());
+	std::vector<std::pair<off_t, size_t> > order(keys.size());
+	std::vector<uint64_t> hashes(keys.size());
+	for (size_t i = 0; i < keys.size(); ++i) {
+		hashes[i] = _page_hash(keys[i]);
+		order[i] = std::make_pair(_page_bucket_offset(hashes[i]), i);
+	}
+	std::sort(order.begin(), order.end());
+	Page page;
+	uint64_t page_number;
+	int slot;
+	for (size_t i = 0; i < order.size(); ) {
+		off_t bucket_offset = order[i].first;
+		RecordReadwLock readw_lock(index_fd_, bucket_offset, SEEK_SET, 1);
+		for (; i < order.size() && order[i].first == bucket_offset; ++i) {
+			size_t index = order[i].second;
+			if (!readw_lock.locked() || _page_find(keys[index], hashes[index], page, page_number, slot, &values[index]))
+				values[index].clear();
+		}
+	}
+}
+
+/*
+ * 删除时把页里最后一个槽挪到被删的位置，页里的槽始终是紧凑的
+ */
+bool PageDB::db_delete(const string &key) {
+	if (readonly_) {
+		printf("db_delete: db is readonly\n");
+		return false;
+	}
+	uint64_t hash = _page_hash(key);
+	RecordWritewLock writew_lock(index_fd_, _page_bucket_offset(hash), SEEK_SET, 1);
+	if (!writew_lock.locked())
+		return false;
+	Page page;
+	uint64_t page_number;
+	int slot;
+	if (_page_find(key, hash, page, page_number, slot, nullptr))
+		return false;
+	int last = page.count - 1;
+	page.fingerprints[slot] = page.fingerprints[last];
+	page.slots[slot] = page.slots[last];
+	page.count--;
+	return _page_write(page_number, page);
+}
+
+int PageDB::db_store(const string &key, const string &data, int flag) {
+	return PageDB::db_try_store(key, data, flag, -1);
+}
+
+int PageDB::db_try_store(const string &key, const string &data, int flag, long long timeout) {
+	if (readonly_) {
+		printf("db_store: db is readonly\n");
+		return -1;
+	}
+	if (flag <= STORE_MIN_FLAG || flag >= STORE_MAX_FLAG) {
+		printf("_db_store: flag is invalid\n");
+		return -1;
+	}
+	//长度限制和DB一致
+	int data_length = data.length() + 1;
+	if (data_length < kData_min || data_length > kData_max) {
+		printf("db_store: invalid data length\n");
+		return -1;
+	}
+	if (!key.length() || (int)key.length() > kPage_key_max) {
+		printf("db_store: invalid key length\n");
+		return -1;
+	}
+	uint64_t hash = _page_hash(key);
+	RecordTimedWriteLock write_lock(index_fd_, _page_bucket_offset(hash), SEEK_SET, 1, timeout);
+	if (!write_lock.locked()) {
+		if (write_lock.busy())
+			return kDB_busy;
+		printf("db_try_store: lock error\n");
+		return -1;
+	}
+	Page page;
+	uint64_t page_number;
+	int slot;
+	int found = _page_find(key, hash, page, page_number, slot, nullptr);
+	if (found < 0)
+		return -1;
+	bool can_find = !found;
+	if (can_find && DB_INSERT == flag) {
+		printf("_db_store_insert: key is exist in db\n");
+		return 1;
+	}
+	if (!can_find && DB_REPLACE == flag) {
+		printf("_db_store_replace: db can not find key\n");
+		return -1;
+	}
+	return _page_put(key, data, hash, page, page_number, slot, can_find);
+}
+
+/*
+ * 把记录追加到.pdat，再更新或者新增槽，参数是_page_find的结果，调用前需要锁住这个桶
+ * 成功返回0，失败返回-1
+ */
+int PageDB::_page_put(const string &key, const string &data, uint64_t hash, Page &page, uint64_t page_number, int slot, bool can_find) {
+	off_t offset;
+	if (!_page_append(key, data, offset))
+		return -1;
+	if (!can_find) {
+		/*
+		 * 最后一页满了再从头找一个有空槽的页，删除可能在前面的页留下空槽
+		 * 都满了就分配一个溢出页，先写新页再把它挂到链上
+		 */
+		if (kPage_slots == page.count) {
+			uint64_t last_number = page_number;
+			for (page_number = _page_bucket_offset(hash) / kPage_size; page_number != last_number; page_number = page.overflow) {
+				if (!_page_read(page_number, page))
+					return -1;
+				if (page.count < kPage_slots)
+					break;
+			}
+			if (page_number == last_number) {
+				uint64_t overflow = _page_allocate();
+				if (!overflow || !_page_read(last_number, page))
+					return -1;
+				page.overflow = overflow;
+				Page fresh;
+				memset(&fresh, 0, sizeof(fresh));
+				if (!_page_write(overflow, fresh) || !_page_write(last_number, page))
+					return -1;
+				page = fresh;
+				page_number = overflow;
+			}
+		}
+		slot = page.count++;
+		page.fingerprints[slot] = hash >> 56;
+		page.slots[slot].key_length = key.length();
+	}
+	page.slots[slot].offset = offset;
+	page.slots[slot].value_length = data.length();
+	if (!_page_write(page_number, page))
+		return -1;
+	stats_.raw_bytes += data.length();
+	stats_.stored_bytes += data.length();
+	stats_.raw_records++;
+	return 0;
+}
+
+int PageDB::db_update(const string &key, const std::function<bool(bool, string&)> &modify) {
+	if (readonly_) {
+		printf("db_update: db is readonly\n");
+		return -1;
+	}
+	if (!key.length() || (int)key.length() > kPage_key_max) {
+		printf("db_update: invalid key length\n");
+		return -1;
+	}
+	uint64_t hash = _page_hash(key);
+	RecordWritewLock writew_lock(index_fd_, _page_bucket_offset(hash), SEEK_SET, 1);
+	if (!writew_lock.locked())
+		return -1;
+	Page page;
+	uint64_t page_number;
+	int slot;
+	string value;
+	int found = _page_find(key, hash, page, page_number, slot, &value);
+	if (found < 0)
+		return -1;
+	bool can_find = !found;
+	if (!can_find)
+		value.clear();
+	if (!modify(can_find, value))
+		return 1;
+	int data_length = value.length() + 1;
+	if (data_length < kData_min || data_length > kData_max) {
+		printf("db_update: invalid data length\n");
+		return -1;
+	}
+	return _page_put(key, value, hash, page, page_number, slot, can_find);
+}
+
+/*
+ * 批量导入，参数参考DB::db_bulk_load
+ * .pdat按输入顺序顺序写完，槽先按桶分组放在内存里，最后每个桶的页一次写出，文件头最后写
+ * 失败时把两个文件恢复成空库
+ */
+bool PageDB::db_bulk_load(const std::function<bool(string&, string&)> &next) {
+	if (readonly_) {
+		printf("db_bulk_load: db is readonly\n");
+		return false;
+	}
+	RecordWritewLock index_lock(index_fd_, 0, SEEK_SET, 0);
+	RecordWritewLock data_lock(data_fd_, 0, SEEK_SET, 0);
+	Header header;
+	struct stat statbuff;
+	if (!index_lock.locked() || !data_lock.locked() || pread(index_fd_, &header, sizeof(header), 0) != sizeof(header) || fstat(data_fd_, &statbuff) < 0) {
+		printf("db_bulk_load: read error of header\n");
+		return false;
+	}
+	if (header.page_count != bucket_count_ + 1 || statbuff.st_size) {
+		printf("db_bulk_load: db is not empty\n");
+		return false;
+	}
+	std::vector<std::vector<std::pair<uint8_t, Slot> > > buckets(bucket_count_);
+	string key, data, last_key, buffer;
+	off_t offset = 0, write_offset = 0;
+	long long records = 0;
+	bool result = true;
+	buffer.reserve(kPage_buffer_size);
+	for (bool first = true; next(key, data); first = false) {
+		if (!first && key <= last_key) {
+			printf("db_bulk_load: keys are not strictly increasing\n");
+			result = false;
+			break;
+		}
+		int data_length = data.length() + 1;
+		if (data_length < kData_min || data_length > kData_max || !key.length() || (int)key.length() > kPage_key_max) {
+			printf("db_bulk_load: invalid key or data length\n");
+			result = false;
+			break;
+		}
+		uint64_t hash = _page_hash(key);
+		Slot slot = {(uint64_t)offset, (uint16_t)key.length(), 0, (uint32_t)data.length()};
+		buckets[_page_bucket_offset(hash) / kPage_size - 1].push_back(std::make_pair((uint8_t)(hash >> 56), slot));
+		uint32_t lengths[2] = {(uint32_t)key.length(), (uint32_t)data.length()};
+		buffer.append((const char *)lengths, sizeof(lengths));
+		buffer.append(key);
+		buffer.append(data);
+		offset += kPage_record_header + key.length() + data.length();
+		if (buffer.length() >= kPage_buffer_size) {
+			if (pwrite(data_fd_, buffer.data(), buffer.length(), write_offset) != (ssize_t)buffer.length()) {
+				printf("db_bulk_load: write error of data file\n");
+				result = false;
+				break;
+			}
+			write_offset += buffer.length();
+			buffer.clear();
+		}
+		++records;
+		last_key.swap(key);
+	}
+	if (result && !buffer.empty() && pwrite(data_fd_, buffer.data(), buffer.length(), write_offset) != (ssize_t)buffer.length()) {
+		printf("db_bulk_load: write error of data file\n");
+		result = false;
+	}
+	//每个桶的槽依次填满页，溢出页从文件末尾往后分配
+	Page page;
+	for (uint32_t i = 0; result && i < bucket_count_; ++i) {
+		std::vector<std::pair<uint8_t, Slot> > &slots = buckets[i];
+		uint64_t page_number = i + 1;
+		size_t j = 0;
+		do {
+			memset(&page, 0, sizeof(page));
+			for (; j < slots.size() && page.count < kPage_slots; ++page.count, ++j) {
+				page.fingerprints[page.count] = slots[j].first;
+				page.slots[page.count] = slots[j].second;
+			}
+			if (j < slots.size())
+				page.overflow = header.page_count++;
+			if (!_page_write(page_number, page)) {
+				result = false;
+				break;
+			}
+			page_number = page.overflow;
+		} while (j < slots.size());
+		std::vector<std::pair<uint8_t, Slot> >().swap(slots);   //写完就释放
+	}
+	if (result && pwrite(index_fd_, &header, sizeof(header), 0) != sizeof(header)) {
+		printf("db_bulk_load: write error of header\n");
+		result = false;
+	}
+	if (!result) {
+		//桶的页截掉再ftruncate回来就都是空的了，文件头还没有改
+		if (ftruncate(index_fd_, kPage_size) < 0 || ftruncate(index_fd_, (bucket_count_ + 1) * kPage_size) < 0 || ftruncate(data_fd_, 0) < 0)
+			printf("db_bulk_load: ftruncate error\n");
+		return false;
+	}
+	stats_.raw_records += records;
+	return true;
+}
+
+/*
+ * 写操作都会先写锁住对应的桶，读锁住整个.pidx就能挡住所有写操作
+ */
+bool PageDB::db_snapshot(const string &pathname, DB &snapshot) {
+	if (!pathname.length() || pathname == pathname_) {
+		printf("db_snapshot: invalid snapshot pathname\n");
+		return false;
+	}
+	{
+		RecordReadwLock readw_lock(index_fd_, 0, SEEK_SET, 0);
+		if (!readw_lock.locked() || !_db_clone_file(index_fd_, pathname + ".pidx") || !_db_clone_file(data_fd_, pathname + ".pdat")) {
+			printf("db_snapshot: clone file error\n");
+			return false;
+		}
+	}
+	return snapshot.db_open(pathname, O_RDONLY);
+}
+
+bool PageDB::db_train_dictionary(const std::vector<string> &) {
+	printf("db_train_dictionary: PageDB does not support compression\n");
+	return false;
+}
+
+DBStats PageDB::db_stats() {
+	DBStats stats = stats_;
+	stats.compression_ratio = 1.0;
+	return stats;
+}
+
+/*
+ * 按桶依次遍历，读锁住整个.pidx挡住所有写操作
+ */
+bool PageDB::db_scan(const std::function<bool(const string&, const string&)> &visit) {
+	RecordReadwLock readw_lock(index_fd_, 0, SEEK_SET, 0);
+	if (!readw_lock.locked())
+		return false;
+	Page page;
+	string key, value;
+	for (uint32_t i = 0; i < bucket_count_; ++i) {
+		for (uint64_t page_number = i + 1; page_number; page_number = page.overflow) {
+			if (!_page_read(page_number, page))
+				return false;
+			for (int j = 0; j < page.count; ++j) {
+				if (!_page_read_record(page.slots[j], key, &value))
+					return false;
+				if (!visit(key, value))
+					return true;
+			}
+		}
+	}
+	return true;
+}
+
+bool PageDB::db_page_count(uint32_t &buckets, uint64_t &overflow) {
+	RecordReadwLock readw_lock(index_fd_, 0, SEEK_SET, 1);
+	Header header;
+	if (!readw_lock.locked() || pread(index_fd_, &header, sizeof(header), 0) != sizeof(header)) {
+		printf("db_page_count: read error of header\n");
+		return false;
+	}
+	buckets = header.bucket_count;
+	overflow = header.page_count - header.bucket_count - 1;
+	return true;
+}
+
+void PageDB::db_set_bucket_count(uint32_t count) {
+	if (count)
+		bucket_init_ = count;
+}
+
+bool PageDB::db_dump(int fd, int) {
+	return _db_dump_scan(fd);
+}
+
+bool PageDB::db_restore(int fd, long long &sequence) {
+	return _db_restore_read(fd, sequence, [this](string &key, string &value) {
+		return !db_store(key, value, DB_INSERT);
+	});
+}
+
+bool PageDB::db_change_log() {
+	printf("db_change_log: change log is not supported\n");
+	return false;
+}
+
+}
@@ -0,0 +1,88 @@
+#include "../include/v_db_client.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <unordered_map>
+#include <unistd.h>
+
+/*
+ * 本机回环的压测程序，先启动vdb-server再运行
+ * 每个线程一个连接，每轮用流水线发送depth个请求，GET和SET各占一半
+ * 同时用unordered_map记录自己写过的值，校验GET的结果
+ * key带上进程号，所以可以对同一个服务器反复运行
+ */
+const int kKey_max = 1000;        //每个线程使用的key数
+const int kValue_max = 10000;     //value的最大值
+
+bool run_client(int id, int port, int rounds, int depth, long long &operations) {
+	vDB::Client client;
+	if (!client.client_connect("127.0.0.1", port))
+		return false;
+	std::unordered_map<std::string, std::string> m;
+	std::vector<std::string> expected;
+	unsigned int seed = id;
+	for (int i = 0; i < rounds; ++i) {
+		expected.clear();
+		for (int j = 0; j < depth; ++j) {
+			vDB::Request request;
+			std::string key = std::to_string(getpid()) + "_" + std::to_string(id) + "_" + std::to_string(rand_r(&seed) % kKey_max);
+			request.keys.push_back(key);
+			if (rand_r(&seed) % 2) {
+				request.op = vDB::OP_SET;
+				request.value = std::to_string(rand_r(&seed) % kValue_max);
+				m[key] = request.value;
+				expected.push_back("");
+			}
+			else {
+				request.op = vDB::OP_GET;
+				expected.push_back(m.count(key) ? m[key] : "");
+			}
+			client.client_send(request);
+		}
+		if (!client.client_flush())
+			return false;
+		for (int j = 0; j < depth; ++j) {
+			vDB::Response response;
+			if (!client.client_receive(response))
+				return false;
+			std::string value = vDB::STATUS_OK == response.status && !response.values.empty() ? response.values[0] : "";
+			if (value != expected[j]) {
+				printf("result is not same, client=%d, round=%d\n", id, i);
+				return false;
+			}
+		}
+		operations += depth;
+	}
+	return true;
+}
+
+/*
+ * 用法：load_generator [端口] [线程数] [轮数] [流水线深度]
+ */
+int main(int argc, char *argv[]) {
+	int port = argc > 1 ? atoi(argv[1]) : 6380;
+	int threads = argc > 2 ? atoi(argv[2]) : 4;
+	int rounds = argc > 3 ? atoi(argv[3]) : 1000;
+	int depth = argc > 4 ? atoi(argv[4]) : 16;
+	std::vector<std::thread> clients;
+	std::vector<long long> operations(threads, 0);
+	std::vector<char> results(threads, 0);
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < threads; ++i)
+		clients.push_back(std::thread([&, i]() {
+			results[i] = run_client(i, port, rounds, depth, operations[i]);
+		}));
+	long long total = 0;
+	bool success = true;
+	for (int i = 0; i < threads; ++i) {
+		clients[i].join();
+		total += operations[i];
+		success = success && results[i];
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%s: %lld operations in %.3fs, %.0f ops/s\n", success ? "ok" : "failed", total, seconds, total / seconds);
+	return success ? 0 : 1;
+}
@@ -1,9 +1,30 @@
 #include "../include/v_db.h"
+#include "../include/v_log_db.h"
+#include "../include/v_mem_db.h"
+#include "../include/v_page_db.h"
+#include "../include/v_fixed_db.h"
+#include "../include/v_change_log.h"
+#include "../include/v_db_server.h"
+#include "../include/v_db_client.h"
+#include "../include/record_lock.h"
 #include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
 #include <string>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <functional>
 #include <unordered_map>
 #include <fcntl.h>
+#include <unistd.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <iostream>
 
 template<typename T>
@@ -16,20 +37,447 @@ bool check_result(T result1, T result2, int cmd_number, int cmd) {
 	return true;
 }
 
-void test_output() {
-	vDB::DB db;
+/*
+ * 测试db_update上的几个原子操作，结果同样和map对比，cmd记为4
+ */
+bool test_update(vDB::DB &db, std::unordered_map<std::string, std::string> &m, int cmd_number) {
+	long long result = 0;
+	//计数器从不存在开始累加
+	for (int i = 0; i < 100; ++i)
+		if (!db.db_increment("counter", i, result))
+			break;
+	m["counter"] = "4950";
+	if (!check_result<std::string>(db.db_fetch("counter"), m["counter"], cmd_number, 4))
+		return false;
+	db.db_store("text", "abc", vDB::DB_STORE);
+	m["text"] = "abc";
+	if (!check_result<bool>(db.db_increment("text", 1, result), false, cmd_number, 4))
+		return false;
+	//溢出时失败，原来的值不变
+	m["overflow"] = std::to_string(LLONG_MAX);
+	db.db_store("overflow", m["overflow"], vDB::DB_STORE);
+	if (!check_result<bool>(db.db_increment("overflow", 1, result), false, cmd_number, 4) ||
+		!check_result<std::string>(db.db_fetch("overflow"), m["overflow"], cmd_number, 4))
+		return false;
+	//所有的value都追加一段，有的需要换一个更大的位置
+	for (auto &element : m) {
+		db.db_append(element.first, "+tail");
+		element.second += "+tail";
+	}
+	for (auto &element : m)
+		if (!check_result<std::string>(db.db_fetch(element.first), element.second, cmd_number, 4))
+			return false;
+	if (!check_result<int>(db.db_compare_and_swap("text", "abc", "x"), 1, cmd_number, 4) ||
+		!check_result<int>(db.db_compare_and_swap("text", "abc+tail", "x"), 0, cmd_number, 4) ||
+		!check_result<int>(db.db_compare_and_swap("new", "", "y"), 0, cmd_number, 4) ||
+		!check_result<int>(db.db_compare_and_swap("new", "", "z"), 1, cmd_number, 4))
+		return false;
+	m["text"] = "x";
+	m["new"] = "y";
+	return check_result<std::string>(db.db_fetch("text"), "x", cmd_number, 4) && check_result<std::string>(db.db_fetch("new"), "y", cmd_number, 4);
+}
+
+/*
+ * 测试限时的try接口，没有别人占着锁时结果和普通接口一样，cmd记为5
+ */
+bool test_try(vDB::DB &db, std::unordered_map<std::string, std::string> &m, int cmd_number) {
+	std::string value;
+	for (auto &element : m)
+		if (!check_result<int>(db.db_try_fetch(element.first, value, 0), 0, cmd_number, 5) ||
+			!check_result<std::string>(value, element.second, cmd_number, 5))
+			return false;
+	if (!check_result<int>(db.db_try_fetch("missing", value, 1000), 1, cmd_number, 5) ||
+		!check_result<int>(db.db_try_store("try", "t", vDB::DB_INSERT, 0), 0, cmd_number, 5) ||
+		!check_result<int>(db.db_try_store("try", "u", vDB::DB_INSERT, 1000), 1, cmd_number, 5))
+		return false;
+	m["try"] = "t";
+	return check_result<std::string>(db.db_fetch("try"), "t", cmd_number, 5);
+}
+
+/*
+ * 子进程写锁住整个.idx文件，限时接口要在期限内返回kDB_busy，数据库不能被改动，cmd同样记为5
+ */
+/*
+ * 阻塞锁出错时不能abort，用fcntl的死锁检测造出一次出错：
+ * 父进程锁住文件末尾之后的一个字节，子进程锁住整个文件再去等这个字节，父进程再去锁链就会得到EDEADLK
+ */
+bool test_lock_error(vDB::DB &db, std::unordered_map<std::string, std::string> &m, int cmd_number, int locked[2]) {
+	const off_t far = 1LL << 40;
+	char byte = 0;
+	int fd = open("testdb.idx", O_RDWR);
+	bool result;
+	pid_t pid;
+	{
+		RecordWritewLock far_lock(fd, far, SEEK_SET, 1);
+		pid = fork();
+		if (!pid) {
+			int child_fd = open("testdb.idx", O_RDWR);
+			RecordWritewLock file_lock(child_fd, 0, SEEK_SET, far);
+			write(locked[1], &byte, 1);
+			RecordWritewLock wait_lock(child_fd, far, SEEK_SET, 1);
+			_exit(0);
+		}
+		read(locked[0], &byte, 1);
+		//等子进程阻塞在far_lock上
+		usleep(50000);
+		const std::string &key = m.begin()->first;
+		std::vector<std::string> values;
+		db.db_multi_fetch({key}, values);
+		result = check_result<bool>(db.db_delete(key), false, cmd_number, 5) &&
+			check_result<int>(db.db_update(key, [](bool, std::string &value) { value = "changed"; return true; }), -1, cmd_number, 5) &&
+			check_result<bool>(db.db_scan([](const std::string&, const std::string&) { return true; }), false, cmd_number, 5) &&
+			check_result<std::string>(values[0], "", cmd_number, 5);
+	}
+	waitpid(pid, nullptr, 0);
+	close(fd);
+	return result;
+}
+
+bool test_try_busy(vDB::DB &db, std::unordered_map<std::string, std::string> &m, int cmd_number) {
+	int locked[2], release[2];
+	if (pipe(locked) < 0 || pipe(release) < 0) {
+		printf("pipe failed\n");
+		return false;
+	}
+	char byte = 0;
+	pid_t pid = fork();
+	if (!pid) {
+		int fd = open("testdb.idx", O_RDWR);
+		{
+			RecordWritewLock writew_lock(fd, 0, SEEK_SET, 0);
+			write(locked[1], &byte, 1);
+			read(release[0], &byte, 1);
+		}
+		_exit(0);
+	}
+	read(locked[0], &byte, 1);
+	const std::string &key = m.begin()->first;
+	std::string value;
+	auto elapsed = [](std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	};
+	auto start = std::chrono::steady_clock::now();
+	bool result = check_result<int>(db.db_try_fetch(key, value, 0), vDB::kDB_busy, cmd_number, 5) &&
+		check_result<int>(db.db_try_store(key, "changed", vDB::DB_STORE, 0), vDB::kDB_busy, cmd_number, 5) &&
+		check_result<bool>(elapsed(start) < 10, true, cmd_number, 5);
+	start = std::chrono::steady_clock::now();
+	result = result && check_result<int>(db.db_try_store(key, "changed", vDB::DB_STORE, 20000), vDB::kDB_busy, cmd_number, 5);
+	long long waited = elapsed(start);
+	result = result && check_result<bool>(waited >= 20 && waited < 200, true, cmd_number, 5);
+	write(release[1], &byte, 1);
+	waitpid(pid, nullptr, 0);
+	result = result && test_lock_error(db, m, cmd_number, locked);
+	close(locked[0]);
+	close(locked[1]);
+	close(release[0]);
+	close(release[1]);
+	return result && check_result<std::string>(db.db_fetch(key), m[key], cmd_number, 5);
+}
+
+/*
+ * key和value里带':'，'\0'，'\n'，还有一个key是另一个key加上'\0'开头的后缀，cmd记为16
+ * 删掉其中一个以后另一个还在，最后全部删掉，不影响后面的测试
+ */
+bool test_binary(vDB::DB &db, int cmd_number) {
+	const std::string keys[] = {"a:b", std::string("a:b\0c", 5), std::string("\0lead", 5), "line\nbreak", "x:y:z"};
+	const std::string values[] = {std::string("v\0al:ue\n", 9), "a:b", std::string("\0\0\0", 3), "\n\n", std::string("tail\0", 5)};
+	const int count = sizeof(keys) / sizeof(keys[0]);
+	bool result = true;
+	for (int i = 0; result && i < count; ++i)
+		result = check_result<int>(db.db_store(keys[i], values[i], vDB::DB_INSERT), 0, cmd_number, 16);
+	for (int i = 0; result && i < count; ++i)
+		result = check_result<std::string>(db.db_fetch(keys[i]), values[i], cmd_number, 16);
+	//前缀相同的两个key互不影响
+	result = result && check_result<int>(db.db_store(keys[1], "replaced\n", vDB::DB_REPLACE), 0, cmd_number, 16) &&
+		check_result<std::string>(db.db_fetch(keys[0]), values[0], cmd_number, 16) &&
+		check_result<bool>(db.db_delete(keys[0]), true, cmd_number, 16) &&
+		check_result<std::string>(db.db_fetch(keys[0]), "", cmd_number, 16) &&
+		check_result<std::string>(db.db_fetch(keys[1]), "replaced\n", cmd_number, 16) &&
+		check_result<std::string>(db.db_fetch("a"), "", cmd_number, 16);
+	size_t found = 0;
+	db.db_scan([&](const std::string &key, const std::string &value) {
+		for (int i = 1; i < count; ++i)
+			if (key == keys[i])
+				found += value == (1 == i ? "replaced\n" : values[i]);
+		return true;
+	});
+	result = result && check_result<size_t>(found, count - 1, cmd_number, 16);
+	for (int i = 1; i < count; ++i)
+		db.db_delete(keys[i]);
+	return result;
+}
+
+/*
+ * 先写一个较长的value，再替换成短一点和长一点但不超过原长度的value，cmd记为17
+ * 都在原来的容量里，应该原地改写，.dat的大小不能变
+ */
+bool test_replace_in_place(vDB::DB &db, int cmd_number) {
+	auto dat_size = []() {
+		struct stat statbuff;
+		return stat("testdb.dat", &statbuff) < 0 ? -1 : (long long)statbuff.st_size;
+	};
+	const std::string key = "in_place";
+	if (!check_result<int>(db.db_store(key, std::string(100, 'a'), vDB::DB_INSERT), 0, cmd_number, 17))
+		return false;
+	long long size = dat_size();
+	bool result = check_result<int>(db.db_store(key, std::string(98, 'b'), vDB::DB_REPLACE), 0, cmd_number, 17) &&
+		check_result<long long>(dat_size(), size, cmd_number, 17) &&
+		check_result<int>(db.db_store(key, std::string(99, 'c'), vDB::DB_REPLACE), 0, cmd_number, 17) &&
+		check_result<long long>(dat_size(), size, cmd_number, 17) &&
+		check_result<std::string>(db.db_fetch(key), std::string(99, 'c'), cmd_number, 17);
+	db.db_delete(key);
+	return result;
+}
+
+/*
+ * 检查副本和map完全一致
+ */
+bool check_copy(vDB::DB &copy, std::unordered_map<std::string, std::string> &m, int cmd_number, int cmd) {
+	size_t count = 0;
+	copy.db_scan([&count](const std::string&, const std::string&) { return ++count; });
+	if (!check_result<size_t>(count, m.size(), cmd_number, cmd))
+		return false;
+	for (auto &element : m)
+		if (!check_result<std::string>(copy.db_fetch(element.first), element.second, cmd_number, cmd))
+			return false;
+	return true;
+}
+
+/*
+ * 数据库的文件里名字匹配pattern的个数，pattern为空时删除testdb_merge的所有文件
+ */
+size_t merge_files(const char *pattern) {
+	glob_t files;
+	if (glob(pattern ? pattern : "testdb_merge*", 0, nullptr, &files))
+		return 0;
+	size_t count = files.gl_pathc;
+	for (size_t i = 0; !pattern && i < count; ++i)
+		unlink(files.gl_pathv[i]);
+	globfree(&files);
+	return count;
+}
+
+/*
+ * LogDB的段设得很小，几轮改写和删除分散到很多段里，cmd记为18
+ * 合并后内容不变，再改写一轮后在后台合并，关闭后用hint文件重新打开，内容也要一致
+ */
+void test_log_merge() {
+	std::unordered_map<std::string, std::string> m;
+	vDB::LogDB db;
+	if (!db.db_open("testdb_merge", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) {
+		printf("db open failed\n");
+		return;
+	}
+	db.db_set_segment_size(4096);
+	auto change = [&db, &m](int round) {
+		for (int i = 0; i < 100; ++i) {
+			std::string key = "merge" + std::to_string(i);
+			if ((i + round) % 7 == 0) {
+				db.db_delete(key);
+				m.erase(key);
+			}
+			else if ((i + round) % 3) {
+				std::string value = std::to_string(round) + std::string(i % 40 + 1, 'a' + round);
+				db.db_store(key, value, vDB::DB_STORE);
+				m[key] = value;
+			}
+		}
+	};
+	for (int round = 0; round < 5; ++round)
+		change(round);
+	bool result = check_result<bool>(merge_files("testdb_merge.*.log") > 3, true, 0, 18) &&
+		check_result<bool>(db.db_dead_ratio() > 0, true, 0, 18) &&
+		check_result<bool>(db.db_merge(), true, 0, 18) &&
+		check_result<bool>(merge_files("testdb_merge.*.hint") > 0, true, 0, 18) && check_copy(db, m, 0, 18);
+	change(5);
+	result = result && check_result<bool>(db.db_merge_background(), true, 0, 18);
+	change(6);
+	db.db_close();
+	vDB::LogDB reopened;
+	result = result && check_result<bool>(reopened.db_open("testdb_merge", O_RDWR), true, 0, 18) && check_copy(reopened, m, 0, 18);
+	reopened.db_close();
+	merge_files(nullptr);
+}
+
+/*
+ * 导出几MB的数据再导入，每条链都比较长，导出流会分成很多块
+ */
+bool test_dump_large(int cmd_number) {
+	std::unordered_map<std::string, std::string> m;
+	vDB::DB source, copy;
+	if (!source.db_open("testdb_big", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR) ||
+		!copy.db_open("testdb_copy", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) {
+		printf("db open failed\n");
+		return false;
+	}
+	for (int i = 0; i < 5000; ++i) {
+		std::string key = "big" + std::to_string(i);
+		m[key] = std::string(900, 'a' + i % 26) + std::to_string(i);
+		source.db_store(key, m[key], vDB::DB_STORE);
+	}
+	int fd = open("testdb.dump", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+	long long sequence;
+	bool result = check_result<bool>(source.db_dump(fd, 4), true, cmd_number, 6);
+	lseek(fd, 0, SEEK_SET);
+	result = result && check_result<bool>(copy.db_restore(fd, sequence), true, cmd_number, 6) && check_copy(copy, m, cmd_number, 6);
+	close(fd);
+	source.db_close();
+	copy.db_close();
+	unlink("testdb.dump");
+	unlink("testdb_big.idx");
+	unlink("testdb_big.dat");
+	unlink("testdb_copy.idx");
+	unlink("testdb_copy.dat");
+	return result;
+}
+
+/*
+ * 导出后导入到一个新的DB，每条记录都要和map一致，cmd记为6
+ * 再把导出文件改坏一个字节，导入要失败而且留下空库，最后再测一次几MB的导出和导入
+ */
+bool test_dump(vDB::DB &db, std::unordered_map<std::string, std::string> &m, int cmd_number) {
+	int fd = open("testdb.dump", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+	if (!check_result<bool>(db.db_dump(fd, 4), true, cmd_number, 6))
+		return false;
+	vDB::DB copy;
+	if (!copy.db_open("testdb_copy", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) {
+		printf("db open failed\n");
+		return false;
+	}
+	lseek(fd, 0, SEEK_SET);
+	long long sequence = -1;
+	if (!check_result<bool>(copy.db_restore(fd, sequence), true, cmd_number, 6) || !check_result<long long>(sequence, db.db_sequence(), cmd_number, 6))
+		return false;
+	size_t count = 0;
+	copy.db_scan([&count](const std::string&, const std::string&) { return ++count; });
+	if (!check_result<size_t>(count, m.size(), cmd_number, 6))
+		return false;
+	for (auto &element : m)
+		if (!check_result<std::string>(copy.db_fetch(element.first), element.second, cmd_number, 6))
+			return false;
+	copy.db_open("testdb_copy", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+	off_t middle = lseek(fd, 0, SEEK_END) / 2;
+	char byte;
+	pread(fd, &byte, 1, middle);
+	byte ^= 1;
+	pwrite(fd, &byte, 1, middle);
+	lseek(fd, 0, SEEK_SET);
+	bool result = check_result<bool>(copy.db_restore(fd, sequence), false, cmd_number, 6);
+	count = 0;
+	copy.db_scan([&count](const std::string&, const std::string&) { return ++count; });
+	close(fd);
+	copy.db_close();
+	unlink("testdb.dump");
+	unlink("testdb_copy.idx");
+	unlink("testdb_copy.dat");
+	return result && check_result<size_t>(count, 0, cmd_number, 6) && test_dump_large(cmd_number);
+}
+
+/*
+ * 开启变更日志后修改一些记录再导出，副本从导出加上日志文件追上主库，cmd记为7
+ * 之后主库继续修改，副本再通过管道接收log_copy推过来的记录追上，最后检查日志末尾的坏记录会被截掉
+ */
+bool test_follow(vDB::DB &db, std::unordered_map<std::string, std::string> &m, int cmd_number) {
+	if (!check_result<bool>(db.db_change_log(), true, cmd_number, 7))
+		return false;
+	auto change = [&db, &m](int round) {
+		for (int i = 0; i < 50; ++i) {
+			std::string key = "follow" + std::to_string(i);
+			if (i % 5 == round % 5) {
+				db.db_delete(key);
+				m.erase(key);
+			}
+			else {
+				db.db_store(key, std::to_string(round * i), vDB::DB_STORE);
+				m[key] = std::to_string(round * i);
+			}
+		}
+		long long result;
+		db.db_increment("follow_counter", round, result);
+		m["follow_counter"] = std::to_string(result);
+	};
+	change(1);
+	int fd = open("testdb.dump", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+	db.db_dump(fd, 2);
+	change(2);
+	vDB::DB copy;
+	long long sequence = -1;
+	lseek(fd, 0, SEEK_SET);
+	if (!copy.db_open("testdb_copy", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR) || !copy.db_restore(fd, sequence)) {
+		printf("db restore failed\n");
+		return false;
+	}
+	close(fd);
+	unlink("testdb.dump");
+	//从日志文件追上，每批只应用几条
+	int log = open("testdb.clog", O_RDONLY);
+	vDB::LogFollower follower;
+	if (!check_result<bool>(follower.follower_open(log, sequence), true, cmd_number, 7))
+		return false;
+	while (follower.follower_apply(copy, 7) > 0) {}
+	close(log);
+	if (!check_result<long long>(follower.follower_sequence(), db.db_sequence(), cmd_number, 7) || !check_copy(copy, m, cmd_number, 7))
+		return false;
+	//再从管道追上
+	change(3);
+	vDB::ChangeLog reader;
+	int pipe_fd[2];
+	if (!reader.log_open("testdb.clog", O_RDONLY) || pipe(pipe_fd) < 0) {
+		printf("open change log failed\n");
+		return false;
+	}
+	long long last = reader.log_copy(pipe_fd[1], follower.follower_sequence());
+	close(pipe_fd[1]);
+	vDB::LogFollower pipe_follower;
+	pipe_follower.follower_open(pipe_fd[0], follower.follower_sequence());
+	while (pipe_follower.follower_apply(copy, 7) > 0) {}
+	close(pipe_fd[0]);
+	bool result = check_result<long long>(last, db.db_sequence(), cmd_number, 7) &&
+		check_result<long long>(pipe_follower.follower_sequence(), last, cmd_number, 7) && check_copy(copy, m, cmd_number, 7);
+	//模拟崩溃时写了一半的记录，跟随者先读到这些字节，以读写方式打开日志时截掉，之后追加的记录照样能跟上
+	log = open("testdb.clog", O_RDWR);
+	char torn[25];
+	memset(torn, 1, sizeof(torn));
+	pwrite(log, torn, sizeof(torn), lseek(log, 0, SEEK_END));
+	follower.follower_open(log, last);
+	result = result && check_result<int>(follower.follower_apply(copy, 7), 0, cmd_number, 7);
+	vDB::ChangeLog writer;
+	result = result && check_result<bool>(writer.log_open("testdb.clog", O_RDWR), true, cmd_number, 7);
+	change(4);
+	while (follower.follower_apply(copy, 7) > 0) {}
+	close(log);
+	result = result && check_result<long long>(follower.follower_sequence(), db.db_sequence(), cmd_number, 7) && check_copy(copy, m, cmd_number, 7);
+	copy.db_close();
+	unlink("testdb_copy.idx");
+	unlink("testdb_copy.dat");
+	return result;
+}
+
+/*
+ * pool不为0时开启这么大的缓冲池，结束后不带缓冲池重新打开，检查脏页都写回了
+ * full为false时跳过只有DB支持的测试，比如锁等待和变更日志
+ */
+void test_output(vDB::DB &db, size_t pool = 0, int adaptive = 0, bool full = true) {
 	std::unordered_map<std::string, std::string> m;
 	if (!db.db_open("testdb", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)){
 		printf("db open failed\n");
 		return;
 	}
+	if (pool && !db.db_buffer_pool(pool)) {
+		printf("db buffer pool failed\n");
+		return;
+	}
+	if (adaptive && !db.db_set_adaptive(adaptive)) {
+		printf("db set adaptive failed\n");
+		return;
+	}
 	/*
-	 * ͨinputļͬʱdbunorder_map
-	 * ԱǵǷһ
+	 * 通过input文件的输入数据同时来操作db和unorder_map
+	 * 对比他们的输出是否不一致
 	 */
 	freopen("input", "r", stdin);
 	int cmd;
-	int cmd_number = 1;       //ʾǵڼе
+	int cmd_number = 1;       //表示这是第几行的命令
 	while (~scanf("%d", &cmd)) {
 		printf("cmd =%d, cmd_number=%d\n",cmd, cmd_number);
 		if (!cmd) {
@@ -39,13 +487,13 @@ void test_output() {
 			printf("key=%s,value=%s,flag=%d\n",key,value,flag);
 			int db_result, map_result;
 			/*
-			 * store
-			 * map˵ҪԼֶ
+			 * store操作
+			 * 对面map来说需要自己手动存
 			 */
 			db_result = db.db_store(key, value, flag);
 			if (m.find(key) == m.end()) {
 				if (flag != 2){
-					//replace
+					//不是replace操作
 					m[key] = value;
 					map_result = 0;
 				}
@@ -54,7 +502,7 @@ void test_output() {
 			}
 			else{
 				if (flag != 1){
-					//insert
+					//不是insert操作
 					m[key] = value;
 					map_result = 0;
 				}
@@ -70,8 +518,8 @@ void test_output() {
 			printf("key=%s\n",key);
 			if (1 == cmd) {
 				/*
-				 * delete
-				 * map˵ҪһǷkey
+				 * delete操作
+				 * 对面map来说需要判一下是否存在这个key
 				 */
 				bool db_result, map_result;
 				db_result = db.db_delete(key);
@@ -87,8 +535,8 @@ void test_output() {
 			}
 			else {
 				/*
-				 * fetch
-				 * ͬҪǷ
+				 * fetch操作
+				 * 同样需要查找是否存在
 				 */
 				std::string db_result, map_result;
 				db_result = db.db_fetch(key);
@@ -100,9 +548,600 @@ void test_output() {
 		}
 		cmd_number++;
 	}
+	//挪到链头是先挂拷贝再摘掉原节点，挪过之后链上不能有重复的key或者丢掉的节点
+	long long records, errors;
+	if (adaptive && !pool && (!check_result<bool>(db.db_stats().promotions > 0, true, cmd_number, 2) ||
+		!check_result<bool>(db.db_verify(2, records, errors), true, cmd_number, 2) || !check_result<long long>(errors, 0, cmd_number, 2)))
+		return;
+	if (!test_binary(db, cmd_number) || (full && !pool && !test_replace_in_place(db, cmd_number)) || !test_update(db, m, cmd_number) || !test_try(db, m, cmd_number) || !test_dump(db, m, cmd_number))
+		return;
+	if (full && (!test_try_busy(db, m, cmd_number) || !test_follow(db, m, cmd_number)))
+		return;
+	db.db_close();
+	if (!pool)
+		return;
+	if (!db.db_open("testdb", O_RDONLY)) {
+		printf("db reopen failed\n");
+		return;
+	}
+	for (auto &element : m)
+		if (!check_result<std::string>(db.db_fetch(element.first), element.second, cmd_number, 2))
+			break;
+	db.db_close();
+}
+
+/*
+ * 用同样的输入测试FixedDB，key和value补0到定长，删除和遍历的结果同样和map对比
+ */
+void test_fixed() {
+	typedef vDB::FixedDB<4, 8> FixedDB;
+	FixedDB db;
+	std::unordered_map<std::string, std::string> m;
+	//桶故意开得很少，让溢出桶经常被分配
+	if (!db.db_open("testdb", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR, 1)) {
+		printf("db open failed\n");
+		return;
+	}
+	freopen("input", "r", stdin);
+	int cmd;
+	int cmd_number = 1;
+	while (~scanf("%d", &cmd)) {
+		char key[10] = {0}, value[10] = {0};
+		scanf("%s", key);
+		if (!cmd) {
+			int flag;
+			scanf("%s%d", value, &flag);
+			int map_result = 0;
+			bool exist = m.count(key);
+			if ((exist && 1 == flag) || (!exist && 2 == flag))
+				map_result = exist ? 1 : -1;
+			else
+				m[key] = std::string(value, 8);
+			if (!check_result<int>(db.db_store(key, value, flag), map_result, cmd_number, cmd))
+				return;
+		}
+		else if (1 == cmd) {
+			if (!check_result<bool>(db.db_delete(key), m.erase(key), cmd_number, cmd))
+				return;
+		}
+		else {
+			std::string map_result;
+			if (m.count(key))
+				map_result = m[key];
+			std::string db_result;
+			if (db.db_fetch(key, value))
+				db_result.assign(value, 8);
+			if (!check_result<std::string>(db_result, map_result, cmd_number, cmd))
+				return;
+		}
+		cmd_number++;
+	}
+	size_t count = 0;
+	db.db_scan([&m, &count](const char *key, const char *value) {
+		auto element = m.find(std::string(key, strnlen(key, 4)));
+		if (element == m.end() || element->second != std::string(value, 8))
+			return false;
+		++count;
+		return true;
+	});
+	check_result<size_t>(count, m.size(), cmd_number, 3);
 	db.db_close();
 }
 
-int main() {
-	test_output();
+/*
+ * 在文件里找到pattern，把它中间的一个字节改掉
+ */
+bool flip_byte(const char *pathname, const std::string &pattern) {
+	int fd = open(pathname, O_RDWR);
+	std::string content(lseek(fd, 0, SEEK_END), 0);
+	pread(fd, &content[0], content.length(), 0);
+	size_t position = content.find(pattern);
+	bool found = position != std::string::npos;
+	if (found) {
+		char byte = content[position + pattern.length() / 2] ^ 1;
+		pwrite(fd, &byte, 1, position + pattern.length() / 2);
+	}
+	close(fd);
+	return found;
+}
+
+/*
+ * 变更日志中间的记录损坏时以读写方式打开要失败，不能把后面的记录截掉，cmd记为15
+ * 截掉跟随者已经应用过的记录后，从截掉的序号之前开始跟随要失败，从之后开始照样能跟上
+ */
+void test_log_trim() {
+	vDB::DB db;
+	std::unordered_map<std::string, std::string> m;
+	if (!db.db_open("testdb_trim", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR) || !db.db_change_log()) {
+		printf("db open failed\n");
+		return;
+	}
+	for (int i = 0; i < 20; ++i) {
+		db.db_store("trim" + std::to_string(i), "value" + std::to_string(i), vDB::DB_STORE);
+		m["trim" + std::to_string(i)] = "value" + std::to_string(i);
+	}
+	db.db_close();
+	//重新打开时检查过的位置推到了末尾，之后追加的记录在下次打开时才检查
+	db.db_open("testdb_trim", O_RDWR);
+	db.db_store("midlog_key", "midlog_value", vDB::DB_STORE);
+	m["midlog_key"] = "midlog_value";
+	for (int i = 0; i < 5; ++i) {
+		db.db_store("trim" + std::to_string(i), "again" + std::to_string(i), vDB::DB_STORE);
+		m["trim" + std::to_string(i)] = "again" + std::to_string(i);
+	}
+	db.db_close();
+	vDB::ChangeLog log;
+	bool result = check_result<bool>(flip_byte("testdb_trim.clog", "midlog_key"), true, 0, 15) &&
+		check_result<bool>(log.log_open("testdb_trim.clog", O_RDWR), false, 0, 15) &&
+		check_result<bool>(flip_byte("testdb_trim.clog", "midlof_key"), true, 0, 15) &&
+		check_result<bool>(log.log_open("testdb_trim.clog", O_RDWR), true, 0, 15) &&
+		check_result<long long>(log.log_sequence(), 26, 0, 15);
+	log.log_close();
+	//截掉前10条，之后从0开始跟随失败，副本先有前10条的结果，从10开始能跟上
+	vDB::DB copy;
+	result = result && check_result<bool>(db.db_open("testdb_trim", O_RDWR), true, 0, 15) &&
+		check_result<bool>(db.db_trim_log(10), true, 0, 15) &&
+		check_result<bool>(copy.db_open("testdb_trim_copy", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR), true, 0, 15);
+	for (int i = 0; result && i < 10; ++i)
+		copy.db_store("trim" + std::to_string(i), "value" + std::to_string(i), vDB::DB_STORE);
+	int fd = open("testdb_trim.clog", O_RDONLY);
+	vDB::LogFollower follower;
+	vDB::ChangeLog reader;
+	int pipe_fd[2];
+	result = result && check_result<bool>(follower.follower_open(fd, 0), false, 0, 15) &&
+		check_result<bool>(reader.log_open("testdb_trim.clog", O_RDONLY) && !pipe(pipe_fd), true, 0, 15);
+	if (result) {
+		check_result<long long>(reader.log_copy(pipe_fd[1], 5), -1, 0, 15);
+		close(pipe_fd[0]);
+		close(pipe_fd[1]);
+	}
+	result = result && check_result<bool>(follower.follower_open(fd, 10), true, 0, 15);
+	while (result && follower.follower_apply(copy, 4) > 0) {}
+	result = result && check_result<long long>(follower.follower_sequence(), 26, 0, 15) && check_copy(copy, m, 0, 15);
+	close(fd);
+	copy.db_close();
+	db.db_close();
+	for (const char *name : {"testdb_trim.idx", "testdb_trim.dat", "testdb_trim.clog", "testdb_trim_copy.idx", "testdb_trim_copy.dat"})
+		unlink(name);
+}
+
+/*
+ * 分别改坏.dat里的一个value和.idx里的一个key，读取要失败，校验和错误要被统计到，cmd记为9
+ * db_verify和vdb-verify都要报告错误，vdb-verify需要先在上级目录make vdb-verify
+ */
+void test_checksum() {
+	vDB::DB db;
+	if (!db.db_open("testdb_crc", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) {
+		printf("db open failed\n");
+		return;
+	}
+	for (int i = 0; i < 100; ++i)
+		db.db_store("crc" + std::to_string(i), "value" + std::to_string(i), vDB::DB_STORE);
+	db.db_store("broken_data", "this value will be flipped", vDB::DB_STORE);
+	db.db_store("broken_index_key", "this key will be flipped", vDB::DB_STORE);
+	db.db_close();
+	if (!check_result<bool>(flip_byte("testdb_crc.dat", "this value will be flipped"), true, 0, 9) ||
+		!check_result<bool>(flip_byte("testdb_crc.idx", "broken_index_key"), true, 0, 9))
+		return;
+	db.db_open("testdb_crc", O_RDWR);
+	long long records = 0, errors = 0;
+	check_result<std::string>(db.db_fetch("broken_data"), "", 0, 9) &&
+		check_result<bool>(db.db_stats().checksum_errors > 0, true, 0, 9) &&
+		check_result<std::string>(db.db_fetch("crc7"), "value7", 0, 9) &&
+		check_result<bool>(db.db_verify(2, records, errors), true, 0, 9) &&
+		check_result<long long>(errors, 2, 0, 9);
+	db.db_close();
+	//key被改坏的节点也要报错，不能当成不存在再插入一条，开了共享缓存也一样
+	std::string value;
+	db.db_open("testdb_crc", O_RDWR);
+	if (check_result<bool>(db.db_share_cache(1024), true, 0, 9)) {
+		check_result<int>(db.db_try_fetch("broken_index_key", value, 0), -1, 0, 9) &&
+			check_result<int>(db.db_try_fetch("broken_index_key", value, 0), -1, 0, 9) &&
+			check_result<int>(db.db_store("broken_index_key", "again", vDB::DB_INSERT), -1, 0, 9);
+		db.db_remove_cache();
+	}
+	db.db_close();
+	if (!access("../vdb-verify", X_OK)) {
+		int status = system("../vdb-verify testdb_crc 2 > /dev/null");
+		check_result<int>(WEXITSTATUS(status), 1, 0, 9);
+	}
+	else
+		printf("vdb-verify is not built, skip\n");
+	unlink("testdb_crc.idx");
+	unlink("testdb_crc.dat");
+	//模拟挪到链头时中途崩溃：把hash表里指向唯一节点的ptr清掉，db_verify要报告走不到的节点
+	if (!db.db_open("testdb_crc", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR))
+		return;
+	db.db_store("orphan_key", "orphan_value", vDB::DB_STORE);
+	db.db_close();
+	int fd = open("testdb_crc.idx", O_RDWR);
+	std::string content(lseek(fd, 0, SEEK_END), 0);
+	pread(fd, &content[0], content.length(), 0);
+	//key前面是7字节的ptr，4字节的长度，8字节的校验和，7字节的data偏移量，4字节的data容量
+	char ptr[8];
+	snprintf(ptr, sizeof(ptr), "%7lld", (long long)content.find("orphan_key") - 30);
+	size_t head = content.find(ptr, 7);
+	if (check_result<bool>(head != std::string::npos && head < 138 * 7, true, 0, 9)) {
+		pwrite(fd, "      0", 7, head);
+		db.db_open("testdb_crc", O_RDWR);
+		check_result<bool>(db.db_verify(2, records, errors), true, 0, 9) &&
+			check_result<long long>(errors, 1, 0, 9);
+		db.db_close();
+	}
+	close(fd);
+	unlink("testdb_crc.idx");
+	unlink("testdb_crc.dat");
+}
+
+/*
+ * 两个进程连上同一个共享缓存，子进程不停地改写、删除再插入，父进程同时读，cmd记为10
+ * value开头是写入的轮数，读到的轮数不能比读之前子进程已经完成的轮数小，也不能比上次读到的小
+ */
+void test_shared_cache() {
+	const int kKeys = 50, kRounds = 200;
+	vDB::DB db;
+	if (!db.db_open("testdb_cache", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR) || !db.db_share_cache(1024)) {
+		printf("db open failed\n");
+		return;
+	}
+	auto make_value = [](int round) { return std::to_string(round) + std::string(round % 13 * 10, 'x'); };
+	for (int i = 0; i < kKeys; ++i)
+		db.db_store("cache" + std::to_string(i), make_value(0), vDB::DB_STORE);
+	//子进程已经完成的轮数
+	std::atomic<int> *done = (std::atomic<int> *)mmap(nullptr, sizeof(std::atomic<int>), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	new (done) std::atomic<int>(0);
+	pid_t pid = fork();
+	if (!pid) {
+		vDB::DB writer;
+		if (!writer.db_open("testdb_cache", O_RDWR))
+			_exit(1);
+		for (int round = 1; round <= kRounds; ++round) {
+			for (int i = 0; i < kKeys; ++i) {
+				std::string key = "cache" + std::to_string(i);
+				if ((round + i) % 5 == 0) {
+					writer.db_delete(key);
+					writer.db_store(key, make_value(round), vDB::DB_INSERT);
+				}
+				else
+					writer.db_store(key, make_value(round), vDB::DB_REPLACE);
+			}
+			done->store(round);
+		}
+		_exit(0);
+	}
+	std::vector<int> last(kKeys, 0);
+	bool result = true;
+	while (result && done->load() < kRounds) {
+		for (int i = 0; result && i < kKeys; ++i) {
+			int finished = done->load();
+			std::string value = db.db_fetch("cache" + std::to_string(i));
+			if (value.empty())
+				continue;
+			int round = atoi(value.c_str());
+			result = check_result<bool>(round >= finished && round >= last[i], true, round, 10);
+			last[i] = round;
+		}
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	result = result && check_result<int>(WEXITSTATUS(status), 0, 0, 10);
+	for (int i = 0; result && i < kKeys; ++i)
+		result = check_result<std::string>(db.db_fetch("cache" + std::to_string(i)), make_value(kRounds), 0, 10);
+	check_result<bool>(db.db_remove_cache(), true, 0, 10);
+	munmap(done, sizeof(std::atomic<int>));
+	db.db_close();
+	unlink("testdb_cache.idx");
+	unlink("testdb_cache.dat");
+}
+
+/*
+ * 训练字典后写入相似的value和随机的value，重新打开后字典要被载入，cmd记为11
+ * 相似的value应该压缩存储，随机的value压缩后不会变小，应该原样存储
+ */
+void test_compression() {
+	vDB::DB db;
+	std::unordered_map<std::string, std::string> m;
+	std::vector<std::string> samples;
+	auto make_value = [](int i) {
+		return "{\"id\":" + std::to_string(i) + ",\"name\":\"user" + std::to_string(i * 7) + "\",\"status\":\"active\",\"roles\":[\"reader\",\"writer\"],\"country\":\"cn\"}";
+	};
+	for (int i = 0; i < 200; ++i)
+		samples.push_back(make_value(i + 1000));
+	if (!db.db_open("testdb_zip", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR) || !check_result<bool>(db.db_train_dictionary(samples), true, 0, 11))
+		return;
+	for (int i = 0; i < 300; ++i) {
+		m["zip" + std::to_string(i)] = make_value(i);
+		db.db_store("zip" + std::to_string(i), make_value(i), vDB::DB_STORE);
+	}
+	std::string random(500, 0);
+	srand(11);
+	for (auto &c : random)
+		c = rand();
+	m["random"] = random;
+	db.db_store("random", random, vDB::DB_STORE);
+	vDB::DBStats stats = db.db_stats();
+	if (!check_result<long long>(stats.compressed_records, 300, 0, 11) || !check_result<long long>(stats.raw_records, 1, 0, 11) ||
+		!check_result<bool>(stats.compression_ratio > 1.5, true, 0, 11))
+		return;
+	db.db_close();
+	//统计是跟着对象的，用新的对象打开
+	vDB::DB reopened;
+	if (!reopened.db_open("testdb_zip", O_RDWR) || !check_copy(reopened, m, 0, 11))
+		return;
+	reopened.db_store("zip_after_reopen", make_value(300), vDB::DB_STORE);
+	//重复插入和找不到key的替换都没有写入，不能算进统计
+	reopened.db_store("zip_after_reopen", make_value(301), vDB::DB_INSERT);
+	reopened.db_store("zip_missing", make_value(302), vDB::DB_REPLACE);
+	check_result<long long>(reopened.db_stats().compressed_records, 1, 0, 11) &&
+		check_result<long long>(reopened.db_stats().raw_bytes, make_value(300).length(), 0, 11) &&
+		check_result<std::string>(reopened.db_fetch("zip_after_reopen"), make_value(300), 0, 11);
+	reopened.db_close();
+	unlink("testdb_zip.idx");
+	unlink("testdb_zip.dat");
+}
+
+/*
+ * 批量导入有序的key后逐条对比，key不递增或者数据库不为空时要失败，cmd记为12
+ */
+void test_bulk_load() {
+	vDB::DB db;
+	std::unordered_map<std::string, std::string> m;
+	if (!db.db_open("testdb_bulk", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) {
+		printf("db open failed\n");
+		return;
+	}
+	int next = 0;
+	auto generate = [&next, &m](std::string &key, std::string &value) {
+		if (next == 3000)
+			return false;
+		char buffer[16];
+		sprintf(buffer, "bulk%06d", next);
+		key = buffer;
+		value = std::string(next % 100 + 1, 'a' + next % 26);
+		m[key] = value;
+		++next;
+		return true;
+	};
+	if (!check_result<bool>(db.db_bulk_load(generate), true, 0, 12) || !check_copy(db, m, 0, 12))
+		return;
+	//key不递增，导入失败后数据库应该是空的，而且还能正常写入
+	db.db_open("testdb_bulk", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+	const char *keys[] = {"b", "c", "a"};
+	next = 0;
+	bool result = db.db_bulk_load([&keys, &next](std::string &key, std::string &value) {
+		if (next == 3)
+			return false;
+		key = keys[next++];
+		value = "v";
+		return true;
+	});
+	m.clear();
+	if (!check_result<bool>(result, false, 0, 12) || !check_copy(db, m, 0, 12))
+		return;
+	db.db_store("only", "1", vDB::DB_STORE);
+	m["only"] = "1";
+	next = 0;
+	check_result<bool>(db.db_bulk_load(generate), false, 0, 12);
+	m.clear();
+	m["only"] = "1";
+	check_copy(db, m, 0, 12);
+	db.db_close();
+	unlink("testdb_bulk.idx");
+	unlink("testdb_bulk.dat");
+}
+
+/*
+ * 快照之后的写入只有原数据库看得到，快照是只读的，cmd记为13
+ */
+void test_snapshot() {
+	vDB::DB db, snapshot;
+	std::unordered_map<std::string, std::string> m;
+	if (!db.db_open("testdb_origin", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) {
+		printf("db open failed\n");
+		return;
+	}
+	for (int i = 0; i < 100; ++i) {
+		m["snap" + std::to_string(i)] = std::to_string(i);
+		db.db_store("snap" + std::to_string(i), std::to_string(i), vDB::DB_STORE);
+	}
+	if (!check_result<bool>(db.db_snapshot("testdb_snapshot", snapshot), true, 0, 13))
+		return;
+	db.db_store("snap1", "changed", vDB::DB_STORE);
+	db.db_store("after", "new", vDB::DB_STORE);
+	db.db_delete("snap2");
+	check_copy(snapshot, m, 0, 13) &&
+		check_result<int>(snapshot.db_store("snap3", "x", vDB::DB_STORE), -1, 0, 13) &&
+		check_result<bool>(snapshot.db_delete("snap4"), false, 0, 13) &&
+		check_result<std::string>(snapshot.db_fetch("snap3"), "3", 0, 13) &&
+		check_result<std::string>(snapshot.db_fetch("snap4"), "4", 0, 13) &&
+		check_result<std::string>(db.db_fetch("snap1"), "changed", 0, 13) &&
+		check_result<std::string>(db.db_fetch("after"), "new", 0, 13);
+	snapshot.db_close();
+	db.db_close();
+	unlink("testdb_origin.idx");
+	unlink("testdb_origin.dat");
+	unlink("testdb_snapshot.idx");
+	unlink("testdb_snapshot.dat");
+}
+
+/*
+ * PageDB的记录损坏时读写都要报错，不能当成不存在再插入一份，cmd记为14
+ */
+void test_page() {
+	vDB::PageDB db;
+	if (!db.db_open("testdb_page", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) {
+		printf("db open failed\n");
+		return;
+	}
+	db.db_store("key1", "v1", vDB::DB_STORE);
+	//截到key的中间
+	truncate("testdb_page.pdat", 10);
+	std::string value;
+	size_t count = 0;
+	long long number;
+	check_result<int>(db.db_store("key1", "v2", vDB::DB_INSERT), -1, 0, 14) &&
+		check_result<int>(db.db_store("key1", "v2", vDB::DB_STORE), -1, 0, 14) &&
+		check_result<int>(db.db_try_fetch("key1", value, -1), -1, 0, 14) &&
+		check_result<bool>(db.db_delete("key1"), false, 0, 14) &&
+		check_result<bool>(db.db_increment("key1", 1, number), false, 0, 14) &&
+		check_result<bool>(db.db_scan([&count](const std::string&, const std::string&) { return ++count; }), false, 0, 14);
+	db.db_close();
+
+	/*
+	 * 只有一个桶，每页240个槽，720条正好占满桶页和两个溢出页
+	 * 删掉桶页里的几条后再插入，要先填回桶页的空槽，不能再分配溢出页
+	 */
+	db.db_set_bucket_count(1);
+	if (!db.db_open("testdb_page", O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR)) {
+		printf("db open failed\n");
+		return;
+	}
+	uint32_t buckets = 0;
+	uint64_t overflow = 0;
+	bool result = true;
+	for (int i = 0; result && i < 720; ++i)
+		result = check_result<int>(db.db_store("page" + std::to_string(i), std::to_string(i), vDB::DB_INSERT), 0, i, 14);
+	result = result && check_result<bool>(db.db_page_count(buckets, overflow), true, 0, 14) &&
+		check_result<uint32_t>(buckets, 1, 0, 14) && check_result<uint64_t>(overflow, 2, 0, 14);
+	for (int i = 0; result && i < 10; ++i)
+		result = check_result<bool>(db.db_delete("page" + std::to_string(i)), true, i, 14);
+	for (int i = 720; result && i < 730; ++i)
+		result = check_result<int>(db.db_store("page" + std::to_string(i), std::to_string(i), vDB::DB_INSERT), 0, i, 14);
+	result = result && check_result<bool>(db.db_page_count(buckets, overflow), true, 0, 14) &&
+		check_result<uint64_t>(overflow, 2, 0, 14);
+	//没有空槽了，再插入一条就要挂第三个溢出页
+	result = result && check_result<int>(db.db_store("page730", "730", vDB::DB_INSERT), 0, 730, 14) &&
+		check_result<bool>(db.db_page_count(buckets, overflow), true, 0, 14) &&
+		check_result<uint64_t>(overflow, 3, 0, 14);
+	for (int i = 0; result && i <= 730; ++i)
+		result = check_result<std::string>(db.db_fetch("page" + std::to_string(i)), i < 10 ? std::string() : std::to_string(i), i, 14);
+	count = 0;
+	result && check_result<bool>(db.db_scan([&count](const std::string&, const std::string&) { return ++count; }), true, 0, 14) &&
+		check_result<size_t>(count, 721, 0, 14);
+	db.db_close();
+	unlink("testdb_page.pidx");
+	unlink("testdb_page.pdat");
+}
+
+/*
+ * 在本进程的线程里启动vdb-server，通过客户端读写，cmd记为8
+ * 回复超过一帧上限的MGET要返回STATUS_ERROR，之后连接还能继续用
+ */
+void test_server() {
+	vDB::Server server;
+	int port = 20000 + getpid() % 20000;
+	if (!server.server_open("testdb_server", port, 2, true)) {
+		printf("server open failed\n");
+		return;
+	}
+	std::thread loop([&server]() { server.server_run(); });
+	vDB::Client client;
+	std::vector<std::string> keys, values;
+	std::string value;
+	if (client.client_connect("127.0.0.1", port)) {
+		for (int i = 0; i < 1500; ++i) {
+			keys.push_back("server" + std::to_string(i));
+			client.client_set(keys.back(), std::string(1000, 'a' + i % 26));
+		}
+		check_result<int>(client.client_mget(std::vector<std::string>(keys.begin(), keys.begin() + 10), values), vDB::STATUS_OK, 0, 8) &&
+			check_result<std::string>(values[3], std::string(1000, 'd'), 0, 8) &&
+			check_result<int>(client.client_mget(keys, values), vDB::STATUS_ERROR, 0, 8) &&
+			check_result<int>(client.client_get(keys[1], value), vDB::STATUS_OK, 0, 8) &&
+			check_result<std::string>(value, std::string(1000, 'b'), 0, 8);
+	}
+	else
+		printf("client connect failed\n");
+	client.client_close();
+
+	//发完请求马上关闭写端，server读到EOF后也要把已经收到的请求都回复完再关闭
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	if (fd >= 0 && !connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		std::string output, input;
+		std::vector<int> ops;
+		for (int i = 0; i < 200; ++i) {
+			vDB::Request request;
+			request.op = i % 2 ? vDB::OP_GET : vDB::OP_SET;
+			request.keys.push_back("eof" + std::to_string(i / 2));
+			request.value = std::to_string(i / 2);
+			vDB::encode_request(request, output);
+			ops.push_back(request.op);
+		}
+		send(fd, output.data(), output.length(), MSG_NOSIGNAL);
+		shutdown(fd, SHUT_WR);
+		char buffer[4096];
+		ssize_t n;
+		while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+			input.append(buffer, n);
+		size_t offset = 0, i = 0;
+		bool result = true;
+		for (; result && i < ops.size(); ++i) {
+			vDB::Response response;
+			int length = vDB::decode_response(ops[i], input.data() + offset, input.length() - offset, response);
+			if (!check_result<bool>(length > 0, true, i, 8))
+				break;
+			offset += length;
+			result = check_result<int>(response.status, vDB::STATUS_OK, i, 8) &&
+				(ops[i] != vDB::OP_GET || check_result<std::string>(response.values[0], std::to_string(i / 2), i, 8));
+		}
+		check_result<size_t>(i, ops.size(), 0, 8);
+	}
+	else
+		printf("connect failed\n");
+	if (fd >= 0)
+		close(fd);
+	server.server_stop();
+	loop.join();
+	server.server_close();
+	unlink("testdb_server.idx");
+	unlink("testdb_server.dat");
+}
+
+/*
+ * 带参数log时测试LogDB，mem时测试MemDB，page时测试PageDB和它的损坏记录，pool时测试开启了缓冲池的DB
+ * adaptive时测试开启了自适应hash链的DB，fixed时测试FixedDB，server时测试vdb-server
+ * 否则测试DB，再测试DB的校验和，多进程共享缓存，压缩，批量导入和快照
+ */
+int main(int argc, char *argv[]) {
+	if (argc > 1 && !strcmp(argv[1], "log")) {
+		vDB::LogDB db;
+		test_output(db, 0, 0, false);
+		test_log_merge();
+	}
+	else if (argc > 1 && !strcmp(argv[1], "mem")) {
+		vDB::MemDB db;
+		test_output(db, 0, 0, false);
+	}
+	else if (argc > 1 && !strcmp(argv[1], "page")) {
+		vDB::PageDB db;
+		test_output(db, 0, 0, false);
+		test_page();
+	}
+	else if (argc > 1 && !strcmp(argv[1], "pool")) {
+		//缓冲池故意开得很小，让淘汰和写回都经常发生
+		vDB::DB db;
+		test_output(db, 64 * 1024);
+	}
+	else if (argc > 1 && !strcmp(argv[1], "adaptive")) {
+		//每次命中都挪到链头，让链表被频繁改动
+		vDB::DB db;
+		test_output(db, 0, 1);
+	}
+	else if (argc > 1 && !strcmp(argv[1], "fixed"))
+		test_fixed();
+	else if (argc > 1 && !strcmp(argv[1], "server"))
+		test_server();
+	else {
+		vDB::DB db;
+		test_output(db);
+		test_checksum();
+		test_log_trim();
+		test_shared_cache();
+		test_compression();
+		test_bulk_load();
+		test_snapshot();
+	}
 }
@@ -0,0 +1,60 @@
+#include "../include/v_db.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*
+ * 用法：vdb-dump 数据库路径 导出文件 [线程数]
+ *       vdb-dump -r 数据库路径 导出文件
+ * 第一种把数据库导出到文件，以只读方式打开，可以在数据库使用中运行
+ * 第二种用导出文件新建数据库，数据库已经存在时失败，成功后打印导出时变更日志的序号，副本从这里开始跟随
+ * 错误信息会打印到标准输出，所以导出文件不能是标准输出，需要管道时可以用命名管道
+ * 成功返回0，失败返回1
+ */
+int main(int argc, char *argv[]) {
+	bool restore = argc > 1 && !strcmp(argv[1], "-r");
+	if (argc < 3 + restore) {
+		printf("usage: %s pathname file [threads]\n       %s -r pathname file\n", argv[0], argv[0]);
+		return 1;
+	}
+	const char *pathname = argv[1 + restore], *file = argv[2 + restore];
+	vDB::DB db;
+	if (restore) {
+		int fd = open(file, O_RDONLY);
+		if (fd < 0) {
+			printf("vdb-dump: open %s error\n", file);
+			return 1;
+		}
+		if (!db.db_open(pathname, O_RDWR | O_CREAT | O_EXCL | O_TRUNC, S_IRUSR | S_IWUSR)) {
+			printf("vdb-dump: create %s error\n", pathname);
+			return 1;
+		}
+		long long sequence = 0;
+		bool result = db.db_restore(fd, sequence);
+		close(fd);
+		if (result)
+			printf("sequence %lld\n", sequence);
+		return result ? 0 : 1;
+	}
+	int threads = argc > 3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
+	if (threads < 1)
+		threads = 1;
+	if (!db.db_open(pathname, O_RDONLY)) {
+		printf("vdb-dump: open %s error\n", pathname);
+		return 1;
+	}
+	int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		printf("vdb-dump: open %s error\n", file);
+		return 1;
+	}
+	bool result = db.db_dump(fd, threads);
+	if (close(fd) < 0)
+		result = false;
+	return result ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+#include "../include/v_db_server.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <signal.h>
+
+vDB::Server server;
+
+void handle_signal(int) {
+	server.server_stop();
+}
+
+/*
+ * 用法：vdb-server 数据库路径 [端口] [工作线程数] [-c]
+ * -c表示重新创建数据库
+ */
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("usage: %s pathname [port] [workers] [-c]\n", argv[0]);
+		return 1;
+	}
+	int port = argc > 2 ? atoi(argv[2]) : 6380;
+	int workers = argc > 3 ? atoi(argv[3]) : 4;
+	bool create = argc > 4 && !strcmp(argv[4], "-c");
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+	if (!server.server_open(argv[1], port, workers, create))
+		return 1;
+	printf("vdb-server: listening on port %d with %d workers\n", port, workers);
+	server.server_run();
+	server.server_close();
+	return 0;
+}
@@ -0,0 +1,31 @@
+#include "../include/v_db.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <fcntl.h>
+
+/*
+ * 用法：vdb-verify 数据库路径 [线程数]
+ * 校验数据库里所有index记录和data记录的校验和，以只读方式打开，可以在数据库使用中运行
+ * 全部正确返回0，有错误返回1
+ */
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		printf("usage: %s pathname [threads]\n", argv[0]);
+		return 1;
+	}
+	int threads = argc > 2 ? atoi(argv[2]) : std::thread::hardware_concurrency();
+	if (threads < 1)
+		threads = 1;
+	vDB::DB db;
+	if (!db.db_open(argv[1], O_RDONLY)) {
+		printf("vdb-verify: open %s error\n", argv[1]);
+		return 1;
+	}
+	long long records, errors;
+	if (!db.db_verify(threads, records, errors))
+		return 1;
+	printf("vdb-verify: %lld records checked, %lld errors\n", records, errors);
+	return errors ? 1 : 0;
+}